@@ -0,0 +1,42 @@
+// Generated by tools/pnpgen.awk, do not edit
+#ifndef _PNP_IDS_H_
+#define _PNP_IDS_H_
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+// (PNT0001\\MOUSE\PNP0F01\PONTAG Microsoft Mouse4F)
+static const uint8_t pnp_id_ms[] PROGMEM __attribute__((unused)) = {
+    0x08, 0x01, 0x24, 0x30, 0x2E, 0x34, 0x10, 0x10, 0x10, 0x11, 0x3C, 0x3C,
+    0x2D, 0x2F, 0x35, 0x33, 0x25, 0x3C, 0x30, 0x2E, 0x30, 0x10, 0x26, 0x10,
+    0x11, 0x3C, 0x30, 0x2F, 0x2E, 0x34, 0x21, 0x27, 0x00, 0x2D, 0x29, 0x23,
+    0x32, 0x2F, 0x33, 0x2F, 0x26, 0x34, 0x00, 0x2D, 0x2F, 0x35, 0x33, 0x25,
+    0x14, 0x26, 0x09
+};
+
+// (PNT0002\\MOUSE\PNP0F0C\PONTAG Microsoft Wheel Mouse37)
+static const uint8_t pnp_id_mswheel[] PROGMEM __attribute__((unused)) = {
+    0x08, 0x01, 0x24, 0x30, 0x2E, 0x34, 0x10, 0x10, 0x10, 0x12, 0x3C, 0x3C,
+    0x2D, 0x2F, 0x35, 0x33, 0x25, 0x3C, 0x30, 0x2E, 0x30, 0x10, 0x26, 0x10,
+    0x23, 0x3C, 0x30, 0x2F, 0x2E, 0x34, 0x21, 0x27, 0x00, 0x2D, 0x29, 0x23,
+    0x32, 0x2F, 0x33, 0x2F, 0x26, 0x34, 0x00, 0x37, 0x28, 0x25, 0x25, 0x2C,
+    0x00, 0x2D, 0x2F, 0x35, 0x33, 0x25, 0x13, 0x17, 0x09
+};
+
+// (PNT0003\\MOUSE\PNP0F08,PNP0F0C\PONTAG Logitech Mouse14)
+static const uint8_t pnp_id_logi[] PROGMEM __attribute__((unused)) = {
+    0x08, 0x01, 0x24, 0x30, 0x2E, 0x34, 0x10, 0x10, 0x10, 0x13, 0x3C, 0x3C,
+    0x2D, 0x2F, 0x35, 0x33, 0x25, 0x3C, 0x30, 0x2E, 0x30, 0x10, 0x26, 0x10,
+    0x18, 0x0C, 0x30, 0x2E, 0x30, 0x10, 0x26, 0x10, 0x23, 0x3C, 0x30, 0x2F,
+    0x2E, 0x34, 0x21, 0x27, 0x00, 0x2C, 0x2F, 0x27, 0x29, 0x34, 0x25, 0x23,
+    0x28, 0x00, 0x2D, 0x2F, 0x35, 0x33, 0x25, 0x11, 0x14, 0x09
+};
+
+// (LGI8050\\MOUSE\PNP0F08,PNP0F0C8B)
+static const uint8_t pnp_id_logiwhl[] PROGMEM __attribute__((unused)) = {
+    0x08, 0x01, 0x24, 0x2C, 0x27, 0x29, 0x18, 0x10, 0x15, 0x10, 0x3C, 0x3C,
+    0x2D, 0x2F, 0x35, 0x33, 0x25, 0x3C, 0x30, 0x2E, 0x30, 0x10, 0x26, 0x10,
+    0x18, 0x0C, 0x30, 0x2E, 0x30, 0x10, 0x26, 0x10, 0x23, 0x18, 0x22, 0x09
+};
+
+#endif /* _PNP_IDS_H_ */
@@ -0,0 +1,150 @@
+// Shared pieces of the host benchmarks and checks, see bench.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+#include "hostcmd.h"
+#include "ps2dev.h"
+
+const char *const bench_proto_names[CFG_PROTO_COUNT] = { "mswheel", "ms", "msys", "logi", "logiwhl", "mm" };
+const uint16_t bench_baud_rates[UART_BAUD_COUNT] = { 1200, 2400, 4800, 9600 };
+
+static const uint8_t *send_bytes;
+static uint8_t send_len, send_pos;
+
+static void (*seq_setup)(void);
+static void (*seq_start)(void);
+static uint32_t seq_settle_ms;
+static uint8_t seq_armed;
+
+uint8_t bench_proto(const char *name) {
+    uint8_t proto;
+
+    for(proto = 0; proto < CFG_PROTO_COUNT; proto++) {
+        if(!strcmp(name, bench_proto_names[proto])) break;
+    }
+
+    return proto;
+}
+
+uint8_t bench_baud(const char *bps) {
+    long b = strtol(bps, NULL, 10);
+    uint8_t baud;
+
+    for(baud = 0; baud < UART_BAUD_COUNT; baud++) {
+        if(bench_baud_rates[baud] == b) break;
+    }
+
+    return baud;
+}
+
+hal_time_t bench_frame_time(void) {
+    return (HAL_HOST_MS(1000) * hal_host_uart_frame_bits()) / hal_host_uart_baud();
+}
+
+static void send_next(void *ctx) {
+    hal_host_uart_rx(send_bytes[send_pos++]);
+    if(send_pos < send_len) hal_host_at(hal_host_now() + bench_frame_time(), send_next, NULL);
+}
+
+void bench_send(const uint8_t *bytes, uint8_t len) {
+    send_bytes = bytes;
+    send_len = len;
+    send_pos = 0;
+    if(len) send_next(NULL);
+}
+
+void bench_configure(uint8_t proto, uint8_t rate, uint8_t baud) {
+    static uint8_t cmds[12];
+
+    memcpy(cmds, (const uint8_t []){ '*', '=', HOSTPARAM_PROTO, proto, '*', '=', HOSTPARAM_RATE, rate,
+                                     '*', '=', HOSTPARAM_BAUD, baud }, sizeof(cmds));
+    bench_send(cmds, sizeof(cmds));
+}
+
+static void seq_run_start(void *ctx) {
+    seq_start();
+}
+
+static void seq_run_setup(void *ctx) {
+    if(seq_setup) seq_setup();
+
+    if(seq_settle_ms) hal_host_at(hal_host_now() + HAL_HOST_MS(seq_settle_ms), seq_run_start, NULL);
+    else seq_start();
+}
+
+static void seq_stream_changed(uint8_t on) {
+    if(!on || !seq_armed) return;
+
+    seq_armed = 0;
+    hal_host_at(hal_host_now() + HAL_HOST_MS(BENCH_SETUP_DELAY_MS), seq_run_setup, NULL);
+}
+
+void bench_sequence(void (*setup)(void), uint32_t settle_ms, void (*start)(void)) {
+    seq_setup = setup;
+    seq_settle_ms = settle_ms;
+    seq_start = start;
+    seq_armed = 1;
+    ps2dev_on_stream(seq_stream_changed);
+}
+
+uint8_t bench_fork(void (*run)(void), const void *result, void *dst, size_t size) {
+    int fds[2];
+    pid_t pid;
+    uint8_t *buf = malloc(size);
+    uint8_t done;
+
+    if(!buf) abort();
+
+    if(pipe(fds)) {
+        perror("pipe");
+        exit(1);
+    }
+    fflush(NULL);
+
+    pid = fork();
+    if(pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if(!pid) {
+        close(fds[0]);
+        run();
+        if(write(fds[1], result, size) != (ssize_t)size) _exit(1);
+        _exit(0);
+    }
+
+    close(fds[1]);
+    done = (read(fds[0], buf, size) == (ssize_t)size);
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+
+    if(done) memcpy(dst, buf, size);
+    free(buf);
+
+    return done;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+void bench_sort(uint32_t *values, size_t count) {
+    qsort(values, count, sizeof(uint32_t), cmp_u32);
+}
+
+uint32_t bench_percentile(const uint32_t *sorted, size_t count, double p) {
+    size_t rank = (size_t)((p / 100.0) * count + 0.999999);
+
+    if(!count) return 0;
+    if(rank < 1) rank = 1;
+    if(rank > count) rank = count;
+
+    return sorted[rank - 1];
+}
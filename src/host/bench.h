@@ -0,0 +1,82 @@
+#ifndef _BENCH_HEADER_
+#define _BENCH_HEADER_
+
+// What the benchmarks and the checks of the host tools share: the names of the serial protocols and
+// speeds, the host commands they send, and the sequence every run goes through.
+//
+// A run boots the firmware on the host HAL against ps2dev. The first time the board enables the mouse,
+// it gets BENCH_SETUP_DELAY_MS to be done blinking. Then the host configures it (bench_configure()
+// sends the commands one frame time apart, like a real host), and the measure starts once the board
+// has settled. The firmware keeps its state in globals, so every run goes in a process of its own.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hal.h"
+#include "pconfig.h"
+#include "uart_baud.h"
+
+#define BENCH_SETUP_DELAY_MS 3000 // From the first time the mouse is enabled, the board is done blinking
+#define BENCH_SETTLE_MS 1000 // From the commands to the measure window
+
+// Names of the CFG_PROTO_* values, as the options take them
+extern const char *const bench_proto_names[CFG_PROTO_COUNT];
+// Speeds of the UART_BAUD_* values, in bps
+extern const uint16_t bench_baud_rates[UART_BAUD_COUNT];
+
+/**
+ * Looks up a protocol by name
+ * @return One of the CFG_PROTO_* values, CFG_PROTO_COUNT if there is no such protocol
+ */
+uint8_t bench_proto(const char *name);
+
+/**
+ * Looks up a speed of the serial port
+ * @return One of the UART_BAUD_* values, UART_BAUD_COUNT if the firmware has no such speed
+ */
+uint8_t bench_baud(const char *bps);
+
+// Time a byte takes on the serial line, at its current speed
+hal_time_t bench_frame_time(void);
+
+/**
+ * Sends bytes to the board one frame time apart, as a host would. One sequence at a time.
+ * @param bytes The bytes, they must stay there until they are all sent
+ * @param len How many
+ */
+void bench_send(const uint8_t *bytes, uint8_t len);
+
+// Sends the commands that select a protocol (CFG_PROTO_*), a PS/2 sample rate and a speed (UART_BAUD_*)
+void bench_configure(uint8_t proto, uint8_t rate, uint8_t baud);
+
+/**
+ * Arms the sequence of a run, before hal_host_run(): it takes over ps2dev_on_stream()
+ * @param setup Called when the board is done blinking, e.g. to configure it. NULL for nothing
+ * @param settle_ms From setup to start
+ * @param start Called when the measure starts
+ */
+void bench_sequence(void (*setup)(void), uint32_t settle_ms, void (*start)(void));
+
+/**
+ * Runs in a new process and brings back its result
+ * @param run Runs the firmware, leaving the result in *result
+ * @param result Where run leaves its result, in the new process
+ * @param dst Where the result is copied, left alone if the run did not complete
+ * @param size Size of the result
+ * @return 1 if the run completed, 0 if not
+ */
+uint8_t bench_fork(void (*run)(void), const void *result, void *dst, size_t size);
+
+// Sorts values in ascending order, for bench_percentile()
+void bench_sort(uint32_t *values, size_t count);
+
+/**
+ * Percentile of a set of values
+ * @param sorted The values, see bench_sort()
+ * @param count How many, can be 0
+ * @param p Percentile, 0 to 100
+ * @return The smallest value with at least p% of the values at or below it, 0 without values
+ */
+uint32_t bench_percentile(const uint32_t *sorted, size_t count, double p);
+
+#endif /* _BENCH_HEADER_ */
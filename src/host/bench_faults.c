@@ -0,0 +1,382 @@
+// Fault injection benchmark: runs the firmware on the host HAL against a simulated PS/2 wheel mouse
+// whose frames get corrupted on the way, as on a long cable or behind a KVM switch, and measures how
+// the board gets back on its feet: PS/2 error recovery in ps2.c, then the resync of the main loop on
+// bit 3 of the first report byte.
+//
+// The mouse moves by a different amount at every sample, and the serial line is fast enough for every
+// report to get its own packet. A packet is correct when it carries exactly the movement of one of the
+// reports the mouse sent, in order; the reports skipped on the way are lost, and a packet matching no
+// report is corrupted: movement the computer sees that the mouse never made.
+//
+// For every fault, the recovery time runs from the start of the faulty frame to the end of the first
+// correct packet delivering a report that ended after it.
+//
+// Scenarios, each in a fresh process: bit flips (data, parity, start or stop bit inverted), dropped
+// clock pulses, truncated frames, and the three mixed at the same overall rate. Rates given on the
+// command line replace them with a single custom scenario.
+//
+// Usage: pontag-bench-faults [-f rate] [--flip P] [--drop P] [--truncate P] [-t seconds] [-o results.json]
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal.h"
+#include "ps2dev.h"
+#include "perf.h"
+#include "pconfig.h"
+#include "uart_baud.h"
+#include "serdec.h"
+#include "bench.h"
+
+#define DRAIN_MS 2000 // After the window, for the reports still on their way
+#define MATCH_AHEAD 256 // Reports a packet is looked up in, from the oldest one not delivered yet
+
+int firmware_main(void);
+
+enum {
+    SC_FLIP = 0,
+    SC_DROP,
+    SC_TRUNCATE,
+    SC_MIXED,
+    SC_CUSTOM
+};
+
+typedef struct {
+    uint8_t ok;
+    uint32_t frames; // PS/2 frames the mouse sent during the window
+    uint32_t faults;
+    uint32_t reports;
+    uint32_t packets;
+    uint32_t correct;
+    uint32_t corrupted;
+    uint32_t lost;
+    uint32_t unrecovered; // Faults with no correct packet after them
+    double mean_ms;
+    double p50_ms, p95_ms, max_ms;
+    uint16_t parity, framing, recover, resyncs, ps2_overflow;
+} Result;
+
+typedef struct {
+    int16_t dx, dy;
+    hal_time_t end; // End of the last PS/2 stop bit
+} Sent;
+
+static const char *const scenario_names[] = { "flip", "drop", "truncate", "mixed", "custom" };
+
+// Options
+static uint8_t proto = CFG_PROTO_MSWHEEL;
+static uint8_t baud = UART_BAUD_9600;
+static uint8_t rate = 40;
+static double fault_rate = 0.005; // Per frame
+static Ps2DevFaults custom;
+static double window = 60.0; // Seconds
+static uint32_t seed = 1;
+
+// Current run
+static uint8_t scenario;
+static Ps2DevFaults faults;
+static Result res;
+static uint8_t moving, measuring;
+static uint32_t sample_count;
+static uint32_t frames_start;
+static PerfStats perf_start;
+
+// Reports waiting for their packet
+static Sent *sent;
+static size_t sent_head, sent_tail, sent_cap;
+
+// Faults waiting for a correct packet, and their recovery times in microseconds
+static hal_time_t *fault_times;
+static size_t fault_head, fault_tail, fault_cap;
+static uint32_t *recoveries;
+static size_t recovery_count, recovery_cap;
+
+// Serial output
+static SerDec dec;
+static int32_t last_x, last_y, last_z;
+
+static void *grow(void *buf, size_t *cap, size_t size) {
+    *cap = *cap ? (*cap * 2) : 1024;
+    buf = realloc(buf, *cap * size);
+    if(!buf) abort();
+
+    return buf;
+}
+
+// Mouse side
+
+static void sample(void) {
+    int16_t dx, dy;
+
+    if(!moving) return;
+
+    // Every pair comes back only every 199 samples, a corrupted packet is unlikely to pass for a report
+    dx = (int16_t)((sample_count * 37) % 199) - 99;
+    dy = (int16_t)((sample_count * 53) % 199) - 99;
+    if(!dx && !dy) dx = 1;
+    sample_count++;
+
+    ps2dev_move(dx, dy, 0);
+}
+
+static void report_sent(const uint8_t *report, uint8_t len, hal_time_t end) {
+    if(!measuring) return;
+
+    if(sent_tail == sent_cap) sent = grow(sent, &sent_cap, sizeof(Sent));
+    sent[sent_tail].dx = (report[0] & 0x10) ? ((int16_t)report[1] - 256) : report[1];
+    sent[sent_tail].dy = (report[0] & 0x20) ? ((int16_t)report[2] - 256) : report[2];
+    sent[sent_tail].end = end;
+    sent_tail++;
+    res.reports++;
+}
+
+static void fault_injected(uint8_t kind, uint8_t bit, hal_time_t when) {
+    if(!measuring) return;
+
+    if(fault_tail == fault_cap) fault_times = grow(fault_times, &fault_cap, sizeof(hal_time_t));
+    fault_times[fault_tail++] = when;
+}
+
+// Serial side
+
+static void recovered(hal_time_t report_end, hal_time_t end) {
+    while((fault_head < fault_tail) && (fault_times[fault_head] < report_end)) {
+        if(recovery_count == recovery_cap) recoveries = grow(recoveries, &recovery_cap, sizeof(uint32_t));
+        recoveries[recovery_count++] = (uint32_t)(((end - fault_times[fault_head]) * 1000000ULL) / F_CPU);
+        fault_head++;
+    }
+}
+
+static void uart_tx(uint8_t b, hal_time_t end) {
+    int32_t dx, dy, dz;
+    size_t idx, last;
+
+    if(!measuring || !serdec_feed(&dec, b)) return;
+
+    dx = dec.x - last_x;
+    dy = dec.y - last_y;
+    dz = dec.z - last_z;
+    last_x = dec.x;
+    last_y = dec.y;
+    last_z = dec.z;
+    res.packets++;
+
+    last = sent_head + MATCH_AHEAD;
+    if(last > sent_tail) last = sent_tail;
+    for(idx = sent_head; idx < last; idx++) {
+        if((sent[idx].dx == dx) && (sent[idx].dy == dy) && !dz) break;
+    }
+
+    if(idx == last) {
+        res.corrupted++;
+        return;
+    }
+
+    res.correct++;
+    res.lost += idx - sent_head;
+    sent_head = idx + 1;
+    recovered(sent[idx].end, end);
+}
+
+// Sequence
+
+static void finish(void *ctx) {
+    PerfStats now;
+    double sum = 0;
+
+    res.ok = measuring;
+    measuring = 0;
+
+    res.frames = ps2dev_stats()->bytes_sent - frames_start;
+    res.faults = fault_tail;
+    res.lost += sent_tail - sent_head;
+    res.unrecovered = fault_tail - fault_head;
+
+    bench_sort(recoveries, recovery_count);
+    for(size_t idx = 0; idx < recovery_count; idx++) sum += recoveries[idx];
+    res.mean_ms = recovery_count ? (sum / recovery_count / 1000.0) : 0.0;
+    res.p50_ms = bench_percentile(recoveries, recovery_count, 50) / 1000.0;
+    res.p95_ms = bench_percentile(recoveries, recovery_count, 95) / 1000.0;
+    res.max_ms = recovery_count ? (recoveries[recovery_count - 1] / 1000.0) : 0.0;
+
+    perf_get(&now);
+    res.parity = now.ps2_parity_err - perf_start.ps2_parity_err;
+    res.framing = now.ps2_frame_err - perf_start.ps2_frame_err;
+    res.recover = now.ps2_recover - perf_start.ps2_recover;
+    res.resyncs = now.resyncs - perf_start.resyncs;
+    res.ps2_overflow = now.ps2_overflow - perf_start.ps2_overflow;
+
+    hal_host_stop(HAL_HOST_STOP);
+}
+
+static void window_done(void *ctx) {
+    moving = 0;
+    ps2dev_faults(NULL);
+    hal_host_at(hal_host_now() + HAL_HOST_MS(DRAIN_MS), finish, NULL);
+}
+
+static void window_start(void) {
+    serdec_init(&dec, proto);
+    measuring = 1;
+    moving = 1;
+    frames_start = ps2dev_stats()->bytes_sent;
+    perf_get(&perf_start);
+    ps2dev_faults(&faults);
+
+    hal_host_at(hal_host_now() + (hal_time_t)(window * F_CPU), window_done, NULL);
+}
+
+static void setup(void) {
+    bench_configure(proto, rate, baud);
+}
+
+// Runs in its own process, for the current scenario
+static void run(void) {
+    memset(&faults, 0, sizeof(faults));
+    switch(scenario) {
+    case SC_FLIP: faults.flip = fault_rate; break;
+    case SC_DROP: faults.drop = fault_rate; break;
+    case SC_TRUNCATE: faults.truncate = fault_rate; break;
+    case SC_MIXED:
+        // At most one fault per frame, the later kinds get their chance only without the earlier ones
+        faults.flip = fault_rate / 3;
+        faults.drop = (fault_rate / 3) / (1 - faults.flip);
+        faults.truncate = (fault_rate / 3) / (1 - faults.flip - (fault_rate / 3));
+        break;
+    default: faults = custom; break;
+    }
+    faults.seed = seed;
+
+    hal_host_on_uart_tx(uart_tx);
+    ps2dev_init(PS2DEV_WHEEL);
+    ps2dev_on_sample(sample);
+    ps2dev_on_report(report_sent);
+    ps2dev_on_fault(fault_injected);
+    bench_sequence(setup, BENCH_SETTLE_MS, window_start);
+
+    // Way longer than needed, in case the board never gets to stream
+    hal_host_at(HAL_HOST_MS(BENCH_SETUP_DELAY_MS + BENCH_SETTLE_MS + DRAIN_MS + 10000) + (hal_time_t)(window * F_CPU), finish, NULL);
+    hal_host_run(firmware_main);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -p, --proto NAME    mswheel, ms, msys, logi, logiwhl or mm (mswheel)\n"
+            "  -b, --baud N        1200, 2400, 4800 or 9600 (9600)\n"
+            "  -r, --rate N        PS/2 sample rate (40)\n"
+            "  -f, --faults P      Fault probability per frame of the built-in scenarios (0.005)\n"
+            "      --flip P        Bit flip probability per frame   \\\n"
+            "      --drop P        Dropped clock pulse probability  | any of them: a single custom scenario\n"
+            "      --truncate P    Truncated frame probability      /\n"
+            "  -s, --seed N        Fault generator seed (1)\n"
+            "  -t, --time S        Seconds of faulty movement for each scenario (60)\n"
+            "  -o, --output FILE   Write the results as JSON\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    static const struct option opts[] = {
+        { "proto", required_argument, NULL, 'p' },
+        { "baud", required_argument, NULL, 'b' },
+        { "rate", required_argument, NULL, 'r' },
+        { "faults", required_argument, NULL, 'f' },
+        { "flip", required_argument, NULL, 'F' },
+        { "drop", required_argument, NULL, 'D' },
+        { "truncate", required_argument, NULL, 'T' },
+        { "seed", required_argument, NULL, 's' },
+        { "time", required_argument, NULL, 't' },
+        { "output", required_argument, NULL, 'o' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    const char *out = NULL;
+    FILE *json = NULL;
+    int opt, failed = 0;
+    uint8_t first, last;
+
+    first = SC_FLIP;
+    last = SC_MIXED;
+
+    while((opt = getopt_long(argc, argv, "p:b:r:f:s:t:o:h", opts, NULL)) != -1) {
+        switch(opt) {
+        case 'p':
+            proto = bench_proto(optarg);
+            if(proto == CFG_PROTO_COUNT) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'b':
+            baud = bench_baud(optarg);
+            if(baud == UART_BAUD_COUNT) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'r': rate = atoi(optarg); break;
+        case 'f': fault_rate = atof(optarg); break;
+        case 'F': custom.flip = atof(optarg); first = last = SC_CUSTOM; break;
+        case 'D': custom.drop = atof(optarg); first = last = SC_CUSTOM; break;
+        case 'T': custom.truncate = atof(optarg); first = last = SC_CUSTOM; break;
+        case 's': seed = strtoul(optarg, NULL, 0); break;
+        case 't': window = atof(optarg); break;
+        case 'o': out = optarg; break;
+        default:
+            usage(argv[0]);
+            return (opt == 'h') ? 0 : 1;
+        }
+    }
+    if((window <= 0) || (fault_rate < 0) || (fault_rate > 1)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if(out && !(json = fopen(out, "w"))) {
+        perror(out);
+        return 1;
+    }
+    if(json) fprintf(json, "{\"f_cpu\": %lu, \"proto\": \"%s\", \"baud\": %u, \"rate\": %u, \"seconds\": %.3f, \"seed\": %lu, \"scenarios\": [\n",
+                     (unsigned long)F_CPU, bench_proto_names[proto], bench_baud_rates[baud], rate, window, (unsigned long)seed);
+
+    fprintf(stderr, "F_CPU %lu Hz, %s at %u bps, %u reports/s, %.1f s per scenario\n",
+            (unsigned long)F_CPU, bench_proto_names[proto], bench_baud_rates[baud], rate, window);
+    if(first != SC_CUSTOM) fprintf(stderr, "Fault probability per frame: %g\n", fault_rate);
+    else fprintf(stderr, "Fault probability per frame: flip %g, drop %g, truncate %g\n", custom.flip, custom.drop, custom.truncate);
+    fprintf(stderr, "%-8s %6s %6s %7s %7s %9s %5s %6s %8s %8s %8s | %6s %7s %7s %7s\n",
+            "scenario", "frames", "faults", "reports", "correct", "corrupted", "lost", "unrec", "mean ms", "p95 ms", "max ms",
+            "parity", "framing", "recover", "resyncs");
+
+    for(uint8_t sc = first; sc <= last; sc++) {
+        Result r;
+
+        memset(&r, 0, sizeof(r));
+        scenario = sc;
+        bench_fork(run, &res, &r, sizeof(r));
+
+        if(!r.ok) failed = 1;
+
+        fprintf(stderr, "%-8s %6u %6u %7u %7u %9u %5u %6u %8.1f %8.1f %8.1f | %6u %7u %7u %7u%s\n",
+                scenario_names[sc], r.frames, r.faults, r.reports, r.correct, r.corrupted, r.lost, r.unrecovered,
+                r.mean_ms, r.p95_ms, r.max_ms, r.parity, r.framing, r.recover, r.resyncs, r.ok ? "" : "  FAILED");
+        if(json) {
+            fprintf(json, "%s    {\"scenario\": \"%s\", \"ok\": %s, \"frames\": %u, \"faults\": %u, \"reports\": %u, \"packets\": %u, "
+                          "\"correct\": %u, \"corrupted\": %u, \"lost\": %u, \"unrecovered\": %u, "
+                          "\"recovery_mean_ms\": %.3f, \"recovery_p50_ms\": %.3f, \"recovery_p95_ms\": %.3f, \"recovery_max_ms\": %.3f, "
+                          "\"parity\": %u, \"framing\": %u, \"recover\": %u, \"resyncs\": %u, \"ps2_overflow\": %u}",
+                    (sc != first) ? ",\n" : "", scenario_names[sc], r.ok ? "true" : "false", r.frames, r.faults, r.reports, r.packets,
+                    r.correct, r.corrupted, r.lost, r.unrecovered, r.mean_ms, r.p50_ms, r.p95_ms, r.max_ms,
+                    r.parity, r.framing, r.recover, r.resyncs, r.ps2_overflow);
+        }
+    }
+
+    if(json) {
+        fprintf(json, "\n  ]}\n");
+        fclose(json);
+    }
+
+    return failed;
+}
@@ -0,0 +1,349 @@
+// End-to-end latency benchmark: runs the firmware on the host HAL against a simulated PS/2 wheel mouse
+// and measures, for every movement report, the time from the end of its last PS/2 stop bit to the end
+// of the serial packet that delivers it, through the ISRs, the main loop, the output scheduler and the UART.
+//
+// The mouse only moves right, so the reports can be matched with the serial packets by the distance
+// covered: a report is delivered by the first packet that brings the decoded X movement up to the
+// total of the reports until it. That holds when the scheduler merges reports or splits them.
+//
+// Workloads, each in a fresh process:
+//   idle    a single small movement every IDLE_PERIOD_MS, the board waits for it with nothing else to do
+//   steady  a small movement at every sample
+//   burst   large movements at every sample for BURST_MS out of every BURST_PERIOD_MS, more than the serial
+//           line can carry at low speeds
+//   rts     steady, with the host probing for the mouse (RTS toggled twice) every RTS_PERIOD_MS. The board
+//           throws away what it holds and identifies itself: the reports it had are counted as dropped.
+//           This one runs at the power-on settings, the ones a probe brings the board back to.
+//
+// Usage: pontag-bench-latency [-p proto] [-b baud] [-r rate] [-t seconds] [-o results.json]
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal.h"
+#include "ps2dev.h"
+#include "pconfig.h"
+#include "uart_baud.h"
+#include "serdec.h"
+#include "bench.h"
+
+#define DRAIN_MS 2000 // After the window, for the reports still on their way
+
+#define IDLE_PERIOD_MS 250
+#define BURST_MS 100
+#define BURST_PERIOD_MS 500
+#define BURST_DELTA 100
+#define RTS_PERIOD_MS 1000
+
+// Identification of the power-on protocol (Microsoft + Wheel), every character with the msb set
+static const uint8_t ident[] = { 0x80 | 'M', 0x80 | 'Z', 0x80 | '@' };
+#define PNP_END (0x80 | (')' - 0x20)) // Last character of the Plug and Play identification
+
+int firmware_main(void);
+
+enum {
+    WL_IDLE = 0,
+    WL_STEADY,
+    WL_BURST,
+    WL_RTS,
+    WL_COUNT
+};
+
+typedef struct {
+    uint8_t ok;
+    uint32_t reports; // Reports the mouse sent from the start of the window
+    uint32_t delivered;
+    uint32_t dropped; // Thrown away by an RTS probe
+    uint32_t probes;
+    double mean_us;
+    uint32_t p50_us, p95_us, p99_us, max_us;
+} Result;
+
+typedef struct {
+    hal_time_t end; // End of the last PS/2 stop bit
+    int32_t total; // X movement of all the reports until this one
+} Pending;
+
+static const char *const workload_names[WL_COUNT] = { "idle", "steady", "burst", "rts" };
+
+// Options
+static uint8_t proto = CFG_PROTO_MSWHEEL;
+static uint8_t baud = UART_BAUD_1200;
+static uint8_t rate = 100;
+static double window = 10.0; // Seconds
+
+// Current run
+static uint8_t workload;
+static Result res;
+static uint8_t moving, measuring;
+static hal_time_t window_start_time, last_move, next_probe;
+static uint8_t probe_armed;
+
+// Reports waiting for their packet
+static Pending *pending;
+static size_t pending_head, pending_tail, pending_cap;
+static int32_t total_in;
+static uint32_t *latencies; // Microseconds
+static size_t latency_count, latency_cap;
+
+// Serial output
+static SerDec dec;
+static int32_t dec_offset; // Movement the board threw away, added to what's decoded
+static uint8_t skip_ident; // Set after a probe, until the end of the identification
+static uint8_t in_ident; // Characters of the legacy identification seen
+
+static void pending_push(hal_time_t end, int32_t total) {
+    if(pending_tail == pending_cap) {
+        pending_cap = pending_cap ? (pending_cap * 2) : 1024;
+        pending = realloc(pending, pending_cap * sizeof(Pending));
+        if(!pending) abort();
+    }
+
+    pending[pending_tail].end = end;
+    pending[pending_tail].total = total;
+    pending_tail++;
+}
+
+static void latency_add(hal_time_t cycles) {
+    if(latency_count == latency_cap) {
+        latency_cap = latency_cap ? (latency_cap * 2) : 1024;
+        latencies = realloc(latencies, latency_cap * sizeof(uint32_t));
+        if(!latencies) abort();
+    }
+
+    latencies[latency_count++] = (uint32_t)((cycles * 1000000ULL) / F_CPU);
+}
+
+static void probe(void *ctx);
+
+// Mouse side
+
+static void report_sent(const uint8_t *report, uint8_t len, hal_time_t end) {
+    int16_t dx = (report[0] & 0x10) ? ((int16_t)report[1] - 256) : report[1];
+
+    if(!measuring) return;
+
+    res.reports++;
+    total_in += dx;
+    pending_push(end, total_in);
+
+    // Probes go right after a report, while the PS/2 lines are quiet
+    if(probe_armed && (end >= next_probe)) {
+        probe_armed = 0;
+        hal_host_at(end + HAL_HOST_US(300), probe, NULL); // Down and up again, like a driver looking for the mouse
+        hal_host_at(end + HAL_HOST_US(800), probe, NULL);
+    }
+}
+
+static void sample(void) {
+    hal_time_t now = hal_host_now();
+
+    if(!moving) return;
+
+    switch(workload) {
+    case WL_IDLE:
+        if((now - last_move) < HAL_HOST_MS(IDLE_PERIOD_MS)) return;
+        last_move = now;
+        ps2dev_move(1, 0, 0);
+        break;
+    case WL_STEADY:
+    case WL_RTS:
+        ps2dev_move(2, 1, 0);
+        break;
+    case WL_BURST:
+        if(((now - window_start_time) % HAL_HOST_MS(BURST_PERIOD_MS)) < HAL_HOST_MS(BURST_MS)) ps2dev_move(BURST_DELTA, -BURST_DELTA / 2, 0);
+        break;
+    }
+}
+
+// Serial side
+
+static void uart_tx(uint8_t b, hal_time_t end) {
+    if(!measuring) return;
+
+    // Skip the identification, after what was in flight when the board got the probe
+    if(skip_ident) {
+        if(in_ident < sizeof(ident)) in_ident = (b == ident[in_ident]) ? (in_ident + 1) : ((b == ident[0]) ? 1 : 0);
+        else if(b == PNP_END) {
+            skip_ident = 0;
+            serdec_resync(&dec);
+        }
+        return;
+    }
+
+    if(!serdec_feed(&dec, b)) return;
+
+    while((pending_head < pending_tail) && (pending[pending_head].total <= (dec.x + dec_offset))) {
+        latency_add(end - pending[pending_head].end);
+        res.delivered++;
+        pending_head++;
+    }
+}
+
+// The host toggled RTS: whatever the board had is gone, and it identifies itself before anything else
+static void probe(void *ctx) {
+    hal_host_rts();
+
+    res.dropped += pending_tail - pending_head;
+    pending_head = pending_tail;
+    dec_offset = total_in - dec.x;
+    skip_ident = 1;
+    in_ident = 0;
+}
+
+static void probe_next(void *ctx) {
+    if(!moving) return;
+
+    probe_armed = 1;
+    next_probe = hal_host_now();
+    res.probes++;
+    hal_host_at(hal_host_now() + HAL_HOST_MS(RTS_PERIOD_MS), probe_next, NULL);
+}
+
+// Sequence
+
+static void finish(void *ctx) {
+    double sum = 0;
+
+    res.ok = measuring;
+    measuring = 0;
+
+    bench_sort(latencies, latency_count);
+    for(size_t idx = 0; idx < latency_count; idx++) sum += latencies[idx];
+    res.mean_us = latency_count ? (sum / latency_count) : 0.0;
+    res.p50_us = bench_percentile(latencies, latency_count, 50);
+    res.p95_us = bench_percentile(latencies, latency_count, 95);
+    res.p99_us = bench_percentile(latencies, latency_count, 99);
+    res.max_us = latency_count ? latencies[latency_count - 1] : 0;
+
+    hal_host_stop(HAL_HOST_STOP);
+}
+
+static void window_done(void *ctx) {
+    moving = 0;
+    hal_host_at(hal_host_now() + HAL_HOST_MS(DRAIN_MS), finish, NULL);
+}
+
+static void window_start(void) {
+    serdec_init(&dec, (workload == WL_RTS) ? CFG_PROTO_MSWHEEL : proto);
+    measuring = 1;
+    moving = 1;
+    window_start_time = hal_host_now();
+    last_move = window_start_time - HAL_HOST_MS(IDLE_PERIOD_MS);
+
+    if(workload == WL_RTS) hal_host_at(hal_host_now() + HAL_HOST_MS(RTS_PERIOD_MS), probe_next, NULL);
+    hal_host_at(hal_host_now() + (hal_time_t)(window * F_CPU), window_done, NULL);
+}
+
+static void setup(void) {
+    if(workload != WL_RTS) bench_configure(proto, rate, baud);
+}
+
+// Runs in its own process, for the current workload
+static void run(void) {
+    hal_host_on_uart_tx(uart_tx);
+    ps2dev_init(PS2DEV_WHEEL);
+    ps2dev_on_sample(sample);
+    ps2dev_on_report(report_sent);
+    bench_sequence(setup, BENCH_SETTLE_MS, window_start);
+
+    // Way longer than needed, in case the board never gets to stream
+    hal_host_at(HAL_HOST_MS(BENCH_SETUP_DELAY_MS + BENCH_SETTLE_MS + DRAIN_MS + 10000) + (hal_time_t)(window * F_CPU), finish, NULL);
+    hal_host_run(firmware_main);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -p, --proto NAME   mswheel, ms, msys, logi, logiwhl or mm (mswheel)\n"
+            "  -b, --baud N       1200, 2400, 4800 or 9600 (1200)\n"
+            "  -r, --rate N       PS/2 sample rate (100)\n"
+            "  -t, --time S       Seconds of movement for each workload (10)\n"
+            "  -o, --output FILE  Write the results as JSON\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    static const struct option opts[] = {
+        { "proto", required_argument, NULL, 'p' },
+        { "baud", required_argument, NULL, 'b' },
+        { "rate", required_argument, NULL, 'r' },
+        { "time", required_argument, NULL, 't' },
+        { "output", required_argument, NULL, 'o' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    const char *out = NULL;
+    FILE *json = NULL;
+    int opt, failed = 0;
+
+    while((opt = getopt_long(argc, argv, "p:b:r:t:o:h", opts, NULL)) != -1) {
+        switch(opt) {
+        case 'p':
+            proto = bench_proto(optarg);
+            if(proto == CFG_PROTO_COUNT) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'b':
+            baud = bench_baud(optarg);
+            if(baud == UART_BAUD_COUNT) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'r': rate = atoi(optarg); break;
+        case 't': window = atof(optarg); break;
+        case 'o': out = optarg; break;
+        default:
+            usage(argv[0]);
+            return (opt == 'h') ? 0 : 1;
+        }
+    }
+    if(window <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if(out && !(json = fopen(out, "w"))) {
+        perror(out);
+        return 1;
+    }
+    if(json) fprintf(json, "{\"f_cpu\": %lu, \"proto\": \"%s\", \"baud\": %u, \"rate\": %u, \"seconds\": %.3f, \"workloads\": [\n",
+                     (unsigned long)F_CPU, bench_proto_names[proto], bench_baud_rates[baud], rate, window);
+
+    fprintf(stderr, "F_CPU %lu Hz, %s at %u bps, %u reports/s, %.1f s per workload (rts at power-on settings)\n",
+            (unsigned long)F_CPU, bench_proto_names[proto], bench_baud_rates[baud], rate, window);
+    fprintf(stderr, "%-7s %8s %9s %7s %9s %9s %9s %9s %9s\n",
+            "load", "reports", "delivered", "dropped", "mean us", "p50 us", "p95 us", "p99 us", "max us");
+
+    for(uint8_t wl = 0; wl < WL_COUNT; wl++) {
+        Result r;
+
+        memset(&r, 0, sizeof(r));
+        workload = wl;
+        bench_fork(run, &res, &r, sizeof(r));
+
+        if(!r.ok) failed = 1;
+
+        fprintf(stderr, "%-7s %8u %9u %7u %9.0f %9u %9u %9u %9u%s\n", workload_names[wl], r.reports, r.delivered, r.dropped,
+                r.mean_us, r.p50_us, r.p95_us, r.p99_us, r.max_us, r.ok ? "" : "  FAILED");
+        if(json) {
+            fprintf(json, "%s    {\"workload\": \"%s\", \"ok\": %s, \"reports\": %u, \"delivered\": %u, \"dropped\": %u, \"probes\": %u, "
+                          "\"mean_us\": %.1f, \"p50_us\": %u, \"p95_us\": %u, \"p99_us\": %u, \"max_us\": %u}",
+                    wl ? ",\n" : "", workload_names[wl], r.ok ? "true" : "false", r.reports, r.delivered, r.dropped, r.probes,
+                    r.mean_us, r.p50_us, r.p95_us, r.p99_us, r.max_us);
+        }
+    }
+
+    if(json) {
+        fprintf(json, "\n  ]}\n");
+        fclose(json);
+    }
+
+    return failed;
+}
@@ -0,0 +1,253 @@
+// Throughput and drop rate benchmark: runs the firmware on the host HAL against a simulated PS/2 wheel
+// mouse moving as fast as it can, for every serial protocol, serial speed and PS/2 sample rate.
+//
+// Every combination runs in a fresh process (the firmware state lives in globals): the board boots,
+// the host selects the protocol, sample rate and speed with the private extension commands, then the
+// mouse reports the largest movement a serial packet can carry, plus a wheel notch, at every sample,
+// changing direction every DIR_SAMPLES samples. After the measure window the mouse stops and the
+// board gets a while to drain what it still holds. The serial output is decoded, and the movement it
+// carries is compared with the movement the mouse was given.
+//
+// Reported for each combination:
+//   - serial packets delivered per second during the window
+//   - motion error: movement given to the mouse minus movement decoded from the serial line, per axis
+//   - PS/2 frames lost: transmissions cut short by the board inhibiting the clock (the mouse sends
+//     them again), parity and framing errors
+//   - receive ring overflows, PS/2 side and host side
+//
+// Usage: pontag-bench-stream [-d delta] [-t seconds] [-D drain_ms] [-o results.json]
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal.h"
+#include "ps2dev.h"
+#include "perf.h"
+#include "pconfig.h"
+#include "uart_baud.h"
+#include "sched.h"
+#include "serdec.h"
+#include "bench.h"
+
+#define DIR_SAMPLES 20
+
+int firmware_main(void);
+
+typedef struct {
+    uint8_t proto, baud, rate;
+    uint8_t ok;
+    double reports_per_s; // Serial packets delivered
+    double ps2_reports_per_s;
+    int32_t err_x, err_y, err_z; // Given minus delivered
+    int32_t in_x, in_y, in_z;
+    uint16_t inhibited, parity, framing;
+    uint16_t ps2_overflow, host_overflow;
+    uint16_t merged, dropped;
+} Result;
+
+static const uint8_t sample_rates[] = { 40, 80, 100, 200 };
+
+// Options
+static int16_t delta = 127; // The largest a serial packet carries
+static double window = 5.0; // Seconds
+static uint32_t drain_ms = 1000;
+
+// Current run
+static Result res;
+static uint8_t moving;
+static uint32_t samples;
+static hal_time_t window_end;
+static uint32_t ps2_reports_start, aborted_start;
+static PerfStats perf_start;
+static SchedStats sched_start;
+
+// Serial output
+static uint8_t decoding;
+static SerDec dec;
+static uint32_t window_packets;
+
+static void uart_tx(uint8_t b, hal_time_t end) {
+    if(!decoding) return;
+
+    serdec_feed(&dec, b);
+    if(end <= window_end) window_packets = dec.packets;
+}
+
+// Movement
+
+static void sample(void) {
+    int8_t dir;
+
+    if(!moving) return;
+
+    dir = ((samples++ / DIR_SAMPLES) & 0x01) ? -1 : 1;
+    ps2dev_move(dir * delta, -dir * delta, dir);
+    res.in_x += dir * delta;
+    res.in_y -= dir * delta;
+    res.in_z += dir;
+}
+
+// Sequence
+
+static void finish(void *ctx) {
+    const Ps2DevStats *ds = ps2dev_stats();
+    PerfStats now;
+
+    perf_get(&now);
+
+    res.ok = decoding; // Or the board never got to the measure window
+    res.reports_per_s = window_packets / window;
+    res.ps2_reports_per_s = (ds->reports - ps2_reports_start) / window;
+    res.err_x = res.in_x - dec.x;
+    res.err_y = res.in_y - dec.y;
+    res.err_z = res.in_z - dec.z;
+    res.inhibited = ds->bytes_aborted - aborted_start;
+    res.parity = now.ps2_parity_err - perf_start.ps2_parity_err;
+    res.framing = now.ps2_frame_err - perf_start.ps2_frame_err;
+    res.ps2_overflow = now.ps2_overflow - perf_start.ps2_overflow;
+    res.host_overflow = now.host_overflow - perf_start.host_overflow;
+    res.merged = sched_stats()->merged - sched_start.merged;
+    res.dropped = sched_stats()->dropped - sched_start.dropped;
+
+    hal_host_stop(HAL_HOST_STOP);
+}
+
+static void window_done(void *ctx) {
+    moving = 0;
+    hal_host_at(hal_host_now() + HAL_HOST_MS(drain_ms), finish, NULL);
+}
+
+static void window_start(void) {
+    perf_get(&perf_start);
+    sched_start = *sched_stats();
+    ps2_reports_start = ps2dev_stats()->reports;
+    aborted_start = ps2dev_stats()->bytes_aborted;
+
+    serdec_init(&dec, res.proto);
+    decoding = 1;
+    moving = 1;
+    window_end = hal_host_now() + (hal_time_t)(window * F_CPU);
+    hal_host_at(window_end, window_done, NULL);
+}
+
+static void setup(void) {
+    bench_configure(res.proto, res.rate, res.baud);
+}
+
+// Runs in its own process, res holds the combination
+static void run(void) {
+    hal_host_on_uart_tx(uart_tx);
+    ps2dev_init(PS2DEV_WHEEL);
+    ps2dev_on_sample(sample);
+    bench_sequence(setup, BENCH_SETTLE_MS, window_start);
+
+    // Way longer than needed, in case the board never gets to stream
+    hal_host_at(HAL_HOST_MS(BENCH_SETUP_DELAY_MS + BENCH_SETTLE_MS + drain_ms + 10000) + (hal_time_t)(window * F_CPU), finish, NULL);
+    hal_host_run(firmware_main);
+}
+
+static void print_json(FILE *f, const Result *r, uint8_t first) {
+    uint8_t wheel = serdec_wheel(r->proto);
+
+    fprintf(f, "%s    {\"proto\": \"%s\", \"baud\": %u, \"rate\": %u, \"ok\": %s, "
+               "\"reports_per_s\": %.1f, \"ps2_reports_per_s\": %.1f, ",
+            first ? "" : ",\n", bench_proto_names[r->proto], bench_baud_rates[r->baud], r->rate, r->ok ? "true" : "false",
+            r->reports_per_s, r->ps2_reports_per_s);
+    fprintf(f, "\"motion_in\": {\"x\": %d, \"y\": %d, \"wheel\": %d}, ", r->in_x, r->in_y, r->in_z);
+    fprintf(f, "\"motion_error\": {\"x\": %d, \"y\": %d, \"wheel\": ", r->err_x, r->err_y);
+    if(wheel) fprintf(f, "%d}, ", r->err_z);
+    else fprintf(f, "null}, ");
+    fprintf(f, "\"ps2_lost\": {\"inhibited\": %u, \"parity\": %u, \"framing\": %u}, ", r->inhibited, r->parity, r->framing);
+    fprintf(f, "\"overflows\": {\"ps2_rx\": %u, \"host_rx\": %u}, \"merged\": %u, \"dropped\": %u}",
+            r->ps2_overflow, r->host_overflow, r->merged, r->dropped);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -d, --delta N      Movement per sample on each axis (127)\n"
+            "  -t, --time S       Seconds of movement for each combination (5)\n"
+            "  -D, --drain MS     Time left to the board to send what it holds (1000)\n"
+            "  -o, --output FILE  Write the results as JSON\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    static const struct option opts[] = {
+        { "delta", required_argument, NULL, 'd' },
+        { "time", required_argument, NULL, 't' },
+        { "drain", required_argument, NULL, 'D' },
+        { "output", required_argument, NULL, 'o' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    const char *out = NULL;
+    FILE *json = NULL;
+    uint8_t first = 1;
+    int opt, failed = 0;
+
+    while((opt = getopt_long(argc, argv, "d:t:D:o:h", opts, NULL)) != -1) {
+        switch(opt) {
+        case 'd': delta = atoi(optarg); break;
+        case 't': window = atof(optarg); break;
+        case 'D': drain_ms = atoi(optarg); break;
+        case 'o': out = optarg; break;
+        default:
+            usage(argv[0]);
+            return (opt == 'h') ? 0 : 1;
+        }
+    }
+    if((delta < 1) || (delta > 255) || (window <= 0)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if(out && !(json = fopen(out, "w"))) {
+        perror(out);
+        return 1;
+    }
+    if(json) fprintf(json, "{\"f_cpu\": %lu, \"delta\": %d, \"seconds\": %.3f, \"drain_ms\": %u, \"runs\": [\n",
+                     (unsigned long)F_CPU, delta, window, drain_ms);
+
+    fprintf(stderr, "F_CPU %lu Hz, %d counts per sample, %.1f s + %u ms drain\n", (unsigned long)F_CPU, delta, window, drain_ms);
+    fprintf(stderr, "%-8s %5s %4s %9s %9s %8s %8s %6s %6s %6s %6s %6s %7s\n",
+            "proto", "baud", "rate", "pkts/s", "ps2 rep/s", "err x", "err y", "err z", "inhib", "par", "frm", "ovf", "merged");
+
+    for(uint8_t proto = 0; proto < CFG_PROTO_COUNT; proto++) {
+        for(uint8_t baud = 0; baud < UART_BAUD_COUNT; baud++) {
+            for(uint8_t idx = 0; idx < sizeof(sample_rates); idx++) {
+                Result r;
+                char err_z[12] = "-";
+
+                memset(&res, 0, sizeof(res));
+                res.proto = proto;
+                res.baud = baud;
+                res.rate = sample_rates[idx];
+                r = res;
+                bench_fork(run, &res, &r, sizeof(r));
+
+                if(!r.ok) failed = 1;
+                if(serdec_wheel(proto)) snprintf(err_z, sizeof(err_z), "%d", r.err_z);
+
+                fprintf(stderr, "%-8s %5u %4u %9.1f %9.1f %8d %8d %6s %6u %6u %6u %6u %7u%s\n",
+                        bench_proto_names[proto], bench_baud_rates[baud], r.rate, r.reports_per_s, r.ps2_reports_per_s, r.err_x, r.err_y,
+                        err_z,
+                        r.inhibited, r.parity, r.framing, r.ps2_overflow + r.host_overflow, r.merged, r.ok ? "" : "  FAILED");
+                if(json) {
+                    print_json(json, &r, first);
+                    first = 0;
+                }
+            }
+        }
+    }
+
+    if(json) {
+        fprintf(json, "\n  ]}\n");
+        fclose(json);
+    }
+
+    return failed;
+}
@@ -0,0 +1,165 @@
+// Button change check: runs the firmware on the host HAL against a simulated PS/2 wheel mouse that changes
+// its buttons at every sample, several times more often than SCHED_BTN_QUEUE_SIZE changes, much faster than
+// the serial line drains them at 1200 bps. Every button state the mouse reported must come out of the serial
+// line in the same order, none merged or lost, and each with the movement the mouse reported while it held.
+//
+// Runs at the power-on settings, Microsoft + Wheel at 1200 bps.
+//
+// Usage: pontag-check-buttons [-n changes]
+// Exits with 1 if a change was lost or some movement came out with the wrong buttons.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal.h"
+#include "ps2dev.h"
+#include "pconfig.h"
+#include "perf.h"
+#include "sched.h"
+#include "serdec.h"
+#include "bench.h"
+
+#define DRAIN_MS 5000 // After the last change, for the packets still on their way
+
+#define MAX_CHANGES 1024
+
+int firmware_main(void);
+
+// Every entry differs from the one before, and the last one from the first
+static const uint8_t pattern[] = {
+    PS2DEV_BTN_LEFT, 0, PS2DEV_BTN_RIGHT, 0, PS2DEV_BTN_MIDDLE, 0,
+    PS2DEV_BTN_LEFT | PS2DEV_BTN_RIGHT, PS2DEV_BTN_LEFT, PS2DEV_BTN_LEFT | PS2DEV_BTN_MIDDLE, PS2DEV_BTN_MIDDLE
+};
+
+static unsigned changes = SCHED_BTN_QUEUE_SIZE * 4;
+static unsigned changed;
+static uint8_t measuring;
+
+// Button states in the order they were reported, starting from all released
+static uint8_t sent[MAX_CHANGES + 1], received[MAX_CHANGES + 1];
+static unsigned sent_count, received_count;
+// X movement made with each of those states
+static int32_t sent_x[MAX_CHANGES + 1], received_x[MAX_CHANGES + 1];
+static int32_t dec_x; // dec.x at the end of the last serial packet
+
+static SerDec dec;
+static uint8_t pkt_pos; // Bytes of the current serial packet received so far, 0 waiting for the first one
+static uint8_t pkt_btns;
+static uint8_t synced;
+
+static void add_state(uint8_t *list, unsigned *count, uint8_t btns) {
+    if(list[*count] == btns) return;
+    if(*count < MAX_CHANGES) (*count)++;
+    list[*count] = btns;
+}
+
+// Mouse side
+
+static void sample(void) {
+    if(!measuring || (changed >= changes)) return;
+
+    ps2dev_buttons(pattern[changed % sizeof(pattern)]);
+    ps2dev_move((changed % 3) + 1, 0, 0); // Not the same for every state, or a shift would go unnoticed
+    changed++;
+}
+
+static void report_sent(const uint8_t *report, uint8_t len, hal_time_t end) {
+    if(!measuring) return;
+
+    add_state(sent, &sent_count, report[0] & (PS2DEV_BTN_LEFT | PS2DEV_BTN_RIGHT | PS2DEV_BTN_MIDDLE));
+    sent_x[sent_count] += (int32_t)report[1] - ((report[0] & 0x10) ? 256 : 0);
+}
+
+// Serial side, Microsoft + Wheel: the first byte of a packet has D6 set, left in D5 and right in D4,
+// the middle button is in D4 of the fourth byte
+
+static void uart_tx(uint8_t b, hal_time_t end) {
+    if(!measuring) return;
+
+    if(b & 0x40) {
+        synced = 1;
+        pkt_pos = 0;
+        pkt_btns = ((b & 0x20) ? PS2DEV_BTN_LEFT : 0) | ((b & 0x10) ? PS2DEV_BTN_RIGHT : 0);
+    } else if(!synced) return;
+
+    if(++pkt_pos == 4) add_state(received, &received_count, pkt_btns | ((b & 0x10) ? PS2DEV_BTN_MIDDLE : 0));
+    serdec_feed(&dec, b);
+
+    if(pkt_pos == 4) {
+        received_x[received_count] += dec.x - dec_x;
+        dec_x = dec.x;
+    }
+}
+
+// Sequence
+
+static void finish(void *ctx) {
+    hal_host_stop(HAL_HOST_STOP);
+}
+
+static void start(void) {
+    serdec_init(&dec, CFG_PROTO_MSWHEEL);
+    measuring = 1;
+
+    // Way longer than the changes take, even if they all had a packet of their own at 1200 bps
+    hal_host_at(hal_host_now() + HAL_HOST_MS(DRAIN_MS + changes * 40), finish, NULL);
+}
+
+int main(int argc, char **argv) {
+    PerfStats perf;
+    const SchedStats *sched;
+    unsigned idx, lost = 0, moved = 0;
+    int32_t total_x = 0;
+    int failed = 0;
+
+    if(argc == 3 && !strcmp(argv[1], "-n")) changes = atoi(argv[2]);
+    else if(argc != 1) {
+        fprintf(stderr, "Usage: %s [-n changes]\n", argv[0]);
+        return 1;
+    }
+    if(!changes || (changes > MAX_CHANGES)) {
+        fprintf(stderr, "%s: 1 to %u changes\n", argv[0], MAX_CHANGES);
+        return 1;
+    }
+
+    hal_host_on_uart_tx(uart_tx);
+    ps2dev_init(PS2DEV_WHEEL);
+    ps2dev_on_sample(sample);
+    ps2dev_on_report(report_sent);
+    bench_sequence(NULL, 0, start); // At the power-on settings
+
+    // In case the board never gets to stream
+    hal_host_at(HAL_HOST_MS(BENCH_SETUP_DELAY_MS + DRAIN_MS + 10000 + changes * 40), finish, NULL);
+    hal_host_run(firmware_main);
+
+    perf_get(&perf);
+    sched = sched_stats();
+
+    for(idx = 1; idx <= sent_count; idx++) {
+        if((idx > received_count) || (received[idx] != sent[idx])) {
+            if(!lost) fprintf(stderr, "first difference at change %u: mouse %02X, serial %02X\n",
+                              idx, sent[idx], (idx <= received_count) ? received[idx] : 0xFF);
+            lost++;
+        } else if(received_x[idx] != sent_x[idx]) {
+            if(!moved) fprintf(stderr, "first movement difference at change %u: mouse %ld, serial %ld\n",
+                               idx, (long)sent_x[idx], (long)received_x[idx]);
+            moved++;
+        }
+    }
+    for(idx = 0; idx <= sent_count; idx++) total_x += sent_x[idx];
+    if(received_x[0] != sent_x[0]) moved++;
+
+    fprintf(stderr, "%u changes asked, mouse reported %u, serial line %u, %u lost\n",
+            changes, sent_count, received_count, lost);
+    fprintf(stderr, "movement: mouse %ld, serial %ld, %u states with the wrong movement; button queue full %u times, PS/2 overflows %u\n",
+            (long)total_x, (long)dec.x, moved, sched->btn_full, perf.ps2_overflow);
+
+    if(!measuring || !sent_count || lost || (received_count != sent_count)) failed = 1;
+    if((dec.x != total_x) || moved || perf.ps2_overflow) failed = 1;
+
+    fprintf(stderr, "%s\n", failed ? "FAILED" : "ok");
+
+    return failed;
+}
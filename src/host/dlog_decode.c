@@ -0,0 +1,178 @@
+// Turns the binary debug log of the board (see src/libs/dlog/dlog.h) back into text, one line per event.
+//
+// The 16-bit stamps are unwrapped into milliseconds from the first event; ticks keep them going and
+// are not printed. Replies to host commands come between two events and are decoded too, the
+// performance counters included, as do the counters the diagnostic output sends every second (see
+// src/libs/diag/diag.h). Anything else is skipped until an event starts again.
+//
+// Usage: pontag-dlog [capture.bin], standard input when no file is given
+//        e.g. stty -F /dev/ttyUSB0 1200 raw && pontag-dlog /dev/ttyUSB0
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "dlog.h"
+#include "hostcmd.h"
+#include "perf.h"
+
+static const char *const ev_names[] = {
+    [DLOG_BOOT] = "boot",
+    [DLOG_CONFIG] = "config",
+    [DLOG_MOUSE_INIT] = "mouse-init",
+    [DLOG_IDENT] = "ident",
+    [DLOG_PS2_PKT] = "ps2",
+    [DLOG_SER_PKT] = "serial",
+    [DLOG_SER_TAIL] = "serial-tail",
+    [DLOG_SCHED] = "sched",
+    [DLOG_SLEEP] = "sleep",
+    [DLOG_WAKE] = "wake",
+    [DLOG_HOSTCMD] = "hostcmd",
+    [DLOG_SCHED_TAIL] = "sched-tail",
+    [DLOG_TICK] = "tick",
+};
+
+static const char *const cmd_names[] = {
+    [HOSTCMD_NONE] = "none",
+    [HOSTCMD_SETBAUD] = "setbaud",
+    [HOSTCMD_SETRATE] = "setrate",
+    [HOSTCMD_SETRES] = "setres",
+    [HOSTCMD_PROMPT] = "prompt",
+    [HOSTCMD_POLL] = "poll",
+    [HOSTCMD_SETPROTO] = "setproto",
+    [HOSTCMD_SETPARAM] = "setparam",
+    [HOSTCMD_GETPARAM] = "getparam",
+    [HOSTCMD_STATS] = "stats",
+};
+
+static uint8_t valid_event(uint8_t b) {
+    uint8_t ev = b & DLOG_EVENT_MASK;
+
+    return ((b & DLOG_SYNC_MASK) == DLOG_SYNC) && (ev < (sizeof(ev_names) / sizeof(ev_names[0]))) && ev_names[ev];
+}
+
+static void print_hist(const char *name, const uint16_t *hist) {
+    printf("  %-8s", name);
+    for(int idx = 0; idx < PERF_HIST_BUCKETS; idx++) printf(" %u", hist[idx]);
+    putchar('\n');
+}
+
+static void print_stats(const uint8_t *block, uint8_t size) {
+    PerfStats ps;
+
+    if(size != sizeof(PerfStats)) {
+        printf("  %u bytes, expected %zu: not decoded\n", size, sizeof(PerfStats));
+        return;
+    }
+
+    // Little-endian and packed on both sides
+    memcpy(&ps, block, sizeof(ps));
+    printf("  ps2 frames %u parity %u framing %u recover %u overflow %u resyncs %u\n",
+           ps.ps2_frames, ps.ps2_parity_err, ps.ps2_frame_err, ps.ps2_recover, ps.ps2_overflow, ps.resyncs);
+    printf("  host overflow %u | serial sent %u merged %u dropped %u | rts %u sleeps %u\n",
+           ps.host_overflow, ps.ser_sent, ps.ser_merged, ps.ser_dropped, ps.rts, ps.sleeps);
+    printf("  hwm ps2 %u serial %u | stack free %u | serial clamped %u\n", ps.ps2_hwm, ps.ser_hwm, ps.stack_free, ps.ser_clamped);
+    print_hist("latency", ps.latency);
+    print_hist("wait", ps.wait);
+}
+
+static void print_event(double ms, const uint8_t *rec) {
+    uint8_t ev = rec[0] & DLOG_EVENT_MASK;
+    const uint8_t *a = &rec[1];
+
+    printf("%10.3f %s%-11s", ms / 1000.0, (rec[0] & DLOG_LOST) ? "(lost) " : "", ev_names[ev]);
+    switch(ev) {
+    case DLOG_BOOT: printf(" firmware %u.%u.%u, option header %02X", a[0], a[1], a[2], a[3]); break;
+    case DLOG_CONFIG: printf(" protocol %u, resolution %u", a[0], a[1]); break;
+    case DLOG_MOUSE_INIT: printf(" result %u, report size %u", a[0], a[1]); break;
+    case DLOG_IDENT: printf(" protocol %u, rts toggles %u, stack free %u", a[0], a[1] | (a[2] << 8), a[3] | (a[4] << 8)); break;
+    case DLOG_PS2_PKT: printf(" %02X %02X %02X %02X", a[0], a[1], a[2], a[3]); break;
+    case DLOG_SER_PKT:
+        printf(" [%u]", a[0]);
+        for(uint8_t idx = 0; (idx < a[0]) && (idx < 4); idx++) printf(" %02X", a[idx + 1]);
+        break;
+    case DLOG_SER_TAIL: printf(" %02X", a[0]); break;
+    case DLOG_SCHED: printf(" merged %u, dropped %u, button queue full %u", a[0] | (a[1] << 8), a[2] | (a[3] << 8), a[4]); break;
+    case DLOG_SCHED_TAIL: printf(" clamped %u, dropped counts %u", a[0] | (a[1] << 8), a[2] | (a[3] << 8)); break;
+    case DLOG_HOSTCMD:
+        if(a[0] < (sizeof(cmd_names) / sizeof(cmd_names[0]))) printf(" %s", cmd_names[a[0]]);
+        else printf(" %u", a[0]);
+        printf(" %u %u", a[1], a[2]);
+        break;
+    default: break;
+    }
+    putchar('\n');
+}
+
+int main(int argc, char **argv) {
+    FILE *in = stdin;
+    uint8_t rec[DLOG_REC_SIZE], block[256];
+    uint16_t last_stamp = 0;
+    uint8_t first = 1;
+    uint64_t now_ms = 0;
+    unsigned events = 0, skipped = 0, lost = 0;
+    int c;
+
+    if(argc > 2) {
+        fprintf(stderr, "Usage: %s [capture.bin]\n", argv[0]);
+        return 1;
+    }
+    if(argc == 2) {
+        in = fopen(argv[1], "rb");
+        if(!in) {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+
+    while((c = fgetc(in)) != EOF) {
+        if(c == HOSTCMD_REPLY_OK) {
+            int id = fgetc(in), val = fgetc(in);
+
+            if(val == EOF) break;
+            printf("%10s reply      = %u %u\n", "", id, val);
+            continue;
+        }
+        if(c == HOSTCMD_REPLY_ERR) {
+            int id = fgetc(in);
+
+            if(id == EOF) break;
+            printf("%10s reply      ! %u\n", "", id);
+            continue;
+        }
+        if(c == HOSTCMD_REPLY_STATS) {
+            int size = fgetc(in);
+
+            if((size == EOF) || (fread(block, 1, size, in) != (size_t)size)) break;
+            printf("%10s counters   # %u\n", "", size);
+            print_stats(block, size);
+            continue;
+        }
+
+        if(!valid_event(c)) {
+            skipped++;
+            continue;
+        }
+        rec[0] = c;
+        if(fread(&rec[1], 1, DLOG_REC_SIZE - 1, in) != (DLOG_REC_SIZE - 1)) break;
+        events++;
+
+        // Stamps wrap around, but the ticks keep them from doing it twice between two events
+        if(!first) now_ms += (uint16_t)((rec[6] | (rec[7] << 8)) - last_stamp);
+        last_stamp = rec[6] | (rec[7] << 8);
+        first = 0;
+
+        if(rec[0] & DLOG_LOST) lost++;
+        if((rec[0] & DLOG_EVENT_MASK) == DLOG_TICK) continue;
+        print_event(now_ms, rec);
+        fflush(stdout);
+    }
+    if(in != stdin) fclose(in);
+
+    fprintf(stderr, "dlog: %u events, %.3f s", events, now_ms / 1000.0);
+    if(skipped) fprintf(stderr, ", %u bytes skipped", skipped);
+    if(lost) fprintf(stderr, ", events lost %u times", lost);
+    fputc('\n', stderr);
+
+    return 0;
+}
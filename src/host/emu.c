@@ -0,0 +1,502 @@
+// PONTAG emulator: runs the firmware on the host HAL, with a simulated PS/2 mouse on one side
+// and a pseudo-terminal on the other, in real time (or faster).
+//
+// Point a serial mouse driver at the terminal it prints, e.g.
+//     inputattach --microsoft /dev/pts/3
+//
+// The mouse moves on its own (--motion) or replays a trace (--trace, see docs/traces.md), starting a
+// while after it's first enabled (--start), when the board is done blinking.
+//
+// Linux pseudo-terminals have no modem lines, so RTS is derived from what the host can do to them:
+// it's up while the terminal is open and its speed is not B0 (hang up). Every change reaches the
+// firmware as an RTS toggle. SIGUSR1 toggles it twice, like a driver probing for the mouse.
+// When the watchdog resets the board, the emulator starts over in a new process on the same terminal.
+//
+// The diagnostic output of the board (see src/libs/diag/diag.h) can go to a file or a FIFO (--diag).
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <avr/eeprom.h>
+
+#include "hal.h"
+#include "ps2dev.h"
+#include "perf.h"
+#include "tracefile.h"
+
+#define TICK HAL_HOST_MS(1) // Pacing, and how often the terminal is checked
+#define RX_QUEUE_LEN 4096
+
+int firmware_main(void);
+
+enum {
+    MOTION_IDLE = 0,
+    MOTION_CIRCLE,
+    MOTION_LINE,
+    MOTION_RANDOM
+};
+
+// Options
+static uint8_t model = PS2DEV_WHEEL;
+static uint8_t motion = MOTION_CIRCLE;
+static double speed = 300.0; // Counts per second
+static uint32_t click_ms, wheel_ms;
+static double accel = 1.0; // Times real time, 0 as fast as possible
+static double run_time; // Seconds, 0 forever
+static uint32_t start_ms = 3000; // From when the mouse is enabled to the first movement
+static uint8_t header = 0xFF;
+static const char *link_path, *eeprom_path, *trace_path, *diag_path;
+static uint8_t trace_loop;
+
+// Terminal
+static int pty_fd = -1, ino_fd = -1, eeprom_fd = -1;
+static int opens; // Open file descriptors on the slave side
+static uint8_t rts;
+static speed_t host_speed;
+
+static uint8_t rx_queue[RX_QUEUE_LEN];
+static size_t rx_head, rx_tail;
+static uint8_t rx_scheduled;
+static hal_time_t rx_next;
+
+// Simulation
+static volatile sig_atomic_t stop_req, rts_req;
+static struct timespec wall_start;
+static hal_time_t stream_start;
+static uint8_t streaming, stream_seen;
+static uint32_t tx_dropped;
+static FILE *diag_file;
+
+static TraceFile trace = { .model = TRACEFILE_NO_MODEL };
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -m, --model std|wheel|explorer  Mouse model (wheel)\n"
+            "  -M, --motion idle|circle|line|random  Synthetic movement (circle)\n"
+            "  -s, --speed N       Movement speed, counts per second (300)\n"
+            "  -c, --click MS      Toggle the left button every MS milliseconds\n"
+            "  -w, --wheel MS      Turn the wheel a notch every MS milliseconds\n"
+            "  -t, --trace FILE    Replay a PS/2 trace instead of moving\n"
+            "  -S, --start MS      Start moving MS milliseconds after the mouse is enabled (3000)\n"
+            "  -r, --loop          Replay the trace over and over\n"
+            "  -x, --accel N       Run N times faster than real time, 0 as fast as possible (1)\n"
+            "  -T, --time S        Stop after S simulated seconds\n"
+            "  -L, --link PATH     Symlink PATH to the terminal\n"
+            "  -e, --eeprom FILE   Keep the EEPROM in FILE\n"
+            "  -D, --diag FILE     Write the diagnostic output to FILE\n"
+            "  -o, --opt HEX       Option header, bits cleared are jumpered (FF)\n"
+            "      --debug         Jumper pin 1: debug mode\n"
+            "      --powersave     Jumper pin 2: power save\n"
+            "      --ms            Jumper pin 3: force the Microsoft protocol\n"
+            "      --no-wheel      Jumper pin 4: skip the wheel detection\n",
+            name);
+}
+
+static double wall_elapsed(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (ts.tv_sec - wall_start.tv_sec) + ((ts.tv_nsec - wall_start.tv_nsec) / 1e9);
+}
+
+static double sim_seconds(hal_time_t t) {
+    return (double)t / F_CPU;
+}
+
+// EEPROM
+
+static void eeprom_load(void) {
+    if(eeprom_fd >= 0) {
+        if(pread(eeprom_fd, hal_host_eeprom, HOST_EEPROM_SIZE, 0) < 0) perror("eeprom");
+    } else if(eeprom_path) {
+        FILE *f = fopen(eeprom_path, "rb");
+
+        if(f) {
+            if(fread(hal_host_eeprom, 1, HOST_EEPROM_SIZE, f) != HOST_EEPROM_SIZE) fprintf(stderr, "%s: short file\n", eeprom_path);
+            fclose(f);
+        }
+    }
+}
+
+static void eeprom_save(void) {
+    if(eeprom_fd >= 0) {
+        if(pwrite(eeprom_fd, hal_host_eeprom, HOST_EEPROM_SIZE, 0) < 0) perror("eeprom");
+    } else if(eeprom_path) {
+        FILE *f = fopen(eeprom_path, "wb");
+
+        if(!f || (fwrite(hal_host_eeprom, 1, HOST_EEPROM_SIZE, f) != HOST_EEPROM_SIZE)) perror(eeprom_path);
+        if(f) fclose(f);
+    }
+}
+
+// Synthetic movement
+
+static void sample(void) {
+    static double px, py;
+    static double vx, vy;
+    static unsigned seed = 1;
+    static uint32_t notches;
+    double t, x = px, y = py;
+
+    if(hal_host_now() < stream_start) return; // Not yet
+    t = sim_seconds(hal_host_now() - stream_start);
+
+    switch(motion) {
+    case MOTION_CIRCLE: {
+        double radius = 200.0;
+
+        x = radius * (cos(speed * t / radius) - 1.0); // Starting from where we are
+        y = radius * sin(speed * t / radius);
+        break;
+    }
+    case MOTION_LINE: { // Back and forth, 800 counts
+        double pos = fmod(speed * t, 1600.0);
+
+        x = (pos < 800.0) ? pos : (1600.0 - pos);
+        break;
+    }
+    case MOTION_RANDOM: {
+        double step = speed / ps2dev_rate();
+
+        vx += step * ((rand_r(&seed) / (double)RAND_MAX) - 0.5);
+        vy += step * ((rand_r(&seed) / (double)RAND_MAX) - 0.5);
+        if(fabs(vx) > step) vx = copysign(step, vx);
+        if(fabs(vy) > step) vy = copysign(step, vy);
+        x = px + vx;
+        y = py + vy;
+        break;
+    }
+    }
+
+    ps2dev_move(lround(x) - lround(px), lround(y) - lround(py), 0);
+    px = x;
+    py = y;
+
+    if(click_ms) ps2dev_buttons(((uint64_t)(t * 1000) / click_ms) & 0x01 ? PS2DEV_BTN_LEFT : 0);
+    if(wheel_ms && ((uint64_t)(t * 1000) / wheel_ms) > notches) {
+        notches++;
+        ps2dev_move(0, 0, ((notches / 5) & 0x01) ? -1 : 1); // Five notches each way
+    }
+}
+
+static void stream_changed(uint8_t on) {
+    streaming = on;
+    if(!on || stream_seen) return;
+
+    // The first time the mouse is enabled, the movement or the trace is scheduled
+    stream_seen = 1;
+    stream_start = hal_host_now() + HAL_HOST_MS(start_ms);
+    if(trace.len) replay_start(&trace, stream_start, 1.0, trace_loop);
+}
+
+// Terminal
+
+static void set_rts(uint8_t up) {
+    if(up == rts) return;
+
+    rts = up;
+    hal_host_rts();
+}
+
+static void uart_tx(uint8_t b, hal_time_t end) {
+    if(!opens) { // Nobody listening
+        tx_dropped++;
+        return;
+    }
+
+    if(write(pty_fd, &b, 1) != 1) tx_dropped++;
+}
+
+static void diag_tx(uint8_t b, hal_time_t end) {
+    fputc(b, diag_file);
+}
+
+static hal_time_t frame_time(void) {
+    return (HAL_HOST_MS(1000) * hal_host_uart_frame_bits()) / hal_host_uart_baud();
+}
+
+static void rx_feed(void *ctx) {
+    if(rx_head == rx_tail) {
+        rx_scheduled = 0;
+        return;
+    }
+
+    hal_host_uart_rx(rx_queue[rx_tail]);
+    rx_tail = (rx_tail + 1) % RX_QUEUE_LEN;
+
+    rx_next = hal_host_now() + frame_time();
+    hal_host_at(rx_next, rx_feed, NULL);
+}
+
+static void pty_poll(void) {
+    uint8_t buf[256];
+    ssize_t len;
+    struct termios tio;
+
+    // Opens and closes of the slave side
+    while((len = read(ino_fd, buf, sizeof(buf))) > 0) {
+        for(ssize_t pos = 0; pos < len; ) {
+            struct inotify_event *ev = (struct inotify_event *)&buf[pos];
+
+            if(ev->mask & IN_OPEN) opens++;
+            if((ev->mask & IN_CLOSE) && (opens > 0)) opens--;
+            pos += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+
+    if(!tcgetattr(pty_fd, &tio)) host_speed = cfgetospeed(&tio);
+
+    set_rts(opens && (host_speed != B0));
+
+    if(rts_req) {
+        rts_req = 0;
+        hal_host_rts();
+        hal_host_rts();
+    }
+
+    // Bytes from the host, they reach the board one frame time apart
+    while(((rx_head + 1) % RX_QUEUE_LEN) != rx_tail) {
+        uint8_t b;
+
+        if(read(pty_fd, &b, 1) != 1) break;
+        rx_queue[rx_head] = b;
+        rx_head = (rx_head + 1) % RX_QUEUE_LEN;
+    }
+    if((rx_head != rx_tail) && !rx_scheduled) {
+        rx_scheduled = 1;
+        hal_host_at((rx_next > hal_host_now()) ? rx_next : hal_host_now(), rx_feed, NULL);
+    }
+}
+
+static void pty_open(void) {
+    struct termios tio;
+    const char *name;
+
+    pty_fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if((pty_fd < 0) || grantpt(pty_fd) || unlockpt(pty_fd) || !(name = ptsname(pty_fd))) {
+        perror("pty");
+        exit(1);
+    }
+
+    // Raw, so the bytes reach the host as they are, until it sets the terminal up by itself
+    tcgetattr(pty_fd, &tio);
+    cfmakeraw(&tio);
+    cfsetspeed(&tio, B1200);
+    tcsetattr(pty_fd, TCSANOW, &tio);
+
+    ino_fd = inotify_init1(IN_NONBLOCK);
+    if((ino_fd < 0) || (inotify_add_watch(ino_fd, name, IN_OPEN | IN_CLOSE) < 0)) {
+        perror("inotify");
+        exit(1);
+    }
+
+    if(link_path) {
+        struct stat st;
+
+        if(!lstat(link_path, &st) && S_ISLNK(st.st_mode)) unlink(link_path);
+        if(symlink(name, link_path)) perror(link_path);
+    }
+
+    printf("%s\n", name);
+    fflush(stdout);
+}
+
+// Pacing
+
+static void tick(void *ctx) {
+    hal_time_t now = hal_host_now();
+
+    if(stop_req || (run_time && (sim_seconds(now) >= run_time))) hal_host_stop(HAL_HOST_STOP);
+
+    if(accel > 0) { // Wait for the wall clock to catch up
+        double ahead = (sim_seconds(now) / accel) - wall_elapsed();
+
+        if(ahead > 0) {
+            struct timespec ts = { (time_t)ahead, (long)((ahead - (time_t)ahead) * 1e9) };
+
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    pty_poll();
+
+    hal_host_at(now + TICK, tick, NULL);
+}
+
+static void on_signal(int sig) {
+    if(sig == SIGUSR1) rts_req = 1;
+    else stop_req = 1;
+}
+
+static void summary(int reason) {
+    double secs = sim_seconds(hal_host_now());
+    const HalHostStats *hs = hal_host_stats();
+    const Ps2DevStats *ds = ps2dev_stats();
+
+    fprintf(stderr, "emu: %s after %.3f s\n",
+            (reason == HAL_HOST_WDT) ? "watchdog reset" : ((reason == HAL_HOST_IDLE) ? "asleep for good" : "stopped"), secs);
+    fprintf(stderr, "emu: ps2 %u reports, %u bytes, %u aborted | serial %u bytes (%.1f/s), %u lost, %u host overruns\n",
+            ds->reports, ds->bytes_sent, ds->bytes_aborted,
+            hs->uart_tx_bytes, secs ? (hs->uart_tx_bytes / secs) : 0.0, tx_dropped, hs->uart_rx_overruns);
+    fprintf(stderr, "emu: firmware ps2 frames %u parity %u framing %u overflow %u | packets sent %u merged %u dropped %u\n",
+            perf_stats.ps2_frames, perf_stats.ps2_parity_err, perf_stats.ps2_frame_err, perf_stats.ps2_overflow,
+            perf_stats.ser_sent, perf_stats.ser_merged, perf_stats.ser_dropped);
+}
+
+// Start over in a new process, keeping the terminal and the EEPROM
+static void reexec(char **argv, int argc) {
+    char resume[64];
+    char **args = calloc(argc + 2, sizeof(char *));
+
+    if(eeprom_fd < 0 && !eeprom_path) {
+        eeprom_fd = memfd_create("pontag-eeprom", 0);
+        if(eeprom_fd < 0) {
+            perror("memfd");
+            exit(1);
+        }
+    }
+    eeprom_save();
+
+    snprintf(resume, sizeof(resume), "--resume=%d,%d,%d,%d,%d", pty_fd, ino_fd, eeprom_fd, opens, host_speed);
+    memcpy(args, argv, argc * sizeof(char *));
+    args[argc] = resume;
+
+    execv("/proc/self/exe", args);
+    perror("exec");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    static const struct option opts[] = {
+        { "model", required_argument, NULL, 'm' },
+        { "motion", required_argument, NULL, 'M' },
+        { "speed", required_argument, NULL, 's' },
+        { "click", required_argument, NULL, 'c' },
+        { "wheel", required_argument, NULL, 'w' },
+        { "trace", required_argument, NULL, 't' },
+        { "loop", no_argument, NULL, 'r' },
+        { "start", required_argument, NULL, 'S' },
+        { "accel", required_argument, NULL, 'x' },
+        { "time", required_argument, NULL, 'T' },
+        { "link", required_argument, NULL, 'L' },
+        { "eeprom", required_argument, NULL, 'e' },
+        { "diag", required_argument, NULL, 'D' },
+        { "opt", required_argument, NULL, 'o' },
+        { "debug", no_argument, NULL, 1 },
+        { "powersave", no_argument, NULL, 2 },
+        { "ms", no_argument, NULL, 3 },
+        { "no-wheel", no_argument, NULL, 4 },
+        { "resume", required_argument, NULL, 5 },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int argc_orig = argc, opt, reason;
+    uint8_t resumed = 0;
+
+    while((opt = getopt_long(argc, argv, "m:M:s:c:w:t:rS:x:T:L:e:D:o:h", opts, NULL)) != -1) {
+        switch(opt) {
+        case 'm':
+            if(!strcmp(optarg, "std")) model = PS2DEV_STANDARD;
+            else if(!strcmp(optarg, "wheel")) model = PS2DEV_WHEEL;
+            else if(!strcmp(optarg, "explorer")) model = PS2DEV_EXPLORER;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'M':
+            if(!strcmp(optarg, "idle")) motion = MOTION_IDLE;
+            else if(!strcmp(optarg, "circle")) motion = MOTION_CIRCLE;
+            else if(!strcmp(optarg, "line")) motion = MOTION_LINE;
+            else if(!strcmp(optarg, "random")) motion = MOTION_RANDOM;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 's': speed = atof(optarg); break;
+        case 'c': click_ms = atoi(optarg); break;
+        case 'w': wheel_ms = atoi(optarg); break;
+        case 't': trace_path = optarg; break;
+        case 'r': trace_loop = 1; break;
+        case 'S': start_ms = atoi(optarg); break;
+        case 'x': accel = atof(optarg); break;
+        case 'T': run_time = atof(optarg); break;
+        case 'L': link_path = optarg; break;
+        case 'e': eeprom_path = optarg; break;
+        case 'D': diag_path = optarg; break;
+        case 'o': header = strtoul(optarg, NULL, 16); break;
+        case 1: header &= ~0x04; break; // See HeaderOptions in main.c
+        case 2: header &= ~0x02; break;
+        case 3: header &= ~0x01; break;
+        case 4: header &= ~0x08; break;
+        case 5: {
+            int spd;
+
+            if(sscanf(optarg, "%d,%d,%d,%d,%d", &pty_fd, &ino_fd, &eeprom_fd, &opens, &spd) != 5) return 1;
+            host_speed = spd;
+            argc_orig--; // Not passed on again
+            resumed = 1;
+            break;
+        }
+        default:
+            usage(argv[0]);
+            return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    if(trace_path && tracefile_load(&trace, trace_path)) return 1;
+    if(!resumed) pty_open();
+    eeprom_load();
+    if(diag_path) {
+        diag_file = fopen(diag_path, resumed ? "ab" : "wb"); // Goes on after a reset
+        if(!diag_file) {
+            perror(diag_path);
+            return 1;
+        }
+        setvbuf(diag_file, NULL, _IONBF, 0); // A reader on a FIFO sees every byte when it comes
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGUSR1, on_signal);
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+    // The board
+    hal_host_set_opt(header);
+    hal_host_on_uart_tx(uart_tx);
+    if(diag_file) hal_host_on_diag_tx(diag_tx);
+    rts = opens && (host_speed != B0); // As it was before the reset, the firmware sees only changes
+
+    // The mouse
+    ps2dev_init((trace.model != TRACEFILE_NO_MODEL) ? trace.model : model);
+    ps2dev_on_stream(stream_changed);
+    if(!trace.len && (motion != MOTION_IDLE || click_ms || wheel_ms)) ps2dev_on_sample(sample);
+
+    hal_host_at(hal_host_now() + TICK, tick, NULL);
+    reason = hal_host_run(firmware_main);
+
+    summary(reason);
+    eeprom_save();
+
+    if(reason == HAL_HOST_WDT) reexec(argv, argc_orig);
+    if(link_path) unlink(link_path);
+
+    return 0;
+}
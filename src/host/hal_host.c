@@ -0,0 +1,621 @@
+// Host backend of the hardware abstraction layer: a small discrete event simulation of the
+// peripherals the firmware uses. See hal_host.h.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+#include <avr/eeprom.h>
+
+#include "hal.h"
+#include "ioconfig.h"
+
+#define WDT_TIMEOUT HAL_HOST_MS(2000) // The shortest of the MCUs we build for
+#define FOREVER ((hal_time_t)-1)
+
+typedef struct {
+    hal_time_t when;
+    uint32_t seq;
+    void (*fn)(void *ctx);
+    void *ctx;
+} Event;
+
+uint8_t hal_host_eeprom[HOST_EEPROM_SIZE] = { [0 ... HOST_EEPROM_SIZE - 1] = 0xFF }; // A new chip
+
+static hal_time_t now;
+static uint32_t call_cost = 64;
+static uint8_t irq_on, in_isr, advancing;
+static HalHostStats stats;
+static hal_time_t irq_raised[HAL_HOST_IRQ_COUNT]; // When each flag was set
+
+static jmp_buf run_jmp;
+
+// External events, kept as a binary heap
+static Event *events;
+static size_t event_count, event_cap;
+static uint32_t event_seq;
+
+// PS/2 lines and their interrupt
+static uint8_t fw_out[2], fw_high[2]; // Direction and output level set by the firmware
+static uint8_t dev_low[2]; // Pulled low by the device
+static uint8_t wire[2] = { 1, 1 };
+static uint8_t int0_en, int0_flag;
+static uint32_t int0_runs;
+static void (*ps2_cb)(uint8_t line, uint8_t level);
+
+// Timer0
+static uint8_t t0_on, t0_flag;
+static hal_time_t t0_next, t0_div;
+
+// Timer1
+static uint8_t t1_on, t1_flag;
+static hal_time_t t1_next, t1_last, t1_period;
+
+// Timer2 and the diagnostic output pin, decoded as 8N1 frames
+static uint8_t t2_on, t2_flag;
+static hal_time_t t2_next, t2_period = 8;
+static uint8_t diag_level = 1, diag_in_frame, diag_next; // Level of the pin, a frame is being decoded, its next bit to sample
+static uint16_t diag_frame;
+static hal_time_t diag_start, diag_bit;
+static void (*diag_cb)(uint8_t b, hal_time_t end);
+
+// UART
+static uint8_t uart_on, udrie, txc, frame_bits = 10;
+static hal_time_t bit_cycles = 16;
+static uint8_t udr_full, udr_byte; // Transmit data register
+static uint8_t shifting, shift_byte; // Transmit shift register
+static hal_time_t shift_end;
+static uint8_t rxc, rx_byte;
+static void (*uart_cb)(uint8_t b, hal_time_t end);
+
+// Board
+static uint8_t int1_en, int1_flag;
+static uint8_t led, opt = 0xFF;
+static uint8_t wdt_on;
+static hal_time_t wdt_kicked;
+
+static void advance_to(hal_time_t t);
+static void dispatch(void);
+static void raise(uint8_t irq, uint8_t *flag);
+static void update_wire(uint8_t line);
+
+// Events
+
+static void heap_swap(size_t a, size_t b) {
+    Event tmp = events[a];
+    events[a] = events[b];
+    events[b] = tmp;
+}
+
+static uint8_t heap_before(size_t a, size_t b) {
+    return (events[a].when < events[b].when) || ((events[a].when == events[b].when) && (events[a].seq < events[b].seq));
+}
+
+void hal_host_at(hal_time_t when, void (*fn)(void *ctx), void *ctx) {
+    size_t idx;
+
+    if(event_count == event_cap) {
+        event_cap = event_cap ? (event_cap * 2) : 64;
+        events = realloc(events, event_cap * sizeof(Event));
+        if(!events) abort();
+    }
+
+    idx = event_count++;
+    events[idx].when = (when < now) ? now : when;
+    events[idx].seq = event_seq++;
+    events[idx].fn = fn;
+    events[idx].ctx = ctx;
+
+    while(idx && heap_before(idx, (idx - 1) / 2)) {
+        heap_swap(idx, (idx - 1) / 2);
+        idx = (idx - 1) / 2;
+    }
+}
+
+static Event heap_pop(void) {
+    Event top = events[0];
+    size_t idx = 0;
+
+    events[0] = events[--event_count];
+    while(1) {
+        size_t l = (2 * idx) + 1, r = l + 1, min = idx;
+
+        if((l < event_count) && heap_before(l, min)) min = l;
+        if((r < event_count) && heap_before(r, min)) min = r;
+        if(min == idx) break;
+
+        heap_swap(idx, min);
+        idx = min;
+    }
+
+    return top;
+}
+
+// Clock
+
+static hal_time_t next_time(void) {
+    hal_time_t next = event_count ? events[0].when : FOREVER;
+
+    if(t0_on && (t0_next < next)) next = t0_next;
+    if(t1_on && (t1_next < next)) next = t1_next;
+    if(t2_on && (t2_next < next)) next = t2_next;
+    if(shifting && (shift_end < next)) next = shift_end;
+
+    return next;
+}
+
+static void uart_shift_done(void) {
+    stats.uart_tx_bytes++;
+    if(uart_cb) uart_cb(shift_byte, now);
+
+    if(udr_full) { // The next byte was waiting in the data register
+        udr_full = 0;
+        shift_byte = udr_byte;
+        shift_end = now + (frame_bits * bit_cycles);
+    } else {
+        shifting = 0;
+        txc = 1;
+    }
+}
+
+static void advance_to(hal_time_t t) {
+    if(advancing) return; // An event callback called back into the HAL
+
+    advancing = 1;
+    while(1) {
+        hal_time_t next = next_time();
+
+        if(next > t) break;
+        now = next;
+
+        if(t1_on && (t1_next == now)) {
+            t1_last = now;
+            t1_next += t1_period;
+            raise(HAL_HOST_IRQ_MILLIS, &t1_flag);
+        }
+        if(t0_on && (t0_next == now)) {
+            t0_next += 256 * t0_div;
+            raise(HAL_HOST_IRQ_PS2_TIMER, &t0_flag);
+        }
+        if(t2_on && (t2_next == now)) {
+            t2_next += t2_period;
+            raise(HAL_HOST_IRQ_DIAG_TIMER, &t2_flag);
+        }
+        if(shifting && (shift_end == now)) uart_shift_done();
+        while(event_count && (events[0].when == now)) {
+            Event ev = heap_pop();
+            ev.fn(ev.ctx);
+        }
+
+        if(wdt_on && ((now - wdt_kicked) > WDT_TIMEOUT)) hal_host_stop(HAL_HOST_WDT);
+
+        advancing = 0;
+        dispatch();
+        advancing = 1;
+    }
+    if(t > now) now = t;
+    advancing = 0;
+
+    dispatch();
+}
+
+// Charge the cost of a call from the main context
+static void tick(void) {
+    if(!in_isr) advance_to(now + call_cost);
+}
+
+// Interrupts
+
+static void raise(uint8_t irq, uint8_t *flag) {
+    if(!*flag) irq_raised[irq] = now;
+    *flag = 1;
+}
+
+static void run_isr(uint8_t irq, void (*isr)(void)) {
+    hal_time_t wait = now - irq_raised[irq];
+
+    if(wait > stats.irq_wait_max[irq]) stats.irq_wait_max[irq] = wait;
+    stats.irqs[irq]++;
+
+    in_isr = 1;
+    irq_on = 0;
+    isr();
+    irq_on = 1;
+    in_isr = 0;
+}
+
+static void dispatch(void) {
+    if(!irq_on || in_isr || advancing) return;
+
+    while(1) {
+        if(int0_flag && int0_en) {
+            int0_flag = 0;
+            int0_runs++;
+            run_isr(HAL_HOST_IRQ_PS2_CLK, hal_isr_ps2_clk);
+        } else if(int1_flag && int1_en) {
+            int1_flag = 0;
+            run_isr(HAL_HOST_IRQ_RTS, hal_isr_rts);
+        } else if(t2_flag && t2_on) {
+            t2_flag = 0;
+            run_isr(HAL_HOST_IRQ_DIAG_TIMER, hal_isr_diag_timer);
+        } else if(t1_flag && t1_on) {
+            t1_flag = 0;
+            run_isr(HAL_HOST_IRQ_MILLIS, hal_isr_millis);
+        } else if(t0_flag && t0_on) {
+            t0_flag = 0;
+            run_isr(HAL_HOST_IRQ_PS2_TIMER, hal_isr_ps2_timer);
+        } else if(rxc && uart_on) { // Reading the data register clears the flag
+            run_isr(HAL_HOST_IRQ_UART_RX, hal_isr_uart_rx);
+            rxc = 0;
+        } else if(udrie && !udr_full && uart_on) {
+            irq_raised[HAL_HOST_IRQ_UART_UDRE] = now;
+            run_isr(HAL_HOST_IRQ_UART_UDRE, hal_isr_uart_udre);
+        } else break;
+    }
+}
+
+uint8_t hal_irq_save(void) {
+    uint8_t state = irq_on;
+
+    irq_on = 0;
+
+    return state;
+}
+
+void hal_irq_restore(uint8_t state) {
+    irq_on = state;
+    if(state) tick();
+}
+
+void hal_irq_enable(void) {
+    irq_on = 1;
+    tick();
+}
+
+uint8_t hal_irq_enabled(void) {
+    return irq_on;
+}
+
+void hal_spin(void) {
+    if(in_isr) advance_to(now + call_cost); // Waiting with interrupts disabled
+    else tick();
+}
+
+// PS/2 lines
+
+static void update_wire(uint8_t line) {
+    uint8_t level = !(dev_low[line] || (fw_out[line] && !fw_high[line]));
+
+    if(level == wire[line]) return;
+    wire[line] = level;
+
+    if((line == HAL_PS2_CLK) && !level) {
+        raise(HAL_HOST_IRQ_PS2_CLK, &int0_flag);
+        dispatch();
+    }
+}
+
+static void fw_line_changed(uint8_t line) {
+    update_wire(line);
+    if(ps2_cb) ps2_cb(line, (fw_out[line] && !fw_high[line]) ? 0 : 1);
+}
+
+uint8_t hal_ps2_get(uint8_t line) {
+    return wire[line];
+}
+
+void hal_ps2_set(uint8_t line, uint8_t level) {
+    fw_high[line] = level ? 1 : 0;
+    fw_line_changed(line);
+}
+
+void hal_ps2_input(uint8_t line, uint8_t in) {
+    fw_out[line] = in ? 0 : 1;
+    fw_line_changed(line);
+}
+
+void hal_ps2_int(uint8_t enable) {
+    if(enable) int0_flag = 0;
+    int0_en = enable;
+    dispatch();
+}
+
+void hal_ps2_int_init(void) {
+}
+
+void hal_ps2_timer_start(uint8_t ticks, uint8_t div) {
+    t0_div = (div == HAL_TIMER_DIV8) ? 8 : 256;
+    t0_next = now + ((hal_time_t)ticks + 1) * t0_div;
+    t0_on = 1;
+}
+
+void hal_ps2_timer_stop(void) {
+    t0_on = 0;
+}
+
+void hal_host_ps2_drive(uint8_t line, uint8_t low) {
+    dev_low[line] = low ? 1 : 0;
+    update_wire(line);
+}
+
+uint8_t hal_host_ps2_level(uint8_t line) {
+    return wire[line];
+}
+
+void hal_host_on_ps2(void (*fn)(uint8_t line, uint8_t level)) {
+    ps2_cb = fn;
+}
+
+// Millisecond timer
+
+void hal_millis_init(uint16_t top) {
+    t1_period = ((hal_time_t)top + 1) * 8;
+    t1_last = now;
+    t1_next = now + t1_period;
+    t1_on = 1;
+}
+
+uint16_t hal_millis_count(void) {
+    return (now - t1_last) / 8;
+}
+
+uint8_t hal_millis_pending(void) {
+    return t1_flag;
+}
+
+// Diagnostic output
+
+// Sample the bits of the frame whose middle came before t, at the level the pin had until now
+static void diag_sample(hal_time_t t) {
+    while(diag_in_frame && (diag_next < 10) && ((diag_start + (diag_next * diag_bit) + (diag_bit / 2)) <= t)) {
+        if(diag_level) diag_frame |= 1 << diag_next;
+        diag_next++;
+    }
+}
+
+static void diag_frame_end(void *ctx) {
+    diag_sample(now);
+    diag_in_frame = 0;
+
+    if((diag_frame & 0x001) || !(diag_frame & 0x200)) { // Start bit high or stop bit low
+        stats.diag_frame_errors++;
+        return;
+    }
+
+    stats.diag_tx_bytes++;
+    if(diag_cb) diag_cb((diag_frame >> 1) & 0xFF, now);
+}
+
+void hal_diag_init(void) {
+    diag_level = 1;
+}
+
+void hal_diag_set(uint8_t level) {
+    level = level ? 1 : 0;
+    if(level == diag_level) return;
+
+    diag_sample(now);
+    diag_level = level;
+
+    if(!diag_in_frame && !level) { // Start bit
+        diag_in_frame = 1;
+        diag_frame = 0;
+        diag_next = 0;
+        diag_start = now;
+        diag_bit = t2_period;
+        hal_host_at(now + (10 * diag_bit), diag_frame_end, NULL);
+    }
+}
+
+void hal_diag_timer_start(uint8_t top) {
+    t2_period = ((hal_time_t)top + 1) * 8;
+    t2_next = now + t2_period;
+    t2_flag = 0;
+    t2_on = 1;
+}
+
+void hal_diag_timer_stop(void) {
+    t2_on = 0;
+}
+
+void hal_host_on_diag_tx(void (*fn)(uint8_t b, hal_time_t end)) {
+    diag_cb = fn;
+}
+
+// Firmware built without the diagnostic output
+void __attribute__((weak)) hal_isr_diag_timer(void) {
+}
+
+// UART
+
+void hal_uart_setbaud(uint16_t ubrr, uint8_t u2x) {
+    bit_cycles = (u2x ? 8 : 16) * ((hal_time_t)ubrr + 1);
+}
+
+void hal_uart_setformat(uint8_t odd_parity) {
+    frame_bits = odd_parity ? 11 : 10;
+}
+
+void hal_uart_enable(void) {
+    uart_on = 1;
+    dispatch();
+}
+
+void hal_uart_disable(void) {
+    uart_on = 0;
+}
+
+void hal_uart_put(uint8_t b) {
+    txc = 0;
+
+    if(!shifting) { // Straight into the shift register
+        shifting = 1;
+        shift_byte = b;
+        shift_end = now + (frame_bits * bit_cycles);
+    } else {
+        udr_full = 1;
+        udr_byte = b;
+    }
+}
+
+uint8_t hal_uart_get(void) {
+    rxc = 0;
+
+    return rx_byte;
+}
+
+uint8_t hal_uart_tx_ready(void) {
+    return !udr_full;
+}
+
+uint8_t hal_uart_tx_done(void) {
+    return txc;
+}
+
+void hal_uart_tx_int(uint8_t enable) {
+    udrie = enable;
+    dispatch();
+}
+
+void hal_host_uart_rx(uint8_t b) {
+    if(!uart_on) return;
+
+    if(rxc) {
+        stats.uart_rx_overruns++;
+        return;
+    }
+
+    rx_byte = b;
+    irq_raised[HAL_HOST_IRQ_UART_RX] = now;
+    rxc = 1;
+    dispatch();
+}
+
+void hal_host_on_uart_tx(void (*fn)(uint8_t b, hal_time_t end)) {
+    uart_cb = fn;
+}
+
+uint32_t hal_host_uart_baud(void) {
+    return F_CPU / bit_cycles;
+}
+
+uint8_t hal_host_uart_frame_bits(void) {
+    return frame_bits;
+}
+
+// Board
+
+void io_init(void) {
+    fw_out[HAL_PS2_CLK] = fw_out[HAL_PS2_DAT] = 0;
+    fw_high[HAL_PS2_CLK] = fw_high[HAL_PS2_DAT] = 0;
+    update_wire(HAL_PS2_CLK);
+    update_wire(HAL_PS2_DAT);
+}
+
+void hal_led(uint8_t on) {
+    led = on ? 1 : 0;
+}
+
+uint8_t hal_host_led(void) {
+    return led;
+}
+
+uint8_t hal_opt_read(void) {
+    return opt;
+}
+
+void hal_host_set_opt(uint8_t header) {
+    opt = header;
+}
+
+void hal_rts_init(void) {
+    int1_en = 1;
+}
+
+void hal_host_rts(void) {
+    raise(HAL_HOST_IRQ_RTS, &int1_flag);
+    dispatch();
+}
+
+void hal_delay_ms(uint16_t ms) {
+    if(ms) advance_to(now + HAL_HOST_MS(ms));
+    else tick();
+}
+
+void hal_wdt_start(void) {
+    wdt_on = 1;
+    wdt_kicked = now;
+}
+
+void hal_wdt_kick(void) {
+    wdt_kicked = now;
+}
+
+void hal_wdt_stop(void) {
+    wdt_on = 0;
+}
+
+void hal_wdt_expire(void) {
+    hal_host_stop(HAL_HOST_WDT);
+}
+
+void hal_sleep_powerdown(void) {
+    uint32_t runs = int0_runs;
+
+    // Any activity on the PS/2 clock wakes us up
+    while(int0_runs == runs) {
+        hal_time_t next = next_time();
+
+        if(!event_count) hal_host_stop(HAL_HOST_IDLE); // Only the timers are left, nothing will ever come
+        advance_to(next);
+    }
+}
+
+
+// Simulation control
+
+int hal_host_run(int (*entry)(void)) {
+    int reason;
+
+    irq_on = in_isr = advancing = 0;
+    memset(&stats, 0, sizeof(stats));
+    int0_en = int0_flag = int1_en = int1_flag = 0;
+    memset(fw_out, 0, sizeof(fw_out));
+    update_wire(HAL_PS2_CLK);
+    update_wire(HAL_PS2_DAT);
+    t0_on = t0_flag = t1_on = t1_flag = t2_on = t2_flag = 0;
+    diag_level = 1;
+    diag_in_frame = 0;
+    uart_on = udrie = txc = udr_full = shifting = rxc = 0;
+    wdt_on = 0;
+
+    reason = setjmp(run_jmp);
+    if(!reason) {
+        entry();
+        reason = HAL_HOST_EXIT;
+    }
+
+    // What was left for this run is of no use to the next one
+    in_isr = advancing = 0;
+    event_count = 0;
+
+    return reason;
+}
+
+void hal_host_stop(int reason) {
+    longjmp(run_jmp, reason);
+}
+
+hal_time_t hal_host_now(void) {
+    return now;
+}
+
+const HalHostStats *hal_host_stats(void) {
+    return &stats;
+}
+
+void hal_host_set_cost(uint32_t cycles) {
+    call_cost = cycles;
+}
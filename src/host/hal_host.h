@@ -0,0 +1,186 @@
+#ifndef _HAL_HOST_HEADER_
+#define _HAL_HOST_HEADER_
+
+// Host backend of the hardware abstraction layer, see hal.h
+//
+// The peripherals are simulated on a virtual clock counting CPU cycles at F_CPU.
+// Interrupt handlers run as soon as they are enabled and their flag is set, and take no time.
+// The main context only moves the clock forward when it calls into the HAL: every call costs
+// a configurable number of cycles, hal_spin() and hal_delay_ms() let the time flow.
+// Nested interrupts (ISR_NOBLOCK) are not simulated.
+
+#include <stdint.h>
+
+// Interrupts
+
+#define ISR_NOBLOCK
+
+#define HAL_ISR(vect, ...) void vect(void)
+
+#define HAL_VECT_PS2_CLK hal_isr_ps2_clk
+#define HAL_VECT_PS2_TIMER hal_isr_ps2_timer
+#define HAL_VECT_MILLIS hal_isr_millis
+#define HAL_VECT_RTS hal_isr_rts
+#define HAL_VECT_UART_RX hal_isr_uart_rx
+#define HAL_VECT_UART_UDRE hal_isr_uart_udre
+#define HAL_VECT_DIAG_TIMER hal_isr_diag_timer
+
+void hal_isr_ps2_clk(void);
+void hal_isr_ps2_timer(void);
+void hal_isr_millis(void);
+void hal_isr_rts(void);
+void hal_isr_uart_rx(void);
+void hal_isr_uart_udre(void);
+void hal_isr_diag_timer(void);
+
+uint8_t hal_irq_save(void);
+void hal_irq_restore(uint8_t state);
+
+static inline void hal_irq_restore_ptr(const uint8_t *state) {
+    hal_irq_restore(*state);
+}
+
+#define HAL_ATOMIC for(uint8_t hal_sreg __attribute__((cleanup(hal_irq_restore_ptr))) = hal_irq_save(), hal_once = 1; \
+                       hal_once; hal_once = 0)
+
+void hal_irq_enable(void);
+uint8_t hal_irq_enabled(void);
+void hal_spin(void);
+
+// PS/2 lines
+
+#define HAL_PS2_CLK 0
+#define HAL_PS2_DAT 1
+
+uint8_t hal_ps2_get(uint8_t line);
+void hal_ps2_set(uint8_t line, uint8_t level);
+void hal_ps2_input(uint8_t line, uint8_t in);
+void hal_ps2_int(uint8_t enable);
+void hal_ps2_int_init(void);
+
+#define HAL_TIMER_DIV8 0x02
+#define HAL_TIMER_DIV256 0x04
+
+void hal_ps2_timer_start(uint8_t ticks, uint8_t div);
+void hal_ps2_timer_stop(void);
+
+// Millisecond timer
+
+void hal_millis_init(uint16_t top);
+uint16_t hal_millis_count(void);
+uint8_t hal_millis_pending(void);
+
+// Diagnostic output
+
+void hal_diag_init(void);
+void hal_diag_set(uint8_t level);
+void hal_diag_timer_start(uint8_t top);
+void hal_diag_timer_stop(void);
+
+// UART
+
+void hal_uart_setbaud(uint16_t ubrr, uint8_t u2x);
+void hal_uart_setformat(uint8_t odd_parity);
+void hal_uart_enable(void);
+void hal_uart_disable(void);
+void hal_uart_put(uint8_t b);
+uint8_t hal_uart_get(void);
+uint8_t hal_uart_tx_ready(void);
+uint8_t hal_uart_tx_done(void);
+void hal_uart_tx_int(uint8_t enable);
+
+// Board
+
+void hal_led(uint8_t on);
+uint8_t hal_opt_read(void);
+void hal_rts_init(void);
+void hal_delay_ms(uint16_t ms);
+void hal_wdt_start(void);
+void hal_wdt_kick(void);
+void hal_wdt_stop(void);
+void hal_wdt_expire(void);
+void hal_sleep_powerdown(void);
+
+// Simulation side, used by the emulator and the benchmarks
+
+typedef uint64_t hal_time_t; // CPU cycles
+
+#define HAL_HOST_US(us) ((hal_time_t)(us) * (F_CPU / 1000000UL))
+#define HAL_HOST_MS(ms) ((hal_time_t)(ms) * (F_CPU / 1000UL))
+
+// Why hal_host_run() returned
+#define HAL_HOST_EXIT 0 // The firmware returned from main()
+#define HAL_HOST_STOP 1 // hal_host_stop() was called
+#define HAL_HOST_WDT 2 // The watchdog expired
+#define HAL_HOST_IDLE 3 // Sleeping with nothing left that could wake the board up
+
+// Interrupt handlers run by the simulation, in vector order
+#define HAL_HOST_IRQ_PS2_CLK 0
+#define HAL_HOST_IRQ_RTS 1
+#define HAL_HOST_IRQ_DIAG_TIMER 2
+#define HAL_HOST_IRQ_MILLIS 3
+#define HAL_HOST_IRQ_PS2_TIMER 4
+#define HAL_HOST_IRQ_UART_RX 5
+#define HAL_HOST_IRQ_UART_UDRE 6
+#define HAL_HOST_IRQ_COUNT 7
+
+typedef struct {
+    uint32_t irqs[HAL_HOST_IRQ_COUNT]; // Handlers run
+    hal_time_t irq_wait_max[HAL_HOST_IRQ_COUNT]; // Longest time a flag waited for its handler, in cycles
+    uint32_t uart_rx_overruns; // Bytes from the host lost because the last one was not read yet
+    uint32_t uart_tx_bytes; // Bytes sent by the board
+    uint32_t diag_tx_bytes; // Bytes decoded on the diagnostic output
+    uint32_t diag_frame_errors; // Frames on the diagnostic output with a bad start or stop bit
+} HalHostStats;
+
+/**
+ * Runs the firmware until it stops, see HAL_HOST_*. Resets the simulated peripherals first, but the
+ * state of the firmware itself is only reset by starting a new process. The EEPROM keeps its content.
+ * Events scheduled before the run are kept, the ones left at the end are dropped. The clock keeps
+ * going from one run to the next.
+ * @param entry The firmware main()
+ * @return Why the run ended
+ */
+int hal_host_run(int (*entry)(void));
+
+// End the run from an event callback, hal_host_run() returns reason
+void hal_host_stop(int reason);
+
+hal_time_t hal_host_now(void);
+const HalHostStats *hal_host_stats(void);
+
+// Cycles charged to every call the main context makes into the HAL (default 64)
+void hal_host_set_cost(uint32_t cycles);
+
+/**
+ * Calls fn(ctx) when the simulated clock reaches the given time. Callbacks scheduled for the same
+ * time run in the order they were scheduled.
+ */
+void hal_host_at(hal_time_t when, void (*fn)(void *ctx), void *ctx);
+
+// The device side of the PS/2 lines: low != 0 pulls the line low, otherwise it's released
+void hal_host_ps2_drive(uint8_t line, uint8_t low);
+// Level on the wire, 1 if nobody pulls the line low
+uint8_t hal_host_ps2_level(uint8_t line);
+// Called every time the firmware changes how it drives a PS/2 line
+void hal_host_on_ps2(void (*fn)(uint8_t line, uint8_t level));
+
+// A byte from the host reaches the UART receiver
+void hal_host_uart_rx(uint8_t b);
+// Called at the end of the stop bit of every byte the board sends
+void hal_host_on_uart_tx(void (*fn)(uint8_t b, hal_time_t end));
+// Current serial speed, in bit/s, and bits in every frame
+uint32_t hal_host_uart_baud(void);
+uint8_t hal_host_uart_frame_bits(void);
+
+// Called at the end of the stop bit of every byte decoded on the diagnostic output pin, sampled in
+// the middle of every bit at the speed Timer2 runs at when the start bit begins
+void hal_host_on_diag_tx(void (*fn)(uint8_t b, hal_time_t end));
+
+// The host toggles RTS
+void hal_host_rts(void);
+// Jumpers on the option header, bits set are open (default 0xFF: nothing jumpered)
+void hal_host_set_opt(uint8_t header);
+uint8_t hal_host_led(void);
+
+#endif /* _HAL_HOST_HEADER_ */
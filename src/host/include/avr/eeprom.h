@@ -0,0 +1,23 @@
+#ifndef _HOST_EEPROM_H_
+#define _HOST_EEPROM_H_
+
+// Host version of the avr-libc EEPROM access, backed by an array in the host backend.
+// It starts erased, like a new chip.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define HOST_EEPROM_SIZE 1024
+
+extern uint8_t hal_host_eeprom[HOST_EEPROM_SIZE];
+
+static inline void eeprom_read_block(void *dst, const void *src, size_t len) {
+    memcpy(dst, &hal_host_eeprom[(uintptr_t)src], len);
+}
+
+static inline void eeprom_update_block(const void *src, void *dst, size_t len) {
+    memcpy(&hal_host_eeprom[(uintptr_t)dst], src, len);
+}
+
+#endif /* _HOST_EEPROM_H_ */
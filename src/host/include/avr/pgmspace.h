@@ -0,0 +1,17 @@
+#ifndef _HOST_PGMSPACE_H_
+#define _HOST_PGMSPACE_H_
+
+// Host version of the avr-libc program memory helpers: everything lives in the same address space
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define memcpy_P(dst, src, len) memcpy((dst), (src), (len))
+#define printf_P printf
+
+#endif /* _HOST_PGMSPACE_H_ */
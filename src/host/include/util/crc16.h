@@ -0,0 +1,15 @@
+#ifndef _HOST_CRC16_H_
+#define _HOST_CRC16_H_
+
+// Host version of the avr-libc CRC16 (polynomial 0xA001, reflected)
+
+#include <stdint.h>
+
+static inline uint16_t _crc16_update(uint16_t crc, uint8_t data) {
+    crc ^= data;
+    for(uint8_t i = 0; i < 8; i++) crc = (crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+
+    return crc;
+}
+
+#endif /* _HOST_CRC16_H_ */
@@ -0,0 +1,572 @@
+// Simulated PS/2 mouse, see ps2dev.h
+
+#include <stdint.h>
+#include <string.h>
+
+#include "hal.h"
+#include "ps2dev.h"
+
+#define TX_QUEUE_LEN 64 // Must be a power of 2
+
+// Timing, the clock runs at 12.5 kHz
+#define T_SETUP HAL_HOST_US(20) // Data changes this long before the falling edge
+#define T_HALF HAL_HOST_US(40) // Half a clock period
+#define T_GAP HAL_HOST_US(100) // Between bytes
+#define T_RESPONSE HAL_HOST_US(500) // From the end of a command to the response
+#define T_RTS HAL_HOST_US(100) // From a request to send to the first clock pulse
+#define T_SELFTEST HAL_HOST_MS(350) // Power on or reset to the self test result
+
+#define BAT_OK 0xAA
+#define ACK 0xFA
+#define RESEND 0xFE
+
+enum {
+    BUS_IDLE = 0,
+    BUS_TX,
+    BUS_RX
+};
+
+// Device state
+static uint8_t model, id;
+static uint8_t rate, res, scaling21, remote, enabled, passive, mute;
+static uint8_t arg_cmd; // Command waiting for its argument
+static uint8_t rate_hist[3]; // Last sample rates set, to spot the unlock sequences
+
+// Movement not reported yet
+static int32_t acc_dx, acc_dy, acc_dz;
+static uint8_t btns, sent_btns;
+
+// Transmitter
+static uint8_t tx_queue[TX_QUEUE_LEN];
+static uint8_t tx_report[TX_QUEUE_LEN]; // For the bytes of a report: its length in the high nibble, the position from 1 in the low one
+static uint8_t tx_flip[TX_QUEUE_LEN]; // Frame bit to invert plus one, 0 for a good frame, see ps2dev_send_fault()
+static uint8_t tx_head, tx_tail;
+static uint8_t last_tx;
+static uint16_t tx_frame; // Start, data, parity and stop bits, LSB first
+static uint8_t tx_bit;
+static uint8_t tx_phase; // 0 data setup, 1 clock low, 2 clock high
+static uint8_t kick_pending;
+static hal_time_t tx_hold; // No transmission before this time
+
+// Receiver
+static uint8_t rx_pulse;
+static uint8_t rx_clock_low;
+static uint16_t rx_frame;
+
+// Report going out, for the report callback
+static uint8_t out_report[4];
+static uint8_t out_len;
+
+static uint8_t bus;
+static uintptr_t bus_gen, sample_gen, selftest_gen;
+static uint8_t fw_clk = 1, fw_dat = 1; // How the firmware drives the lines
+
+static void (*sample_cb)(void);
+static void (*stream_cb)(uint8_t on);
+static void (*report_cb)(const uint8_t *report, uint8_t len, hal_time_t end);
+static void (*fault_cb)(uint8_t kind, uint8_t bit, hal_time_t when);
+static void (*command_cb)(uint8_t b);
+static Ps2DevStats stats;
+
+// Line faults
+static Ps2DevFaults faults;
+static uint8_t faults_on;
+static uint32_t fault_seed;
+static uint8_t tx_fault, tx_fault_bit; // Fault of the frame going out, and the bit it hits
+
+static void tx_kick(void);
+static void tx_start(void *ctx);
+static void tx_step(void *ctx);
+static void rx_step(void *ctx);
+static void sample_tick(void *ctx);
+static void selftest_done(void *ctx);
+static void set_defaults(void);
+static void set_enabled(uint8_t on);
+
+static void drive(uint8_t line, uint8_t low) {
+    hal_host_ps2_drive(line, low);
+}
+
+// Everything scheduled on the bus so far is void
+static void bus_reset(void) {
+    bus_gen++;
+    drive(HAL_PS2_CLK, 0);
+    drive(HAL_PS2_DAT, 0);
+    bus = BUS_IDLE;
+    kick_pending = 0;
+}
+
+static void queue_mark(uint8_t b, uint8_t mark) {
+    uint8_t next = (tx_head + 1) & (TX_QUEUE_LEN - 1);
+
+    if(next == tx_tail) return; // Full, like a real mouse we just lose it
+
+    tx_queue[tx_head] = b;
+    tx_report[tx_head] = mark;
+    tx_flip[tx_head] = 0;
+    tx_head = next;
+    tx_kick();
+}
+
+static void queue(uint8_t b) {
+    queue_mark(b, 0);
+}
+
+// A byte of a report made it to the host
+static void report_byte(uint8_t b, uint8_t mark) {
+    uint8_t len = mark >> 4, pos = mark & 0x0F;
+
+    if(pos == 1) out_len = 0;
+    if(pos != (out_len + 1)) return; // Some of it never made it
+
+    out_report[out_len++] = b;
+    if((out_len == len) && report_cb) report_cb(out_report, len, hal_host_now());
+}
+
+static uint8_t queue_free(void) {
+    return (tx_tail - tx_head - 1) & (TX_QUEUE_LEN - 1);
+}
+
+// Line faults
+
+static uint32_t fault_rand(void) {
+    fault_seed = (fault_seed * 1103515245UL) + 12345UL;
+
+    return (fault_seed >> 8) & 0xFFFFFF;
+}
+
+static uint8_t fault_roll(double p) {
+    return (p > 0) && (fault_rand() < (p * 16777216.0));
+}
+
+// Picks the fault, if any, of the frame about to go out
+static void fault_pick(void) {
+    tx_fault = 0;
+    if(!faults_on) return;
+
+    if(fault_roll(faults.flip)) tx_fault = PS2DEV_FAULT_FLIP;
+    else if(fault_roll(faults.drop)) tx_fault = PS2DEV_FAULT_DROP;
+    else if(fault_roll(faults.truncate)) tx_fault = PS2DEV_FAULT_TRUNCATE;
+    if(!tx_fault) return;
+
+    // Any of the 11 bits, but a frame is cut after its start bit at least
+    tx_fault_bit = (tx_fault == PS2DEV_FAULT_TRUNCATE) ? (1 + (fault_rand() % 10)) : (fault_rand() % 11);
+    stats.faults++;
+    if(fault_cb) fault_cb(tx_fault, tx_fault_bit, hal_host_now());
+}
+
+// Transmitter
+
+static void tx_kick(void) {
+    hal_time_t when = hal_host_now() + T_GAP;
+
+    if((bus != BUS_IDLE) || kick_pending || (tx_head == tx_tail)) return;
+
+    if(when < tx_hold) when = tx_hold;
+    kick_pending = 1;
+    hal_host_at(when, tx_start, (void *)bus_gen);
+}
+
+static void tx_start(void *ctx) {
+    uint8_t b, parity = 1;
+
+    if((uintptr_t)ctx != bus_gen) return;
+    kick_pending = 0;
+
+    if((bus != BUS_IDLE) || (tx_head == tx_tail)) return;
+    if(!hal_host_ps2_level(HAL_PS2_CLK)) return; // Inhibited, we start again when the clock is released
+
+    b = tx_queue[tx_tail];
+    for(uint8_t idx = 0; idx < 8; idx++) parity ^= (b >> idx) & 0x01;
+
+    tx_frame = ((uint16_t)b << 1) | ((uint16_t)parity << 9) | (1 << 10); // The start bit is 0
+    tx_bit = 0;
+    tx_phase = 0;
+    bus = BUS_TX;
+    fault_pick();
+    if(tx_flip[tx_tail]) { // Sent bad on purpose, once: if the host cuts it short it goes out again right
+        tx_fault = PS2DEV_FAULT_FLIP;
+        tx_fault_bit = tx_flip[tx_tail] - 1;
+        tx_flip[tx_tail] = 0;
+    }
+
+    tx_step((void *)bus_gen);
+}
+
+// The frame is out, as far as we know
+static void tx_done(void) {
+    last_tx = tx_queue[tx_tail];
+    if(tx_report[tx_tail]) report_byte(last_tx, tx_report[tx_tail]);
+    tx_tail = (tx_tail + 1) & (TX_QUEUE_LEN - 1);
+    stats.bytes_sent++;
+    drive(HAL_PS2_DAT, 0);
+    bus = BUS_IDLE;
+    tx_kick();
+}
+
+// Every bit goes through three steps: data setup, clock low, clock high
+static void tx_step(void *ctx) {
+    uint8_t fault_here;
+
+    if(((uintptr_t)ctx != bus_gen) || (bus != BUS_TX)) return;
+
+    fault_here = tx_fault && (tx_bit == tx_fault_bit);
+
+    if(tx_phase == 0) {
+        if(!hal_host_ps2_level(HAL_PS2_CLK)) { // The host is inhibiting the transfer
+            stats.bytes_aborted++;
+            bus_reset();
+            return;
+        }
+
+        if(fault_here && (tx_fault == PS2DEV_FAULT_TRUNCATE)) { // The rest of the frame never makes it
+            tx_done();
+            return;
+        }
+
+        drive(HAL_PS2_DAT, !(((tx_frame >> tx_bit) & 0x01) ^ (fault_here && (tx_fault == PS2DEV_FAULT_FLIP))));
+        tx_phase = 1;
+        hal_host_at(hal_host_now() + T_SETUP, tx_step, ctx);
+    } else if(tx_phase == 1) {
+        if(!fault_here || (tx_fault != PS2DEV_FAULT_DROP)) drive(HAL_PS2_CLK, 1);
+        tx_phase = 2;
+        hal_host_at(hal_host_now() + T_HALF, tx_step, ctx);
+    } else {
+        drive(HAL_PS2_CLK, 0);
+        tx_phase = 0;
+
+        if(!hal_host_ps2_level(HAL_PS2_CLK) && (tx_bit < 10)) { // Held low by the host: the byte will be sent again
+            stats.bytes_aborted++;
+            bus_reset();
+            return;
+        }
+
+        if(++tx_bit < 11) {
+            hal_host_at(hal_host_now() + (T_HALF - T_SETUP), tx_step, ctx);
+            return;
+        }
+
+        tx_done();
+    }
+}
+
+// Receiver
+
+static void handle_byte(uint8_t b);
+
+static void rx_step(void *ctx) {
+    if(((uintptr_t)ctx != bus_gen) || (bus != BUS_RX)) return;
+
+    if(!rx_clock_low) {
+        drive(HAL_PS2_CLK, 1);
+        rx_clock_low = 1;
+        rx_pulse++;
+        hal_host_at(hal_host_now() + T_HALF, rx_step, ctx);
+        return;
+    }
+
+    drive(HAL_PS2_CLK, 0);
+    rx_clock_low = 0;
+
+    if(rx_pulse <= 10) { // Data, parity and stop bits are read on the rising edge
+        rx_frame |= (uint16_t)(hal_host_ps2_level(HAL_PS2_DAT) ? 1 : 0) << (rx_pulse - 1);
+        if(rx_pulse == 10) drive(HAL_PS2_DAT, 1); // Acknowledge
+        hal_host_at(hal_host_now() + T_HALF, rx_step, ctx);
+    } else {
+        uint8_t b = rx_frame & 0xFF, ones = 0;
+
+        drive(HAL_PS2_DAT, 0);
+        bus = BUS_IDLE;
+
+        for(uint8_t idx = 0; idx < 9; idx++) ones += (rx_frame >> idx) & 0x01;
+
+        tx_hold = hal_host_now() + T_RESPONSE;
+        if(!(ones & 0x01) || !(rx_frame & 0x200)) { // Bad parity or stop bit
+            stats.rx_errors++;
+            if(!mute) queue(RESEND);
+        } else {
+            stats.commands++;
+            if(command_cb) command_cb(b);
+            if(!mute) handle_byte(b);
+        }
+    }
+}
+
+// Follow how the firmware drives the lines
+static void lines_changed(uint8_t line, uint8_t level) {
+    uint8_t prev_clk = fw_clk;
+
+    if(line == HAL_PS2_CLK) fw_clk = level;
+    else fw_dat = level;
+
+    if((line != HAL_PS2_CLK) || prev_clk || !fw_clk) return;
+
+    if(!fw_dat) { // Clock released with data held low: request to send
+        if(bus == BUS_TX) stats.bytes_aborted++;
+        bus_reset();
+
+        bus = BUS_RX;
+        rx_pulse = 0;
+        rx_clock_low = 0;
+        rx_frame = 0;
+        hal_host_at(hal_host_now() + T_RTS, rx_step, (void *)bus_gen);
+    } else {
+        tx_kick(); // The inhibit is over
+    }
+}
+
+// Commands
+
+static void queue_report(void) {
+    int16_t dx = (acc_dx > 255) ? 255 : ((acc_dx < -255) ? -255 : acc_dx);
+    int16_t dy = (acc_dy > 255) ? 255 : ((acc_dy < -255) ? -255 : acc_dy);
+    int8_t dz;
+    uint8_t head = 0x08 | (btns & 0x07);
+    uint8_t len = (id == PS2DEV_STANDARD) ? 0x30 : 0x40;
+
+    if(id == PS2DEV_EXPLORER) dz = (acc_dz > 7) ? 7 : ((acc_dz < -8) ? -8 : acc_dz);
+    else dz = (acc_dz > 127) ? 127 : ((acc_dz < -127) ? -127 : acc_dz);
+
+    if(dx < 0) head |= 0x10;
+    if(dy < 0) head |= 0x20;
+
+    queue_mark(head, len | 1);
+    queue_mark(dx & 0xFF, len | 2);
+    queue_mark(dy & 0xFF, len | 3);
+    if(id == PS2DEV_EXPLORER) queue_mark((dz & 0x0F) | (btns & (PS2DEV_BTN_4 | PS2DEV_BTN_5)), len | 4);
+    else if(id == PS2DEV_WHEEL) queue_mark(dz, len | 4);
+
+    acc_dx -= dx;
+    acc_dy -= dy;
+    acc_dz = (id == PS2DEV_STANDARD) ? 0 : (acc_dz - dz);
+    sent_btns = btns;
+    stats.reports++;
+}
+
+static void set_rate(uint8_t r) {
+    rate = r;
+    rate_hist[0] = rate_hist[1];
+    rate_hist[1] = rate_hist[2];
+    rate_hist[2] = r;
+
+    if((model >= PS2DEV_WHEEL) && (id == PS2DEV_STANDARD) &&
+        (rate_hist[0] == 200) && (rate_hist[1] == 100) && (rate_hist[2] == 80)) id = PS2DEV_WHEEL;
+    else if((model == PS2DEV_EXPLORER) && (id == PS2DEV_WHEEL) &&
+        (rate_hist[0] == 200) && (rate_hist[1] == 200) && (rate_hist[2] == 80)) id = PS2DEV_EXPLORER;
+}
+
+static void handle_byte(uint8_t b) {
+    if(b == RESEND) {
+        queue(last_tx);
+        return;
+    }
+
+    tx_head = tx_tail; // A command throws away whatever we were about to send
+
+    if(arg_cmd) {
+        uint8_t cmd = arg_cmd;
+
+        arg_cmd = 0;
+        if(cmd == 0xF3) {
+            if((b == 10) || (b == 20) || (b == 40) || (b == 60) || (b == 80) || (b == 100) || (b == 200)) {
+                set_rate(b);
+                queue(ACK);
+            } else queue(RESEND);
+        } else {
+            res = b & 0x03;
+            queue(ACK);
+        }
+        return;
+    }
+
+    switch(b) {
+    case 0xFF: // Reset
+        queue(ACK);
+        set_defaults();
+        id = PS2DEV_STANDARD;
+        hal_host_at(hal_host_now() + T_SELFTEST, selftest_done, (void *)++selftest_gen);
+        break;
+    case 0xF6: // Set defaults
+        queue(ACK);
+        set_defaults();
+        break;
+    case 0xF5: // Disable
+        queue(ACK);
+        set_enabled(0);
+        break;
+    case 0xF4: // Enable
+        queue(ACK);
+        set_enabled(1);
+        break;
+    case 0xF3: // Sample rate
+    case 0xE8: // Resolution
+        queue(ACK);
+        arg_cmd = b;
+        break;
+    case 0xF2: // Read ID
+        queue(ACK);
+        queue(id);
+        break;
+    case 0xF0: // Remote mode
+        queue(ACK);
+        remote = 1;
+        break;
+    case 0xEA: // Stream mode
+        queue(ACK);
+        remote = 0;
+        break;
+    case 0xEB: // Read data
+        queue(ACK);
+        queue_report();
+        break;
+    case 0xE9: // Status request
+        queue(ACK);
+        queue((remote << 6) | (enabled << 5) | (scaling21 << 4) |
+              ((btns & PS2DEV_BTN_LEFT) << 2) | ((btns & PS2DEV_BTN_MIDDLE) >> 1) | ((btns & PS2DEV_BTN_RIGHT) >> 1));
+        queue(res);
+        queue(rate);
+        break;
+    case 0xE6: // Scaling 1:1
+    case 0xE7: // Scaling 2:1
+        queue(ACK);
+        scaling21 = b & 0x01;
+        break;
+    case 0xEE: // Echo
+        queue(0xEE);
+        break;
+    case 0xEC: // Reset wrap mode
+        queue(ACK);
+        break;
+    default:
+        queue(RESEND);
+        break;
+    }
+}
+
+static void set_enabled(uint8_t on) {
+    if(on == enabled) return;
+
+    enabled = on;
+    acc_dx = acc_dy = acc_dz = 0;
+    if(stream_cb) stream_cb(on);
+}
+
+static void set_defaults(void) {
+    rate = 100;
+    res = 2;
+    scaling21 = 0;
+    remote = 0;
+    arg_cmd = 0;
+    set_enabled(0);
+}
+
+static void selftest_done(void *ctx) {
+    if((uintptr_t)ctx != selftest_gen) return; // Reset again in the meantime
+
+    queue(BAT_OK);
+    queue(id);
+}
+
+static void sample_tick(void *ctx) {
+    if((uintptr_t)ctx != sample_gen) return;
+
+    if(enabled && !remote && !passive) {
+        if(sample_cb) sample_cb();
+        if((acc_dx || acc_dy || ((id != PS2DEV_STANDARD) && acc_dz) || (btns != sent_btns)) &&
+            (queue_free() >= 4)) queue_report();
+    }
+
+    hal_host_at(hal_host_now() + (HAL_HOST_MS(1000) / rate), sample_tick, ctx);
+}
+
+void ps2dev_init(uint8_t m) {
+    model = m;
+    id = PS2DEV_STANDARD;
+    memset(&stats, 0, sizeof(stats));
+    memset(rate_hist, 0, sizeof(rate_hist));
+    acc_dx = acc_dy = acc_dz = 0;
+    btns = sent_btns = 0;
+    tx_head = tx_tail = 0;
+    enabled = 0;
+    set_defaults();
+
+    fw_clk = fw_dat = 1;
+    bus_reset();
+    hal_host_on_ps2(lines_changed);
+
+    hal_host_at(hal_host_now() + T_SELFTEST, selftest_done, (void *)++selftest_gen);
+    hal_host_at(hal_host_now() + HAL_HOST_MS(10), sample_tick, (void *)++sample_gen);
+}
+
+void ps2dev_move(int16_t dx, int16_t dy, int8_t dz) {
+    acc_dx += dx;
+    acc_dy += dy;
+    acc_dz += dz;
+}
+
+void ps2dev_buttons(uint8_t b) {
+    btns = b;
+}
+
+void ps2dev_send(const uint8_t *bytes, uint8_t len) {
+    while(len--) queue(*bytes++);
+}
+
+void ps2dev_send_fault(uint8_t b, uint8_t bit) {
+    uint8_t at = tx_head;
+
+    queue(b);
+    if(tx_head != at) tx_flip[at] = bit + 1; // Still in the queue, it goes out after a gap at least
+}
+
+void ps2dev_passive(uint8_t on) {
+    passive = on;
+}
+
+void ps2dev_mute(uint8_t on) {
+    mute = on;
+}
+
+void ps2dev_on_command(void (*fn)(uint8_t b)) {
+    command_cb = fn;
+}
+
+void ps2dev_on_sample(void (*fn)(void)) {
+    sample_cb = fn;
+}
+
+void ps2dev_on_stream(void (*fn)(uint8_t on)) {
+    stream_cb = fn;
+}
+
+void ps2dev_on_report(void (*fn)(const uint8_t *report, uint8_t len, hal_time_t end)) {
+    report_cb = fn;
+}
+
+void ps2dev_faults(const Ps2DevFaults *f) {
+    faults_on = (f != NULL);
+    if(!f) return;
+
+    faults = *f;
+    fault_seed = f->seed;
+}
+
+void ps2dev_on_fault(void (*fn)(uint8_t kind, uint8_t bit, hal_time_t when)) {
+    fault_cb = fn;
+}
+
+uint8_t ps2dev_rate(void) {
+    return rate;
+}
+
+uint8_t ps2dev_res(void) {
+    return res;
+}
+
+uint8_t ps2dev_id(void) {
+    return id;
+}
+
+const Ps2DevStats *ps2dev_stats(void) {
+    return &stats;
+}
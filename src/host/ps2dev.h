@@ -0,0 +1,111 @@
+#ifndef _PS2DEV_HEADER_
+#define _PS2DEV_HEADER_
+
+// Simulated PS/2 mouse, on the other end of the lines of the host HAL.
+//
+// It speaks the PS/2 protocol bit by bit with realistic timing, answers the mouse command set
+// (reset, rates, resolution, status, IDs and the wheel / 5 buttons unlock sequences, stream and
+// remote mode) and reports the movement it is given at its sample rate.
+
+#include <stdint.h>
+
+#include "hal.h"
+
+// Mouse models
+#define PS2DEV_STANDARD 0 // 3 buttons, ID 0
+#define PS2DEV_WHEEL 3 // Intellimouse, ID 3
+#define PS2DEV_EXPLORER 4 // Intellimouse Explorer, 5 buttons and wheel, ID 4
+
+// Buttons, as in the first byte of the report, plus the 4th and 5th
+#define PS2DEV_BTN_LEFT 0x01
+#define PS2DEV_BTN_RIGHT 0x02
+#define PS2DEV_BTN_MIDDLE 0x04
+#define PS2DEV_BTN_4 0x10
+#define PS2DEV_BTN_5 0x20
+
+typedef struct {
+    uint32_t bytes_sent; // Bytes that made it to the host
+    uint32_t bytes_aborted; // Transmissions cut short by the host inhibiting the clock
+    uint32_t reports; // Movement reports queued
+    uint32_t commands; // Bytes received from the host
+    uint32_t rx_errors; // Bytes from the host with a bad parity or stop bit
+    uint32_t faults; // Frames sent with a line fault, see ps2dev_faults()
+} Ps2DevStats;
+
+// Line faults
+#define PS2DEV_FAULT_FLIP 1 // One bit of the frame inverted
+#define PS2DEV_FAULT_DROP 2 // One clock pulse missing
+#define PS2DEV_FAULT_TRUNCATE 3 // The frame stops after a few bits, the next one follows as usual
+
+typedef struct {
+    double flip, drop, truncate; // Probability for every frame sent, at most one fault per frame
+    uint32_t seed; // Same seed, same faults on the same traffic
+} Ps2DevFaults;
+
+/**
+ * Connects the mouse to the lines. It completes its self test after a while and reports it.
+ * Call before hal_host_run().
+ * @param model One of the PS2DEV_* models
+ */
+void ps2dev_init(uint8_t model);
+
+/**
+ * Adds movement, reported with the next samples. What does not fit in a report is kept for the next one.
+ * @param dx Right is positive
+ * @param dy Up is positive, as in the PS/2 reports
+ * @param dz Wheel, down is positive
+ */
+void ps2dev_move(int16_t dx, int16_t dy, int8_t dz);
+
+// Sets the buttons held down, PS2DEV_BTN_*
+void ps2dev_buttons(uint8_t btns);
+
+// Queues raw bytes, sent as they are at the first chance (e.g. from a trace)
+void ps2dev_send(const uint8_t *bytes, uint8_t len);
+
+/**
+ * Queues a byte sent with one bit of its frame inverted, e.g. a parity error from a trace
+ * @param b Byte
+ * @param bit Frame bit to invert: 0 start, 1-8 data, 9 parity, 10 stop
+ */
+void ps2dev_send_fault(uint8_t b, uint8_t bit);
+
+// Stop reporting movement on our own, the lines are driven from a trace (see hal_host_ps2_drive())
+void ps2dev_passive(uint8_t passive);
+
+// Stop answering the host commands, the answers come from a trace (see ps2dev_send())
+void ps2dev_mute(uint8_t mute);
+
+// Called for every byte received from the host, answered or not
+void ps2dev_on_command(void (*fn)(uint8_t b));
+
+/**
+ * Registers a function called at every sample while the mouse is reporting in stream mode,
+ * right before the report is built: the place to add movement with ps2dev_move().
+ */
+void ps2dev_on_sample(void (*fn)(void));
+
+// Called when the host enables (on != 0) or disables reporting
+void ps2dev_on_stream(void (*fn)(uint8_t on));
+
+// Called when the last byte of a movement report is on the wire, with the whole report and the end of its stop bit
+void ps2dev_on_report(void (*fn)(const uint8_t *report, uint8_t len, hal_time_t end));
+
+/**
+ * Corrupts the frames the mouse sends, as a long cable or a KVM switch would. The mouse does not
+ * know: it goes on as if the frame went out fine, unless the host asks for it again.
+ * @param faults Fault rates, NULL for a clean line again
+ */
+void ps2dev_faults(const Ps2DevFaults *faults);
+
+// Called when a frame is about to go out with a fault, PS2DEV_FAULT_*, on the given bit (0 start, 10 stop)
+void ps2dev_on_fault(void (*fn)(uint8_t kind, uint8_t bit, hal_time_t when));
+
+// Current sample rate (reports per second), resolution code and ID
+uint8_t ps2dev_rate(void);
+uint8_t ps2dev_res(void);
+uint8_t ps2dev_id(void);
+
+const Ps2DevStats *ps2dev_stats(void);
+
+#endif /* _PS2DEV_HEADER_ */
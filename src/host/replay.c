@@ -0,0 +1,265 @@
+// Trace replay: runs the firmware on the host HAL against a PS/2 trace (see docs/traces.md) as fast
+// as the host can, and writes what the board sends on the serial line. Given a golden output from an
+// earlier run, it compares the two and fails if a byte differs, or if the timing moved more than allowed.
+//
+// The simulation only depends on the trace and the options, so two runs of the same firmware give
+// the same output byte for byte and cycle for cycle: any difference comes from the firmware.
+//
+// The serial output file is text:
+//     # pontag-serial 1
+//     <us> <hex>
+// one line per byte, timed at the end of its stop bit from power-on.
+//
+// Usage: pontag-replay [options] trace.txt
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal.h"
+#include "ps2dev.h"
+#include "perf.h"
+#include "tracefile.h"
+
+#define TICK HAL_HOST_MS(10)
+#define DRAIN_MS 1000 // After the end of the trace, for the packets still on their way
+
+int firmware_main(void);
+
+typedef struct {
+    uint64_t us;
+    uint8_t b;
+} SerByte;
+
+typedef struct {
+    SerByte *b;
+    size_t len, cap;
+} SerStream;
+
+// Options
+static uint8_t model = TRACEFILE_NO_MODEL;
+static double speed = 1.0;
+static uint32_t start_ms = 3000; // From when the mouse is enabled to the first event
+static double max_time = 600.0; // Seconds
+static uint32_t max_shift_us; // 0 no limit
+static const char *out_path, *golden_path;
+
+static TraceFile trace = { .model = TRACEFILE_NO_MODEL };
+static SerStream output;
+static uint8_t stream_seen;
+static hal_time_t done_at;
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [options] trace.txt\n"
+            "  -m, --model std|wheel|explorer  Mouse model, if the trace doesn't say (wheel)\n"
+            "  -s, --speed N       Replay N times faster than recorded (1)\n"
+            "  -S, --start MS      Start the trace MS milliseconds after the mouse is enabled (3000)\n"
+            "  -T, --time S        Give up after S simulated seconds (600)\n"
+            "  -o, --output FILE   Write the serial output to FILE\n"
+            "  -g, --golden FILE   Compare the serial output with FILE\n"
+            "      --max-shift US  Fail if a byte moved more than US microseconds from the golden output\n",
+            name);
+}
+
+static uint64_t to_us(hal_time_t t) {
+    return (t * 1000000ULL) / F_CPU;
+}
+
+static void stream_add(SerStream *s, uint64_t us, uint8_t b) {
+    if(s->len == s->cap) {
+        s->cap = s->cap ? (s->cap * 2) : 4096;
+        s->b = realloc(s->b, s->cap * sizeof(SerByte));
+        if(!s->b) abort();
+    }
+
+    s->b[s->len].us = us;
+    s->b[s->len].b = b;
+    s->len++;
+}
+
+static int stream_load(SerStream *s, const char *path) {
+    FILE *f = fopen(path, "r");
+    char line[128];
+    unsigned lineno = 0;
+
+    if(!f) {
+        perror(path);
+        return -1;
+    }
+
+    while(fgets(line, sizeof(line), f)) {
+        unsigned long long us;
+        unsigned b;
+
+        lineno++;
+        if((line[0] == '#') || (line[0] == '\n')) continue;
+        if((sscanf(line, "%llu %x", &us, &b) != 2) || (b > 0xFF)) {
+            fprintf(stderr, "%s:%u: bad line\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+        stream_add(s, us, b);
+    }
+
+    fclose(f);
+
+    return 0;
+}
+
+static void stream_write(const SerStream *s, FILE *f) {
+    fprintf(f, "# pontag-serial 1\n");
+    for(size_t idx = 0; idx < s->len; idx++) fprintf(f, "%llu %02X\n", (unsigned long long)s->b[idx].us, s->b[idx].b);
+}
+
+// Simulation
+
+static void stream_changed(uint8_t on) {
+    if(!on || stream_seen) return;
+
+    stream_seen = 1;
+    replay_start(&trace, hal_host_now() + HAL_HOST_MS(start_ms), speed, 0);
+}
+
+static void uart_tx(uint8_t b, hal_time_t end) {
+    stream_add(&output, to_us(end), b);
+}
+
+static void tick(void *ctx) {
+    hal_time_t now = hal_host_now();
+
+    if(replay_stats()->done && !done_at) done_at = now;
+    if((done_at && (now >= (done_at + HAL_HOST_MS(DRAIN_MS)))) || (now >= (hal_time_t)(max_time * F_CPU))) {
+        hal_host_stop(HAL_HOST_STOP);
+        return;
+    }
+
+    hal_host_at(now + TICK, tick, NULL);
+}
+
+// Comparison
+
+static int compare(const SerStream *got, const SerStream *want) {
+    size_t len = (got->len < want->len) ? got->len : want->len, idx;
+    int64_t shift_max = 0;
+    double shift_sum = 0;
+    int fail = 0;
+
+    for(idx = 0; idx < len; idx++) {
+        int64_t shift = (int64_t)got->b[idx].us - (int64_t)want->b[idx].us;
+
+        if(got->b[idx].b != want->b[idx].b) {
+            fprintf(stderr, "replay: byte %zu differs: %02X at %llu us, golden %02X at %llu us\n", idx,
+                    got->b[idx].b, (unsigned long long)got->b[idx].us, want->b[idx].b, (unsigned long long)want->b[idx].us);
+            fail = 1;
+            break;
+        }
+
+        if(shift < 0) shift = -shift;
+        if(shift > shift_max) shift_max = shift;
+        shift_sum += shift;
+    }
+
+    if(!fail && (got->len != want->len)) {
+        fprintf(stderr, "replay: %zu bytes, golden %zu\n", got->len, want->len);
+        fail = 1;
+    }
+
+    fprintf(stderr, "replay: %zu bytes match the golden output, timing shift mean %.1f us max %lld us\n",
+            idx, idx ? (shift_sum / idx) : 0.0, (long long)shift_max);
+
+    if(max_shift_us && (shift_max > max_shift_us)) {
+        fprintf(stderr, "replay: timing shift over %u us\n", max_shift_us);
+        fail = 1;
+    }
+
+    return fail;
+}
+
+int main(int argc, char **argv) {
+    static const struct option opts[] = {
+        { "model", required_argument, NULL, 'm' },
+        { "speed", required_argument, NULL, 's' },
+        { "start", required_argument, NULL, 'S' },
+        { "time", required_argument, NULL, 'T' },
+        { "output", required_argument, NULL, 'o' },
+        { "golden", required_argument, NULL, 'g' },
+        { "max-shift", required_argument, NULL, 1 },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    const ReplayStats *rs;
+    SerStream golden = { 0 };
+    int opt, reason, fail = 0;
+
+    while((opt = getopt_long(argc, argv, "m:s:S:T:o:g:h", opts, NULL)) != -1) {
+        switch(opt) {
+        case 'm':
+            if(!strcmp(optarg, "std")) model = PS2DEV_STANDARD;
+            else if(!strcmp(optarg, "wheel")) model = PS2DEV_WHEEL;
+            else if(!strcmp(optarg, "explorer")) model = PS2DEV_EXPLORER;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 's': speed = atof(optarg); break;
+        case 'S': start_ms = atoi(optarg); break;
+        case 'T': max_time = atof(optarg); break;
+        case 'o': out_path = optarg; break;
+        case 'g': golden_path = optarg; break;
+        case 1: max_shift_us = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    if((optind != (argc - 1)) || (speed <= 0)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if(tracefile_load(&trace, argv[optind])) return 1;
+    if(golden_path && stream_load(&golden, golden_path)) return 1;
+
+    // The trace says which mouse it was, then the option, then a wheel mouse
+    if(trace.model == TRACEFILE_NO_MODEL) trace.model = (model != TRACEFILE_NO_MODEL) ? model : PS2DEV_WHEEL;
+
+    hal_host_on_uart_tx(uart_tx);
+    ps2dev_init(trace.model);
+    ps2dev_on_stream(stream_changed);
+
+    hal_host_at(hal_host_now() + TICK, tick, NULL);
+    reason = hal_host_run(firmware_main);
+
+    rs = replay_stats();
+    fprintf(stderr, "replay: %s after %.3f s, %u of %u events\n",
+            (reason == HAL_HOST_WDT) ? "watchdog reset" : ((reason == HAL_HOST_IDLE) ? "asleep for good" : (rs->done ? "done" : "timed out")),
+            (double)hal_host_now() / F_CPU, rs->events, (unsigned)trace.len);
+    if(trace.syncs) {
+        fprintf(stderr, "replay: bytes to the mouse %u as traced, %u different, %u missing\n",
+                rs->syncs, rs->sync_diffs, rs->sync_misses);
+    }
+    if(rs->sleeps || perf_stats.sleeps) fprintf(stderr, "replay: sleeps %u in the trace, %u replayed\n", rs->sleeps, perf_stats.sleeps);
+    fprintf(stderr, "replay: firmware ps2 frames %u parity %u framing %u overflow %u | packets sent %u, serial %zu bytes\n",
+            perf_stats.ps2_frames, perf_stats.ps2_parity_err, perf_stats.ps2_frame_err, perf_stats.ps2_overflow,
+            perf_stats.ser_sent, output.len);
+
+    if(out_path) {
+        FILE *f = fopen(out_path, "w");
+
+        if(!f) {
+            perror(out_path);
+            return 1;
+        }
+        stream_write(&output, f);
+        fclose(f);
+    }
+
+    if(!rs->done || (reason == HAL_HOST_WDT)) fail = 1;
+    if(golden_path && compare(&output, &golden)) fail = 1;
+
+    return fail;
+}
@@ -0,0 +1,75 @@
+// Serial mouse decoder, see serdec.h
+
+#include <string.h>
+
+#include "serdec.h"
+#include "pconfig.h"
+
+static int8_t sign4(uint8_t v) {
+    return (v & 0x08) ? (int8_t)(v | 0xF0) : (int8_t)(v & 0x0F);
+}
+
+void serdec_init(SerDec *dec, uint8_t proto) {
+    memset(dec, 0, sizeof(SerDec));
+    dec->proto = proto;
+}
+
+void serdec_resync(SerDec *dec) {
+    dec->pos = 0;
+}
+
+uint8_t serdec_wheel(uint8_t proto) {
+    return (proto == CFG_PROTO_MSWHEEL) || (proto == CFG_PROTO_LOGIWHL);
+}
+
+uint8_t serdec_feed(SerDec *dec, uint8_t b) {
+    switch(dec->proto) {
+    case CFG_PROTO_MSWHEEL:
+    case CFG_PROTO_MS:
+    case CFG_PROTO_LOGI:
+    case CFG_PROTO_LOGIWHL: {
+        // Every byte has the msb set, only the first one of a packet has D6 set
+        uint8_t last = serdec_wheel(dec->proto) ? 4 : 3;
+
+        if(!(b & 0x80)) return 0; // Not part of a packet (e.g. a host command reply)
+        if(b & 0x40) dec->pos = 0;
+        else if(dec->pos == 0) return 0; // Not in sync yet
+        if(dec->pos < sizeof(dec->pkt)) dec->pkt[dec->pos++] = b;
+
+        if(dec->pos == 3) { // Y is negative upward
+            dec->x += (int8_t)(((dec->pkt[0] & 0x03) << 6) | (dec->pkt[1] & 0x3F));
+            dec->y -= (int8_t)(((dec->pkt[0] & 0x0C) << 4) | (dec->pkt[2] & 0x3F));
+        }
+        if((dec->pos == 4) && (last == 4)) dec->z += sign4(dec->pkt[3]);
+        if(dec->pos != last) return 0;
+        break;
+    }
+    case CFG_PROTO_MSYS:
+        if((dec->pos == 0) || (dec->pos == 5)) {
+            if((b & 0xF8) != 0x80) return 0; // Waiting for the sync byte
+            dec->pos = 0;
+        }
+        dec->pkt[dec->pos++] = b;
+        if(dec->pos != 5) return 0;
+
+        dec->x += (int8_t)dec->pkt[1] + (int8_t)dec->pkt[3];
+        dec->y += (int8_t)dec->pkt[2] + (int8_t)dec->pkt[4];
+        break;
+    case CFG_PROTO_MM: // Sign and magnitude, the sign bits are set for right and up
+        if(b & 0x80) dec->pos = 0;
+        else if(dec->pos == 0) return 0;
+        if(dec->pos < 3) dec->pkt[dec->pos++] = b;
+        if(dec->pos != 3) return 0;
+
+        dec->x += (dec->pkt[0] & 0x10) ? dec->pkt[1] : -dec->pkt[1];
+        dec->y += (dec->pkt[0] & 0x08) ? dec->pkt[2] : -dec->pkt[2];
+        dec->pos = 0;
+        break;
+    default:
+        return 0;
+    }
+
+    dec->packets++;
+
+    return 1;
+}
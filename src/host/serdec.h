@@ -0,0 +1,38 @@
+#ifndef _SERDEC_HEADER_
+#define _SERDEC_HEADER_
+
+// Serial mouse decoder for the host tools: turns the bytes the board sends back into movement,
+// for every protocol of the firmware.
+
+#include <stdint.h>
+
+typedef struct {
+    uint8_t proto; // One of the CFG_PROTO_* values
+    uint8_t pkt[6];
+    uint8_t pos; // Bytes of the current packet received so far, 0 waiting for the first one
+    int32_t x, y, z; // Movement decoded so far, in the PS/2 directions: right, up and wheel down are positive
+    uint32_t packets;
+} SerDec;
+
+/**
+ * Starts decoding a protocol, from a packet boundary
+ * @param dec Decoder
+ * @param proto One of the CFG_PROTO_* values
+ */
+void serdec_init(SerDec *dec, uint8_t proto);
+
+// Forget the packet being received, the next one starts over (e.g. after bytes that were not packets)
+void serdec_resync(SerDec *dec);
+
+/**
+ * Feeds a byte from the serial line
+ * @param dec Decoder
+ * @param b Byte
+ * @return 1 if it completed the movement of a packet, 0 otherwise
+ */
+uint8_t serdec_feed(SerDec *dec, uint8_t b);
+
+// 1 if the protocol reports the wheel
+uint8_t serdec_wheel(uint8_t proto);
+
+#endif /* _SERDEC_HEADER_ */
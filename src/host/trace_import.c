@@ -0,0 +1,162 @@
+// Turns a binary PS/2 capture, what the board sends in trace mode (see src/libs/trace/trace.h and
+// docs/host_commands.md), into a text trace the emulator and the replay tool can load (docs/traces.md).
+//
+// The capture times every byte from the mouse when its stop bit is in, the text trace when it starts:
+// they are moved back by one frame at the slowest clock the PS/2 side allows, and never before the
+// event they follow. Ticks only keep the time going and don't show up in the trace.
+//
+// The board ignores RTS while capturing, but a replay runs the firmware as it would serve the host:
+// the toggles would reset the serial side there and send the mouse commands it never got. They are
+// left out of the trace unless asked for.
+//
+// Usage: pontag-trace-import [-m std|wheel|explorer] [-r] [-o trace.txt] capture.bin
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal.h"
+#include "ps2dev.h"
+#include "tracefile.h"
+#include "trace.h"
+
+#define STAMP_US 8 // See millis_stamp()
+#define FRAME_US 880 // 11 bits at 12.5 kHz
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [options] capture.bin\n"
+            "  -m, --model std|wheel|explorer  Mouse that was traced\n"
+            "  -r, --rts           Replay the RTS toggles\n"
+            "  -o, --output FILE   Text trace (standard output)\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    static const struct option opts[] = {
+        { "model", required_argument, NULL, 'm' },
+        { "rts", no_argument, NULL, 'r' },
+        { "output", required_argument, NULL, 'o' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    TraceFile tf = { .model = TRACEFILE_NO_MODEL };
+    const char *out_path = NULL;
+    FILE *in, *out = stdout;
+    uint8_t rec[TRACE_REC_SIZE];
+    uint64_t now_us = 0, last_us = 0;
+    uint16_t last_stamp = 0;
+    uint8_t first = 1, rts = 0;
+    uint32_t records = 0, skipped = 0, lost = 0, toggles = 0;
+    int opt, c;
+
+    while((opt = getopt_long(argc, argv, "m:ro:h", opts, NULL)) != -1) {
+        switch(opt) {
+        case 'm':
+            if(!strcmp(optarg, "std")) tf.model = PS2DEV_STANDARD;
+            else if(!strcmp(optarg, "wheel")) tf.model = PS2DEV_WHEEL;
+            else if(!strcmp(optarg, "explorer")) tf.model = PS2DEV_EXPLORER;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'r': rts = 1; break;
+        case 'o': out_path = optarg; break;
+        default:
+            usage(argv[0]);
+            return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    if(optind != (argc - 1)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    in = fopen(argv[optind], "rb");
+    if(!in) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    while((c = fgetc(in)) != EOF) {
+        TraceEvent ev;
+        uint16_t stamp;
+        uint64_t at;
+
+        // Records start with the sync nibble, anything else is skipped until one does
+        if((c & TRACE_SYNC_MASK) != TRACE_SYNC) {
+            skipped++;
+            continue;
+        }
+        rec[0] = c;
+        if(fread(&rec[1], 1, TRACE_REC_SIZE - 1, in) != (TRACE_REC_SIZE - 1)) break;
+        records++;
+
+        // Stamps wrap around, but never between two records
+        stamp = rec[2] | (rec[3] << 8);
+        if(!first) now_us += (uint16_t)(stamp - last_stamp) * STAMP_US;
+        last_stamp = stamp;
+        first = 0;
+
+        if(rec[0] & TRACE_LOST) lost++;
+
+        memset(&ev, 0, sizeof(ev));
+        at = now_us;
+        switch(rec[0] & TRACE_TYPE_MASK) {
+        case TRACE_PS2_RX: ev.kind = 'b'; at = (at > FRAME_US) ? (at - FRAME_US) : 0; break;
+        case TRACE_PS2_PARITY: ev.kind = 'p'; at = (at > FRAME_US) ? (at - FRAME_US) : 0; break;
+        case TRACE_PS2_FRAME: ev.kind = 'f'; break;
+        case TRACE_PS2_TX: ev.kind = 'h'; break;
+        case TRACE_RTS:
+            if(!rts) {
+                toggles++;
+                continue;
+            }
+            ev.kind = 'r';
+            break;
+        case TRACE_SLEEP: ev.kind = 's'; break;
+        case TRACE_WAKE: ev.kind = 'w'; break;
+        default: continue; // Ticks
+        }
+        if(at < last_us) at = last_us;
+        last_us = at;
+
+        ev.at = HAL_HOST_US(at);
+        if((ev.kind == 'b') || (ev.kind == 'p') || (ev.kind == 'f') || (ev.kind == 'h')) ev.data[ev.len++] = rec[1];
+
+        // Bytes of the same report, back to back, go on one line
+        if((ev.kind == 'b') && tf.len && (tf.ev[tf.len - 1].kind == 'b') && (tf.ev[tf.len - 1].len < TRACEFILE_MAX_BYTES) &&
+           ((ev.at - tf.ev[tf.len - 1].at) <= HAL_HOST_US(FRAME_US * tf.ev[tf.len - 1].len + FRAME_US))) {
+            TraceEvent *prev = &tf.ev[tf.len - 1];
+
+            prev->data[prev->len++] = rec[1];
+            continue;
+        }
+
+        tracefile_add(&tf, &ev);
+    }
+    fclose(in);
+
+    if(out_path) {
+        out = fopen(out_path, "w");
+        if(!out) {
+            perror(out_path);
+            return 1;
+        }
+    }
+    tracefile_write(&tf, out);
+    if(out != stdout) fclose(out);
+
+    fprintf(stderr, "trace-import: %u records, %u events, %.3f s", records, (unsigned)tf.len, now_us / 1e6);
+    if(skipped) fprintf(stderr, ", %u bytes skipped", skipped);
+    if(lost) fprintf(stderr, ", records lost %u times", lost);
+    if(toggles) fprintf(stderr, ", %u RTS toggles left out", toggles);
+    fputc('\n', stderr);
+    tracefile_free(&tf);
+
+    return 0;
+}
@@ -0,0 +1,258 @@
+// PS/2 traces, see tracefile.h
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracefile.h"
+#include "ps2dev.h"
+
+#define SYNC_TIMEOUT HAL_HOST_MS(100) // Past the time in the trace, for the board to send a byte to the mouse
+#define SYNC_QUEUE_LEN 16 // Must be a power of 2
+#define LOOP_GAP HAL_HOST_MS(10)
+
+static const char *const model_names[] = { "std", NULL, NULL, "wheel", "explorer" };
+
+// Replay
+static const TraceFile *trace;
+static size_t pos;
+static hal_time_t base; // Where the start of the trace falls
+static double speed;
+static uint8_t loop, active, waiting;
+static uintptr_t wait_gen;
+static ReplayStats stats;
+
+// Bytes the board sent to the mouse, not matched with the trace yet
+static uint8_t sync_byte[SYNC_QUEUE_LEN];
+static hal_time_t sync_time[SYNC_QUEUE_LEN];
+static uint8_t sync_head, sync_tail;
+
+static void next(void);
+
+// Loading and saving
+
+int tracefile_load(TraceFile *tf, const char *path) {
+    FILE *f = fopen(path, "r");
+    char line[512];
+    unsigned lineno = 0;
+    hal_time_t last = 0;
+
+    memset(tf, 0, sizeof(TraceFile));
+    tf->model = TRACEFILE_NO_MODEL;
+
+    if(!f) {
+        perror(path);
+        return -1;
+    }
+
+    while(fgets(line, sizeof(line), f)) {
+        TraceEvent ev;
+        char *p = line, *end;
+        unsigned long long us;
+        uint8_t want; // Values expected: 0 none, 1 one, 2 two, 255 one or more
+
+        lineno++;
+        while((*p == ' ') || (*p == '\t')) p++;
+        if((*p == '#') || (*p == '\n') || (*p == '\r') || !*p) continue;
+
+        memset(&ev, 0, sizeof(ev));
+        ev.kind = *p++;
+
+        if(ev.kind == 'm') { // Model, no time
+            char name[16];
+            uint8_t idx;
+
+            if(sscanf(p, "%15s", name) != 1) goto bad;
+            for(idx = 0; idx < (sizeof(model_names) / sizeof(model_names[0])); idx++) {
+                if(model_names[idx] && !strcmp(name, model_names[idx])) break;
+            }
+            if(idx == (sizeof(model_names) / sizeof(model_names[0]))) goto bad;
+            tf->model = idx;
+            continue;
+        }
+
+        switch(ev.kind) {
+        case 'b': want = 255; break;
+        case 'p': case 'f': case 'h': case 'u': want = 1; break;
+        case 'l': want = 2; break;
+        case 'r': case 's': case 'w': want = 0; break;
+        default: goto bad;
+        }
+
+        us = strtoull(p, &end, 10);
+        if(end == p) goto bad;
+        ev.at = HAL_HOST_US(us);
+        if(ev.at < last) {
+            fprintf(stderr, "%s:%u: time goes backwards\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+        last = ev.at;
+        p = end;
+
+        while(ev.len < TRACEFILE_MAX_BYTES) {
+            unsigned long v = strtoul(p, &end, (ev.kind == 'l') ? 10 : 16);
+
+            if(end == p) break;
+            if(v > 0xFF) goto bad;
+            ev.data[ev.len++] = v;
+            p = end;
+        }
+        if((want == 255) ? !ev.len : (ev.len != want)) goto bad;
+
+        tracefile_add(tf, &ev);
+        continue;
+
+    bad:
+        fprintf(stderr, "%s:%u: bad event\n", path, lineno);
+        fclose(f);
+        return -1;
+    }
+
+    fclose(f);
+
+    return 0;
+}
+
+void tracefile_add(TraceFile *tf, const TraceEvent *ev) {
+    if(tf->len == tf->cap) {
+        tf->cap = tf->cap ? (tf->cap * 2) : 256;
+        tf->ev = realloc(tf->ev, tf->cap * sizeof(TraceEvent));
+        if(!tf->ev) abort();
+    }
+
+    tf->ev[tf->len++] = *ev;
+    if(ev->kind == 'h') tf->syncs = 1;
+}
+
+void tracefile_write(const TraceFile *tf, FILE *f) {
+    fprintf(f, "# pontag-trace 1\n");
+    if((tf->model < (sizeof(model_names) / sizeof(model_names[0]))) && model_names[tf->model]) fprintf(f, "m %s\n", model_names[tf->model]);
+
+    for(size_t idx = 0; idx < tf->len; idx++) {
+        const TraceEvent *ev = &tf->ev[idx];
+
+        fprintf(f, "%c %llu", ev->kind, (unsigned long long)((ev->at * 1000000ULL) / F_CPU));
+        for(uint8_t b = 0; b < ev->len; b++) fprintf(f, (ev->kind == 'l') ? " %u" : " %02X", ev->data[b]);
+        fputc('\n', f);
+    }
+}
+
+void tracefile_free(TraceFile *tf) {
+    free(tf->ev);
+    memset(tf, 0, sizeof(TraceFile));
+    tf->model = TRACEFILE_NO_MODEL;
+}
+
+// Replay
+
+static hal_time_t scaled(hal_time_t at) {
+    return (hal_time_t)(at / speed);
+}
+
+// The board sent the byte of the 'h' event we're at: what follows is timed from there
+static void sync_take(void) {
+    const TraceEvent *ev = &trace->ev[pos];
+
+    if(sync_byte[sync_tail] == ev->data[0]) stats.syncs++;
+    else stats.sync_diffs++;
+
+    base = sync_time[sync_tail] - scaled(ev->at);
+    sync_tail = (sync_tail + 1) & (SYNC_QUEUE_LEN - 1);
+}
+
+static void sync_timeout(void *ctx) {
+    if(!waiting || ((uintptr_t)ctx != wait_gen)) return;
+
+    waiting = 0;
+    stats.sync_misses++;
+    base = hal_host_now() - scaled(trace->ev[pos].at);
+    pos++;
+    next();
+}
+
+static void command_received(uint8_t b) {
+    uint8_t next_head = (sync_head + 1) & (SYNC_QUEUE_LEN - 1);
+
+    if(!active) return;
+
+    if(next_head == sync_tail) sync_tail = (sync_tail + 1) & (SYNC_QUEUE_LEN - 1); // Way out of step, forget the oldest
+    sync_byte[sync_head] = b;
+    sync_time[sync_head] = hal_host_now();
+    sync_head = next_head;
+
+    if(waiting) {
+        waiting = 0;
+        sync_take();
+        stats.events++;
+        pos++;
+        next();
+    }
+}
+
+static void step(void *ctx) {
+    const TraceEvent *ev = &trace->ev[pos];
+
+    switch(ev->kind) {
+    case 'b': ps2dev_send(ev->data, ev->len); break;
+    case 'p': ps2dev_send_fault(ev->data[0], 9); break;
+    case 'f': ps2dev_send_fault(ev->data[0], 10); break;
+    case 'l':
+        hal_host_ps2_drive(HAL_PS2_CLK, !ev->data[0]);
+        hal_host_ps2_drive(HAL_PS2_DAT, !ev->data[1]);
+        break;
+    case 'h':
+        if(sync_head == sync_tail) { // Not yet
+            waiting = 1;
+            hal_host_at(hal_host_now() + SYNC_TIMEOUT, sync_timeout, (void *)++wait_gen);
+            return;
+        }
+        sync_take();
+        break;
+    case 'u': hal_host_uart_rx(ev->data[0]); break;
+    case 'r': hal_host_rts(); break;
+    case 's': stats.sleeps++; break;
+    case 'w': stats.wakes++; break;
+    }
+
+    stats.events++;
+    pos++;
+    next();
+}
+
+static void next(void) {
+    if(pos == trace->len) {
+        if(!loop) {
+            active = 0;
+            stats.done = 1;
+            return;
+        }
+
+        pos = 0;
+        base = hal_host_now() + LOOP_GAP;
+    }
+
+    hal_host_at(base + scaled(trace->ev[pos].at), step, NULL);
+}
+
+void replay_start(const TraceFile *tf, hal_time_t start, double spd, uint8_t lp) {
+    trace = tf;
+    speed = (spd > 0) ? spd : 1.0;
+    loop = lp;
+    base = start;
+    pos = 0;
+    waiting = 0;
+    sync_head = sync_tail = 0;
+    memset(&stats, 0, sizeof(stats));
+
+    ps2dev_passive(1);
+    ps2dev_mute(tf->syncs);
+    ps2dev_on_command(command_received);
+
+    active = tf->len != 0;
+    if(active) next();
+    else stats.done = 1;
+}
+
+const ReplayStats *replay_stats(void) {
+    return &stats;
+}
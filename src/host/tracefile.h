@@ -0,0 +1,72 @@
+#ifndef _TRACEFILE_HEADER_
+#define _TRACEFILE_HEADER_
+
+// PS/2 traces for the host tools: loading, saving, and replaying them against the firmware through the
+// simulated mouse. See docs/traces.md for the format.
+//
+// The replay only uses the simulation side of the host HAL and the simulated mouse, so other simulators
+// can host it by providing hal_host_at(), hal_host_now(), hal_host_ps2_drive(), hal_host_rts() and
+// hal_host_uart_rx().
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hal.h"
+
+#define TRACEFILE_MAX_BYTES 16
+#define TRACEFILE_NO_MODEL 0xFF
+
+typedef struct {
+    hal_time_t at; // From the start of the trace
+    char kind; // See docs/traces.md
+    uint8_t len;
+    uint8_t data[TRACEFILE_MAX_BYTES];
+} TraceEvent;
+
+typedef struct {
+    TraceEvent *ev;
+    size_t len, cap;
+    uint8_t model; // PS2DEV_* model of the mouse that was traced, TRACEFILE_NO_MODEL if not given
+    uint8_t syncs; // 1 if the trace has bytes sent to the mouse ('h'): then it holds the answers too
+} TraceFile;
+
+typedef struct {
+    uint32_t events; // Events replayed
+    uint32_t syncs; // Bytes the board sent to the mouse, as in the trace
+    uint32_t sync_diffs; // Bytes the board sent to the mouse, different from the trace
+    uint32_t sync_misses; // Bytes in the trace the board never sent
+    uint32_t sleeps, wakes; // Sleep and wake up events in the trace, not replayed
+    uint8_t done;
+} ReplayStats;
+
+/**
+ * Loads a trace, printing what's wrong with it
+ * @param tf Trace, filled in
+ * @param path Text trace file
+ * @return 0 if the trace was loaded, -1 otherwise
+ */
+int tracefile_load(TraceFile *tf, const char *path);
+
+// Appends an event, times must not go backwards
+void tracefile_add(TraceFile *tf, const TraceEvent *ev);
+
+// Writes a trace in the text format
+void tracefile_write(const TraceFile *tf, FILE *f);
+
+void tracefile_free(TraceFile *tf);
+
+/**
+ * Replays a trace through the simulated mouse, which must be initialized already. From then on the
+ * mouse does not report on its own, and if the trace has the bytes sent to the mouse it does not
+ * answer the commands either: the trace does, and every byte sent to the mouse in the trace waits
+ * for the board to send it, so what follows stays in step with the firmware.
+ * @param tf Trace, kept until the end of the replay
+ * @param start When the first event of the trace happens
+ * @param speed 1 at the recorded timing, N to replay N times faster
+ * @param loop Replay the trace over and over
+ */
+void replay_start(const TraceFile *tf, hal_time_t start, double speed, uint8_t loop);
+
+const ReplayStats *replay_stats(void);
+
+#endif /* _TRACEFILE_HEADER_ */
@@ -7,4 +7,8 @@
 #define token_paste3_int(x, y, z) x ## y ## z
 #define token_paste3(x, y, z) token_paste3_int(x, y, z)
 
+// stringification, e.g. to put the value of a macro in an asm string
+#define stringify_int(x) #x
+#define stringify(x) stringify_int(x)
+
 #endif /* _AVR_EXPERIMENTS_DEFINES_ */
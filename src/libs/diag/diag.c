@@ -0,0 +1,89 @@
+#include "diag.h"
+
+#if ENABLE_DIAG_UART
+
+#include "hal.h"
+
+// Ring size, must be a power of 2
+#ifndef DIAG_TX_BUFFER_SIZE
+#define DIAG_TX_BUFFER_SIZE 32
+#endif
+
+#if (DIAG_TX_BUFFER_SIZE & (DIAG_TX_BUFFER_SIZE - 1))
+#error "DIAG_TX_BUFFER_SIZE must be a power of 2"
+#endif
+
+// Timer2 counts at F_CPU / 8, one compare match every bit
+#define DIAG_TICKS (((F_CPU / 8) + (DIAG_BAUD / 2)) / DIAG_BAUD)
+
+#if (DIAG_TICKS < 2) || (DIAG_TICKS > 256)
+#error "DIAG_BAUD out of range for this F_CPU"
+#endif
+#if ((DIAG_TICKS * DIAG_BAUD * 50) < (F_CPU / 8 * 49)) || ((DIAG_TICKS * DIAG_BAUD * 50) > (F_CPU / 8 * 51))
+#error "DIAG_BAUD is more than 2% off with this F_CPU"
+#endif
+
+#define DIAG_FRAME_BITS 10 // Start, 8 data bits, stop
+
+static volatile uint8_t tx_head; // Written by the main loop
+static volatile uint8_t tx_tail; // Written by the ISR
+static volatile uint8_t tx_buf[DIAG_TX_BUFFER_SIZE];
+static volatile uint8_t running; // The timer is on
+
+static uint16_t frame; // Bits still to go out, lsb first
+static uint8_t bits_left;
+
+void diag_init(void) {
+    tx_head = tx_tail = 0;
+    running = 0;
+
+    hal_diag_init(); // Idle high
+}
+
+// Take the next byte from the ring. There must be one.
+static void diag_load(void) {
+    frame = ((uint16_t)tx_buf[tx_tail] << 1) | (1 << (DIAG_FRAME_BITS - 1)); // Start bit low, stop bit high
+    bits_left = DIAG_FRAME_BITS;
+    tx_tail = (tx_tail + 1) & (DIAG_TX_BUFFER_SIZE - 1);
+}
+
+void diag_putbyte(uint8_t b) {
+    uint8_t next_head = (tx_head + 1) & (DIAG_TX_BUFFER_SIZE - 1);
+
+    while(next_head == tx_tail) hal_spin(); // Ring full, wait for the ISR to take a byte
+
+    tx_buf[tx_head] = b;
+    tx_head = next_head;
+
+    HAL_ATOMIC {
+        if(!running) { // The start bit goes out one bit from now
+            running = 1;
+            diag_load();
+            hal_diag_timer_start(DIAG_TICKS - 1);
+        }
+    }
+}
+
+uint8_t diag_tx_free(void) {
+    return (tx_tail - tx_head - 1) & (DIAG_TX_BUFFER_SIZE - 1);
+}
+
+uint8_t diag_tx_empty(void) {
+    return !running;
+}
+
+HAL_ISR(HAL_VECT_DIAG_TIMER) {
+    hal_diag_set(frame & 1); // First thing, so every edge comes at the same delay from the compare match
+    frame >>= 1;
+    if(--bits_left) return;
+
+    // The stop bit is going out, the next start bit comes one bit from now
+    if(tx_head != tx_tail) {
+        diag_load();
+    } else {
+        hal_diag_timer_stop();
+        running = 0;
+    }
+}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef _DIAG_HEADER_
+#define _DIAG_HEADER_
+
+// Diagnostic output: a transmit-only software UART on a spare pin of the option header (see
+// ioconfig.h), 8N1 at DIAG_BAUD. It carries the performance counters, the debug log or a PS/2
+// trace while the hardware UART keeps serving the host.
+//
+// Bytes are queued in a RAM ring; Timer2 interrupts once per bit and the handler moves the pin, so
+// sending never waits on the main loop. The timer only runs while there is something to send.
+
+#include <stdint.h>
+
+// Built into the firmware, the Makefiles set it to 0 to leave it out
+#ifndef ENABLE_DIAG_UART
+#define ENABLE_DIAG_UART 1
+#endif
+
+// The bit time has to stay well above the longest handler that keeps the Timer2 one waiting
+#ifndef DIAG_BAUD
+#define DIAG_BAUD 38400
+#endif
+
+// What the diagnostic output carries, see HOSTPARAM_DIAG
+#define DIAG_OUT_NONE 0
+#define DIAG_OUT_STATS 1 // The performance counters every DIAG_STATS_MS, as the reply to the counters command
+#define DIAG_OUT_LOG 2 // The debug log (see dlog.h)
+#define DIAG_OUT_TRACE 4 // A PS/2 trace capture (see trace.h), on its own
+
+#define DIAG_STATS_MS 1000
+
+void diag_init(void);
+
+/**
+ * Queue a byte. Waits only if the ring is full.
+ * @param b Byte to send
+ */
+void diag_putbyte(uint8_t b);
+// Number of bytes that can be queued without waiting
+uint8_t diag_tx_free(void);
+// Check if everything queued has been sent, the stop bit of the last byte might still be going out
+uint8_t diag_tx_empty(void);
+
+#endif /* _DIAG_HEADER_ */
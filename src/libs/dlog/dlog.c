@@ -0,0 +1,58 @@
+#include "dlog.h"
+
+#if ENABLE_DLOG
+
+#include <stddef.h>
+
+#include "millis.h"
+
+// Events the ring holds, must be a power of 2
+#ifndef DLOG_BUFFER_LEN
+#define DLOG_BUFFER_LEN 8
+#endif
+
+#if (DLOG_BUFFER_LEN & (DLOG_BUFFER_LEN - 1))
+#error "DLOG_BUFFER_LEN must be a power of 2"
+#endif
+
+static uint8_t buf[DLOG_BUFFER_LEN * DLOG_REC_SIZE];
+
+RecRing dlog_ring = RECRING_INIT(buf, DLOG_REC_SIZE, DLOG_BUFFER_LEN, DLOG_LOST);
+
+void dlog_start(uint8_t to) {
+    recring_start(&dlog_ring, to);
+}
+
+void dlog_stop(void) {
+    recring_stop(&dlog_ring);
+}
+
+void dlog_put(uint8_t ev, uint8_t a0, uint8_t a1, uint8_t a2, uint8_t a3, uint8_t a4) {
+    volatile uint8_t *rec = recring_alloc(&dlog_ring);
+    uint16_t stamp;
+
+    if(rec == NULL) return;
+
+    stamp = millis();
+    rec[0] = DLOG_SYNC | ev;
+    rec[1] = a0;
+    rec[2] = a1;
+    rec[3] = a2;
+    rec[4] = a3;
+    rec[5] = a4;
+    rec[6] = stamp & 0xFF;
+    rec[7] = stamp >> 8;
+    recring_commit(&dlog_ring);
+}
+
+void dlog_flush(uint32_t now) {
+    if(recring_idle(&dlog_ring, now, DLOG_TICK_MS)) dlog_put(DLOG_TICK, 0, 0, 0, 0, 0);
+
+    recring_flush(&dlog_ring, now);
+}
+
+void dlog_drain(void) {
+    recring_drain(&dlog_ring);
+}
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef _DLOG_HEADER_
+#define _DLOG_HEADER_
+
+// Debug log: in debug mode the firmware reports what it does as fixed-size binary events instead of
+// text, so no printf is needed and nothing in the data path waits for the serial port. Events are
+// queued in a RAM ring and moved to the UART by the main loop as room frees up in the transmit buffer
+// (see recring.h). out/host/pontag-dlog turns them back into text.
+//
+// Every event is DLOG_REC_SIZE bytes:
+//   0  DLOG_SYNC in the two high bits, DLOG_LOST if events were lost before this one, the event (DLOG_*) in the low bits
+//   1  Arguments, DLOG_ARGS bytes, see the events
+//   6  Time, millis() truncated to 16 bits, little-endian. It wraps around every 65 s,
+//      DLOG_TICK events keep the gaps between events shorter than that
+//
+// When the ring is full new events are dropped, and the next one that fits carries DLOG_LOST.
+
+#include <stdint.h>
+
+#include "recring.h"
+
+// Built into the firmware, the Makefiles set it to 0 to leave it out
+#ifndef ENABLE_DLOG
+#define ENABLE_DLOG 1
+#endif
+
+#define DLOG_REC_SIZE 8
+#define DLOG_ARGS 5
+
+#define DLOG_SYNC 0xC0
+#define DLOG_SYNC_MASK 0xC0
+#define DLOG_LOST 0x20
+#define DLOG_EVENT_MASK 0x1F
+
+// Events, with their arguments
+#define DLOG_BOOT 0 // Firmware version major, minor, patch, option header
+#define DLOG_CONFIG 1 // Stored protocol, resolution
+#define DLOG_MOUSE_INIT 2 // mouse_init() result, PS/2 report size
+#define DLOG_IDENT 3 // Protocol the board identifies as (CFG_PROTO_*), RTS toggles so far (16-bit), free stack (16-bit)
+#define DLOG_PS2_PKT 4 // PS/2 report, 4 bytes
+#define DLOG_SER_PKT 5 // Serial packet size, first 4 bytes
+#define DLOG_SER_TAIL 6 // Serial packet byte 5, when there is one
+#define DLOG_SCHED 7 // Scheduler reports merged (16-bit), times dropped (16-bit), times the button queue filled up (low byte)
+#define DLOG_SLEEP 8 // No arguments
+#define DLOG_WAKE 9 // No arguments
+#define DLOG_HOSTCMD 10 // Host command (HOSTCMD_*), argument, value
+#define DLOG_SCHED_TAIL 11 // Right after DLOG_SCHED: counts lost at the accumulator limit (16-bit), counts dropped (16-bit)
+#define DLOG_TICK 31 // Nothing happened for DLOG_TICK_MS
+
+#define DLOG_TICK_MS 30000
+
+// Where the log goes, dlog_on is 0 when it's not running
+#define DLOG_ON_UART RECRING_ON_UART
+#define DLOG_ON_DIAG RECRING_ON_DIAG // The diagnostic output, see diag.h
+
+#if ENABLE_DLOG
+extern RecRing dlog_ring;
+#define dlog_on (dlog_ring.on)
+#else
+#define dlog_on 0 // Left out, never running: what checks it goes away
+#endif
+
+// Queue an event if the log is running. Main loop only.
+#define DLOG(ev, a0, a1, a2, a3, a4) do { if(dlog_on) dlog_put((ev), (a0), (a1), (a2), (a3), (a4)); } while(0)
+
+#if ENABLE_DLOG
+/**
+ * Start logging, clearing what might be left
+ * @param to DLOG_ON_UART or DLOG_ON_DIAG
+ */
+void dlog_start(uint8_t to);
+// Stop logging, dropping the events not sent yet
+void dlog_stop(void);
+
+/**
+ * Queue an event, stamped now
+ * @param ev One of the events
+ * @param a0 First argument, unused ones are 0
+ */
+void dlog_put(uint8_t ev, uint8_t a0, uint8_t a1, uint8_t a2, uint8_t a3, uint8_t a4);
+
+/**
+ * Moves whole events to the output, as long as it has room for them. Never waits.
+ * Sends a DLOG_TICK when nothing was sent for DLOG_TICK_MS.
+ * @param now Current millis()
+ */
+void dlog_flush(uint32_t now);
+
+// Sends everything queued and waits for it to leave the output, e.g. before sleeping
+void dlog_drain(void);
+#else
+static inline void dlog_start(uint8_t to) { }
+static inline void dlog_stop(void) { }
+static inline void dlog_put(uint8_t ev, uint8_t a0, uint8_t a1, uint8_t a2, uint8_t a3, uint8_t a4) { }
+static inline void dlog_flush(uint32_t now) { }
+static inline void dlog_drain(void) { }
+#endif
+
+#endif /* _DLOG_HEADER_ */
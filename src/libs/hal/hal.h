@@ -0,0 +1,59 @@
+#ifndef _HAL_HEADER_
+#define _HAL_HEADER_
+
+// Hardware abstraction layer: GPIO, timers, UART, watchdog and interrupts.
+//
+// The firmware builds against the AVR backend, where everything is inlined into plain register
+// accesses. The host backend (src/host) simulates the same peripherals, so the PS/2 state machine,
+// the protocol conversion and the main loop can be compiled and run on a workstation.
+//
+// Both backends provide:
+//
+// Interrupts
+//   HAL_ISR(vect, ...)         Define an interrupt handler for one of the HAL_VECT_* vectors
+//   HAL_ATOMIC                 Run the following block with interrupts disabled, then restore them
+//   hal_irq_enable()           Enable interrupts
+//   hal_irq_enabled()          Check if interrupts are enabled
+//   hal_spin()                 Called in busy-wait loops, lets the host simulation move forward
+//
+// PS/2 lines (HAL_PS2_CLK, HAL_PS2_DAT) and the clock interrupt
+//   hal_ps2_get(line)          Read a line, not 0 if it's high
+//   hal_ps2_set(line, level)   Set the output level of a line
+//   hal_ps2_input(line, in)    Make a line an input (in != 0) or an output
+//   hal_ps2_int_init()         Make the clock interrupt trigger on the falling edge
+//   hal_ps2_int(enable)        Enable the interrupt on the falling edge of the clock, or disable it
+//   hal_ps2_timer_start(t, d)  Start the PS/2 timer: first overflow after t + 1 ticks of F_CPU / d (HAL_TIMER_DIV*),
+//                              then every 256 ticks
+//   hal_ps2_timer_stop()       Stop the PS/2 timer and its interrupt
+//
+// Millisecond timer, counting at F_CPU / 8
+//   hal_millis_init(top)       Start it, the interrupt comes every top + 1 ticks
+//   hal_millis_count()         Current count
+//   hal_millis_pending()       Check if the count wrapped around, but the interrupt did not run yet
+//
+// Diagnostic output, a pin of the option header paced by Timer2
+//   hal_diag_init()            Make the pin an output, high
+//   hal_diag_set(level)        Set the level of the pin
+//   hal_diag_timer_start(top)  Start Timer2 at F_CPU / 8, the interrupt comes every top + 1 ticks
+//   hal_diag_timer_stop()      Stop Timer2 and its interrupt
+//
+// UART
+//   hal_uart_setbaud(ubrr, u2x), hal_uart_setformat(odd_parity), hal_uart_enable(), hal_uart_disable()
+//   hal_uart_put(b)            Write a byte into the data register, clearing the transmission complete flag
+//   hal_uart_get()             Read the data register
+//   hal_uart_tx_ready()        Check if the data register can take a byte
+//   hal_uart_tx_done()         Check if the transmission is complete
+//   hal_uart_tx_int(enable)    Enable the data register empty interrupt, or disable it
+//
+// Board
+//   hal_led(on), hal_opt_read(), hal_rts_init(), hal_delay_ms(ms)
+//   hal_wdt_start(), hal_wdt_kick(), hal_wdt_stop(), hal_wdt_expire()
+//   hal_sleep_powerdown()      Sleep until the PS/2 clock goes low
+
+#if defined (__AVR__)
+#include "hal_avr.h"
+#else
+#include "hal_host.h"
+#endif
+
+#endif /* _HAL_HEADER_ */
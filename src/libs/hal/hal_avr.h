@@ -0,0 +1,364 @@
+#ifndef _HAL_AVR_HEADER_
+#define _HAL_AVR_HEADER_
+
+// AVR backend of the hardware abstraction layer, see hal.h
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#include <avr/sleep.h>
+#include <util/delay.h>
+#include <util/atomic.h>
+
+#include "common/defines.h"
+#include "ioconfig.h"
+
+// Interrupts
+
+#define HAL_ISR(vect, ...) ISR(vect, ##__VA_ARGS__)
+
+#define HAL_VECT_PS2_CLK INT0_vect
+#define HAL_VECT_PS2_TIMER TIMER0_OVF_vect
+#define HAL_VECT_MILLIS TIMER1_COMPA_vect
+#define HAL_VECT_RTS INT1_vect
+#define HAL_VECT_UART_RX UART_RX_vect
+#define HAL_VECT_UART_UDRE UART_UDRE_vect
+#if defined (__AVR_ATmega8A__)
+#define HAL_VECT_DIAG_TIMER TIMER2_COMP_vect
+#elif defined (__AVR_ATmega328P__)
+#define HAL_VECT_DIAG_TIMER TIMER2_COMPA_vect
+#endif
+
+#define HAL_ATOMIC ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+
+#define hal_irq_enable() sei()
+#define hal_irq_enabled() (SREG & _BV(SREG_I))
+#define hal_spin() do { } while(0)
+
+// PS/2 lines
+
+#define HAL_PS2_CLK PS2CLK
+#define HAL_PS2_DAT PS2DAT
+
+#define hal_ps2_get(line) (PS2PIN & _BV(line))
+#define hal_ps2_set(line, level) ((level) ? (PS2PORT |= _BV(line)) : (PS2PORT &= ~_BV(line)))
+#define hal_ps2_input(line, in) ((in) ? (PS2DDR &= ~_BV(line)) : (PS2DDR |= _BV(line)))
+
+static inline void hal_ps2_int(uint8_t enable) {
+    if(enable) {
+#if defined (__AVR_ATmega8A__)
+        GIFR |= _BV(INTF0);
+        GICR |= _BV(INT0);
+#elif defined (__AVR_ATmega328P__)
+        EIFR |= _BV(INTF0);
+        EIMSK |= _BV(INT0);
+#endif
+    } else {
+#if defined (__AVR_ATmega8A__)
+        GICR &= ~_BV(INT0);
+#elif defined (__AVR_ATmega328P__)
+        EIMSK &= ~_BV(INT0);
+#endif
+    }
+}
+
+// Interrupt on the falling edge of the clock
+static inline void hal_ps2_int_init(void) {
+#if defined (__AVR_ATmega8A__)
+    MCUCR |= _BV(ISC01);
+#elif defined (__AVR_ATmega328P__)
+    EICRA |= _BV(ISC01);
+#endif
+}
+
+// PS/2 timer (Timer0), the prescaler values are the clock select bits
+#define HAL_TIMER_DIV8 0x02
+#define HAL_TIMER_DIV256 0x04
+
+static inline void hal_ps2_timer_start(uint8_t ticks, uint8_t div) {
+    TCNT0 = 255 - ticks;
+#if defined (__AVR_ATmega8A__)
+    TIMSK |= _BV(TOIE0);
+    TCCR0 = div;
+#elif defined (__AVR_ATmega328P__)
+    TIMSK0 |= _BV(TOIE0);
+    TCCR0B = div;
+#endif
+}
+
+static inline void hal_ps2_timer_stop(void) {
+#if defined (__AVR_ATmega8A__)
+    TIMSK &= ~_BV(TOIE0);
+    TCCR0 = 0;
+#elif defined (__AVR_ATmega328P__)
+    TIMSK0 &= ~_BV(TOIE0);
+    TCCR0B = 0;
+#endif
+}
+
+// Millisecond timer (Timer1)
+
+static inline void hal_millis_init(uint16_t top) {
+    // Clear timer when the count matches top, and set clock divider by 8
+    TCCR1B |= (1 << WGM12) | (1 << CS11);
+
+    OCR1AH = top >> 8;
+    OCR1AL = top & 0xFF;
+
+    // Enable compare-match interrupt
+#if defined (__AVR_ATmega328P__)
+    TIMSK1 |= (1 << OCIE1A);
+#elif defined (__AVR_ATmega8A__)
+    TIMSK |= (1 << OCIE1A);
+#endif
+}
+
+#define hal_millis_count() TCNT1
+
+#if defined (__AVR_ATmega328P__)
+#define hal_millis_pending() (TIFR1 & _BV(OCF1A))
+#elif defined (__AVR_ATmega8A__)
+#define hal_millis_pending() (TIFR & _BV(OCF1A))
+#endif
+
+// Diagnostic output (Timer2 and a pin of the option header)
+
+static inline void hal_diag_init(void) {
+    DIAGPORT |= _BV(DIAGTX); // High before it becomes an output, it was pulled up
+    DIAGDDR |= _BV(DIAGTX);
+}
+
+#define hal_diag_set(level) ((level) ? (DIAGPORT |= _BV(DIAGTX)) : (DIAGPORT &= ~_BV(DIAGTX)))
+
+// Clear timer on compare match, clock divider by 8
+static inline void hal_diag_timer_start(uint8_t top) {
+    TCNT2 = 0;
+#if defined (__AVR_ATmega8A__)
+    OCR2 = top;
+    TIFR = _BV(OCF2);
+    TIMSK |= _BV(OCIE2);
+    TCCR2 = _BV(WGM21) | _BV(CS21);
+#elif defined (__AVR_ATmega328P__)
+    OCR2A = top;
+    TCCR2A = _BV(WGM21);
+    TIFR2 = _BV(OCF2A);
+    TIMSK2 |= _BV(OCIE2A);
+    TCCR2B = _BV(CS21);
+#endif
+}
+
+static inline void hal_diag_timer_stop(void) {
+#if defined (__AVR_ATmega8A__)
+    TCCR2 = 0;
+    TIMSK &= ~_BV(OCIE2);
+#elif defined (__AVR_ATmega328P__)
+    TCCR2B = 0;
+    TIMSK2 &= ~_BV(OCIE2A);
+#endif
+}
+
+// UART
+
+#if defined(__SECOND_UART__)
+#define UART_NUMBER 1
+#else
+#define UART_NUMBER 0
+#endif
+
+#if defined(__AVR_AT90Tiny2313__) | defined(__AVR_ATtiny2313__) | defined(__AVR_ATtiny4313__)
+#define UART_UBRRH UBRRH
+#define UART_UBRRL UBRRL
+
+#define UART_UCSRA UCSRA
+#define UART_UCSRC UCSRC
+#define UART_UCSRB UCSRB
+
+#define UART_RXEN RXEN
+#define UART_TXEN TXEN
+
+#define UART_UCSZ0 UCSZ0
+#define UART_UCSZ1 UCSZ1
+#define UART_UPM0 UPM0
+#define UART_UPM1 UPM1
+
+#define UART_RXCIE RXCIE
+#define UART_UDRIE UDRIE
+
+#define UART_RX_vect USART_RX_vect
+#define UART_UDRE_vect USART_UDRE_vect
+
+#define UART_UDR UDR
+
+#define UART_UDRE UDRE
+
+#define UART_RXC RXC
+#define UART_TXC TXC
+
+#define UART_U2X U2X
+
+#elif defined (__AVR_ATmega8A__)
+
+#define UART_UDR                UDR
+#define UART_UCSRA              token_paste2(UCSR, A)
+#define UART_UCSRB              token_paste2(UCSR, B)
+#define UART_UCSRC              token_paste2(UCSR, C)
+#define UART_UBRR               UBRR
+#define UART_UBRRL              token_paste2(UBRR, L)
+#define UART_UBRRH              token_paste2(UBRR, H)
+#define UART_U2X                U2X
+
+#define UART_UDRE               UDRE
+
+#define UART_RXC		RXC
+#define UART_TXC		TXC
+
+#define UART_RXEN		RXEN
+#define UART_TXEN		TXEN
+
+#define UART_UCSZ0              token_paste2(UCSZ, 0)
+#define UART_UCSZ1              token_paste2(UCSZ, 1)
+#define UART_UPM0               token_paste2(UPM, 0)
+#define UART_UPM1               token_paste2(UPM, 1)
+
+#define UART_RXCIE		RXCIE
+#define UART_UDRIE		UDRIE
+
+#define UART_RX_vect		USART_RXC_vect
+#define UART_UDRE_vect		USART_UDRE_vect
+
+#else // Not an ATTiny
+
+#define UART_UDR                token_paste2(UDR, UART_NUMBER)
+
+#undef UCSR
+#define UART_UCSRA              token_paste3(UCSR, UART_NUMBER, A)
+#define UART_UCSRB              token_paste3(UCSR, UART_NUMBER, B)
+#define UART_UCSRC              token_paste3(UCSR, UART_NUMBER, C)
+#define UART_UBRR               token_paste2(UBRR, UART_NUMBER)
+#define UART_UBRRL              token_paste3(UBRR, UART_NUMBER, L)
+#define UART_UBRRH              token_paste3(UBRR, UART_NUMBER, H)
+
+#define UART_U2X				token_paste2(U2X, UART_NUMBER)
+
+#undef UDRE
+#define UART_UDRE				token_paste2(UDRE, UART_NUMBER)
+
+#undef RXC
+#define UART_RXC				token_paste2(RXC, UART_NUMBER)
+
+#undef TXC
+#define UART_TXC				token_paste2(TXC, UART_NUMBER)
+
+#undef RXEN
+#undef TXEN
+#define UART_RXEN				token_paste2(RXEN, UART_NUMBER)
+#define UART_TXEN				token_paste2(TXEN, UART_NUMBER)
+
+#undef UCSZ
+#define UART_UCSZ0              token_paste3(UCSZ, UART_NUMBER, 0)
+#define UART_UCSZ1              token_paste3(UCSZ, UART_NUMBER, 1)
+
+#undef UPM
+#define UART_UPM0               token_paste3(UPM, UART_NUMBER, 0)
+#define UART_UPM1               token_paste3(UPM, UART_NUMBER, 1)
+
+#undef RXCIE
+#undef UDRIE
+#define UART_RXCIE				token_paste2(RXCIE, UART_NUMBER)
+#define UART_UDRIE				token_paste2(UDRIE, UART_NUMBER)
+
+#if defined(__SECOND_UART__)
+#define UART_RX_vect            USART1_RX_vect
+#define UART_UDRE_vect          USART1_UDRE_vect
+#else
+#define UART_RX_vect            USART_RX_vect
+#define UART_UDRE_vect          USART_UDRE_vect
+#endif
+
+#endif
+
+static inline void hal_uart_setbaud(uint16_t ubrr, uint8_t u2x) {
+    UART_UBRRH = ubrr >> 8;
+    UART_UBRRL = ubrr & 0xFF;
+
+    if(u2x) UART_UCSRA |= _BV(UART_U2X);
+    else UART_UCSRA &= ~_BV(UART_U2X);
+}
+
+static inline void hal_uart_setformat(uint8_t odd_parity) {
+    uint8_t ucsrc = _BV(UART_UCSZ1) | _BV(UART_UCSZ0); /* 8-bit data */
+
+    if(odd_parity) ucsrc |= _BV(UART_UPM1) | _BV(UART_UPM0); /* Odd parity */
+
+#if defined (__AVR_ATmega8A__)
+    // ATMega8A requires the msb to be set to 1, otherwise UBRRH is selected
+    UART_UCSRC = 0x80 | ucsrc;
+#else
+    UART_UCSRC = ucsrc;
+#endif
+}
+
+#define hal_uart_enable() (UART_UCSRB = _BV(UART_RXEN) | _BV(UART_TXEN) | _BV(UART_RXCIE)) /* Enable RX and TX, and the RX interrupt */
+#define hal_uart_disable() (UART_UCSRB = 0) /* Disable RX and TX */
+
+static inline void hal_uart_put(uint8_t b) {
+    UART_UCSRA = (UART_UCSRA & _BV(UART_U2X)) | _BV(UART_TXC); // Clear the transmission complete flag, leave the rest alone
+    UART_UDR = b;
+}
+
+#define hal_uart_get() UART_UDR
+#define hal_uart_tx_ready() bit_is_set(UART_UCSRA, UART_UDRE)
+#define hal_uart_tx_done() bit_is_set(UART_UCSRA, UART_TXC)
+#define hal_uart_tx_int(enable) ((enable) ? (UART_UCSRB |= _BV(UART_UDRIE)) : (UART_UCSRB &= ~_BV(UART_UDRIE)))
+
+// Board
+
+#define hal_led(on) ((on) ? (LEDPORT |= _BV(LED_P)) : (LEDPORT &= ~_BV(LED_P)))
+#define hal_opt_read() OPTPIN
+#define hal_delay_ms(ms) _delay_ms(ms)
+
+// Interrupt on RTS changes
+static inline void hal_rts_init(void) {
+#if defined (__AVR_ATmega328P__)
+    // Toggle at the rising edge
+    EICRA |= _BV(ISC10);
+    EICRA &= ~_BV(ISC11);
+    EIMSK |= _BV(INT1);
+#elif defined (__AVR_ATmega8A__)
+    MCUCR |= _BV(ISC10);
+    MCUCR &= ~_BV(ISC11);
+    GICR  |= _BV(INT1);
+#endif
+}
+
+#if defined (__AVR_ATmega328P__)
+#define hal_wdt_start() wdt_enable(WDTO_4S) // Reset in 4 seconds...
+#elif defined (__AVR_ATmega8A__)
+#define hal_wdt_start() wdt_enable(WDTO_2S) // Reset in 2 seconds...
+#endif
+#define hal_wdt_kick() wdt_reset()
+#define hal_wdt_stop() wdt_disable()
+#define hal_wdt_expire() do { wdt_enable(WDTO_15MS); while(1); } while(0) // This will reset the unit
+
+static inline void hal_sleep_powerdown(void) {
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    cli();
+
+    // Set INT0 to interrupt on low level (falling edge won't work)
+#if defined (__AVR_ATmega8A__)
+    MCUCR &= ~(_BV(ISC01) | _BV(ISC00));
+#elif defined (__AVR_ATmega328P__)
+    EICRA &= ~(_BV(ISC01) | _BV(ISC00));
+#endif
+
+    // Go to sleep now...
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+
+    // Restore interrupt on falling edge for INT0
+    hal_ps2_int_init();
+}
+
+#endif /* _HAL_AVR_HEADER_ */
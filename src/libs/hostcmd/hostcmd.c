@@ -0,0 +1,114 @@
+#include "hostcmd.h"
+
+#if ENABLE_HOSTCMD
+
+#include "pconfig.h"
+
+// Parser states
+enum _hc_state {
+    HC_IDLE = 0,    // Waiting for a command
+    HC_STAR,        // Got '*', waiting for the command letter
+    HC_SET_ID,      // Got '*=', waiting for the parameter id
+    HC_SET_VAL,     // Got '*=' and the id, waiting for the value
+    HC_GET_ID       // Got '*?', waiting for the parameter id
+};
+
+static uint8_t state = HC_IDLE;
+static uint8_t param_id;
+
+static uint8_t hostcmd_letter(uint8_t c, HostCmd *cmd);
+
+void hostcmd_reset(void) {
+    state = HC_IDLE;
+}
+
+// Commands that do not need the '*' prefix. Returns 1 if c was a command.
+static uint8_t hostcmd_letter(uint8_t c, HostCmd *cmd) {
+    cmd->cmd = HOSTCMD_SETRATE;
+
+    switch(c) {
+        // Report rates, mapped to the nearest PS/2 sample rate
+        case 'J': cmd->arg = 10; break;
+        case 'K': cmd->arg = 20; break;
+        case 'L': cmd->arg = 40; break; // 35
+        case 'R': cmd->arg = 60; break; // 50
+        case 'M': cmd->arg = 80; break; // 67
+        case 'Q': cmd->arg = 100; break;
+        case 'N': cmd->arg = 200; break; // 150
+        case 'O': cmd->arg = 200; break; // Continuous
+        // Report modes
+        case 'D': cmd->cmd = HOSTCMD_PROMPT; break;
+        case 'P': cmd->cmd = HOSTCMD_POLL; break;
+        // Format switches
+        case 'S': cmd->cmd = HOSTCMD_SETPROTO; cmd->arg = CFG_PROTO_MM; break;
+        case 'U': cmd->cmd = HOSTCMD_SETPROTO; cmd->arg = CFG_PROTO_MSYS; break;
+        default:
+            cmd->cmd = HOSTCMD_NONE;
+            return 0;
+    }
+
+    return 1;
+}
+
+uint8_t hostcmd_feed(uint8_t c, HostCmd *cmd) {
+    switch(state) {
+        // Private extension, these are binary so the whole byte is used
+        case HC_SET_ID:
+            param_id = c;
+            state = HC_SET_VAL;
+            return 0;
+        case HC_SET_VAL:
+            state = HC_IDLE;
+            cmd->cmd = HOSTCMD_SETPARAM;
+            cmd->arg = param_id;
+            cmd->val = c;
+            return 1;
+        case HC_GET_ID:
+            state = HC_IDLE;
+            cmd->cmd = HOSTCMD_GETPARAM;
+            cmd->arg = c;
+            return 1;
+        default:
+            break;
+    }
+
+    c &= 0x7F; // The host might be talking 7-bit
+
+    switch(state) {
+        case HC_STAR:
+            state = HC_IDLE;
+            
+            if((c >= 'n') && (c <= 'q')) { // Speed selection
+                cmd->cmd = HOSTCMD_SETBAUD;
+                cmd->arg = UART_BAUD_1200 + (c - 'n');
+                return 1;
+            } else if((c >= 'h') && (c <= 'k')) { // Resolution selection
+                cmd->cmd = HOSTCMD_SETRES;
+                cmd->arg = c - 'h';
+                return 1;
+            } else if(c == '=') {
+                state = HC_SET_ID;
+                return 0;
+            } else if(c == '?') {
+                state = HC_GET_ID;
+                return 0;
+            } else if(c == '#') {
+                cmd->cmd = HOSTCMD_STATS;
+                return 1;
+            }
+            
+            // Not a command we know, maybe it's the start of another one
+            if(c == '*') state = HC_STAR;
+            else return hostcmd_letter(c, cmd);
+            break;
+        case HC_IDLE:
+        default:
+            if(c == '*') state = HC_STAR;
+            else return hostcmd_letter(c, cmd);
+            break;
+    }
+
+    return 0;
+}
+
+#endif
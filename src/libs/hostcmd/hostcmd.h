@@ -0,0 +1,67 @@
+#ifndef _HOSTCMD_HEADER_
+#define _HOSTCMD_HEADER_
+
+#include <stdint.h>
+
+#include "uart_baud.h"
+
+// Built into the firmware, the Makefiles set it to 0 to leave it out: what comes from the host is then ignored
+#ifndef ENABLE_HOSTCMD
+#define ENABLE_HOSTCMD 1
+#endif
+
+#define HOSTCMD_NONE 0
+#define HOSTCMD_SETBAUD 1 // arg is the new uart_baud_t speed
+#define HOSTCMD_SETRATE 2 // arg is the new PS/2 sample rate, in reports per second. Also leaves prompt mode
+#define HOSTCMD_SETRES 3 // arg is the new PS/2 resolution (0 = 1, 1 = 2, 2 = 4, 3 = 8 counts/mm)
+#define HOSTCMD_PROMPT 4 // Enter prompt mode: reports are sent only when requested
+#define HOSTCMD_POLL 5 // Send a report, in prompt mode
+#define HOSTCMD_SETPROTO 6 // arg is the new serial protocol (CFG_PROTO_*)
+#define HOSTCMD_SETPARAM 7 // Private extension, arg is the parameter id (HOSTPARAM_*), val the new value
+#define HOSTCMD_GETPARAM 8 // Private extension, arg is the parameter id (HOSTPARAM_*)
+#define HOSTCMD_STATS 9 // Private extension, dump the performance counters
+
+// Parameters for the private set/get extension
+#define HOSTPARAM_PROTO 0 // Serial protocol (CFG_PROTO_*)
+#define HOSTPARAM_RES 1 // PS/2 resolution (0-3)
+#define HOSTPARAM_RATE 2 // PS/2 sample rate (reports per second)
+#define HOSTPARAM_BAUD 3 // Serial speed (uart_baud_t)
+#define HOSTPARAM_SCALE_X 4 // X sensitivity, Q4.4 fixed point (0x10 = 1x)
+#define HOSTPARAM_SCALE_Y 5 // Y sensitivity, Q4.4 fixed point (0x10 = 1x)
+#define HOSTPARAM_SAVE 6 // Writing 1 stores the current sensitivity, acceleration, wheel detents and output policy in the configuration
+#define HOSTPARAM_ACCEL 7 // Acceleration curve (MOTION_ACCEL_*)
+#define HOSTPARAM_DETENTS 8 // Wheel detents for every notch (1-8)
+#define HOSTPARAM_POLICY 9 // Output policy (SCHED_*)
+#define HOSTPARAM_MAX_LAG 10 // Lag limit of the bounded-lag output policy, in ms (10-255)
+#define HOSTPARAM_TRACE 11 // 1 starts the PS/2 trace capture at 250000 bps, 0 stops it (see trace.h)
+#define HOSTPARAM_DIAG 12 // What the diagnostic output carries (DIAG_OUT_*, see diag.h)
+
+// Replies to the private extension
+#define HOSTCMD_REPLY_OK '=' // Followed by the parameter id and its value
+#define HOSTCMD_REPLY_ERR '!' // Followed by the parameter id
+#define HOSTCMD_REPLY_STATS '#' // Followed by the size of the counter block and the block itself
+
+typedef struct {
+    uint8_t cmd; // One of HOSTCMD_*
+    uint8_t arg;
+    uint8_t val;
+} HostCmd;
+
+#if ENABLE_HOSTCMD
+/**
+ * Feeds one byte received from the host into the command parser.
+ * See docs/host_commands.md for the supported commands.
+ * @param c Byte received from the serial port
+ * @param cmd Pointer to a HostCmd struct that will contain the decoded command
+ * @return 1 if a complete command was decoded into cmd, 0 otherwise
+ */
+uint8_t hostcmd_feed(uint8_t c, HostCmd *cmd);
+
+// Drop any partially received command
+void hostcmd_reset(void);
+#else
+static inline uint8_t hostcmd_feed(uint8_t c, HostCmd *cmd) { return 0; }
+static inline void hostcmd_reset(void) { }
+#endif
+
+#endif /* _HOSTCMD_HEADER_ */
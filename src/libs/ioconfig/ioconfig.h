@@ -3,7 +3,9 @@
 
 // I/O port definitions
 
+#if defined (__AVR__)
 #include <avr/io.h>
+#endif
 
 #define PS2PORT PORTD           // PS2 port
 #define PS2PIN  PIND            // PS2 input
@@ -34,6 +36,11 @@
 #define OPTPIN   PINC
 #define OPTDDR   DDRC
 
+// PC5 carries the diagnostic output instead, when it's built in (see diag.h)
+#define DIAGPORT PORTC
+#define DIAGDDR  DDRC
+#define DIAGTX   5
+
 void io_init(void);
 
 #endif /* _IOCONFIG_H_ */
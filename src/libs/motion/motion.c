@@ -0,0 +1,137 @@
+#include <avr/pgmspace.h>
+
+#include "motion.h"
+
+// PS/2 movement limits, 9-bit two's complement
+#define PS2_DELTA_MIN -256
+#define PS2_DELTA_MAX 255
+
+// Wheel movement limits: what a serial wheel packet carries, and what we are willing to keep pending
+#define SER_WHEEL_MIN -8
+#define SER_WHEEL_MAX 7
+#define WHEEL_PENDING_MAX 256
+
+#if ENABLE_MOTION_SCALE
+#define ACCEL_GAIN_ONE 16 // Gains in the curves are Q4.4 fixed point
+#define ACCEL_CURVE_SIZE 16
+#define ACCEL_SPEED_SHIFT 2 // Every entry of a curve covers 4 counts of speed
+
+// Gain for every speed, the first entry is always 1x so slow and precise movements are left alone
+static const uint8_t accel_curves[MOTION_ACCEL_COUNT - 1][ACCEL_CURVE_SIZE] PROGMEM = {
+    { 16, 16, 18, 20, 22, 24, 26, 28, 30, 32, 32, 32, 32, 32, 32, 32 }, // Mild
+    { 16, 16, 20, 24, 28, 32, 36, 40, 44, 48, 48, 48, 48, 48, 48, 48 }, // Medium
+    { 16, 20, 24, 32, 40, 48, 56, 64, 64, 64, 64, 64, 64, 64, 64, 64 }  // Strong
+};
+
+static uint16_t scale[2] = { MOTION_SCALE_ONE, MOTION_SCALE_ONE }; // X, Y
+static int16_t frac[2] = { 0, 0 }; // Sub-count movement, in 1/256 of a count
+static uint8_t accel = MOTION_ACCEL_NONE;
+
+static int16_t motion_scale_axis(int16_t delta, uint16_t mult, uint8_t axis);
+static uint8_t motion_gain(int16_t dx, int16_t dy);
+#endif
+
+static uint8_t detents = 1;
+static int16_t wheel = 0; // Pending wheel movement, in detents
+
+#if ENABLE_MOTION_SCALE
+void motion_setscale(uint16_t scale_x, uint16_t scale_y) {
+    scale[0] = scale_x;
+    scale[1] = scale_y;
+
+    frac[0] = frac[1] = 0;
+}
+
+void motion_setaccel(uint8_t curve) {
+    accel = (curve < MOTION_ACCEL_COUNT) ? curve : MOTION_ACCEL_NONE;
+}
+
+// Acceleration gain for the movement in a report, Q4.4
+static uint8_t motion_gain(int16_t dx, int16_t dy) {
+    if(accel == MOTION_ACCEL_NONE) return ACCEL_GAIN_ONE;
+
+    uint16_t ax = (dx < 0) ? -dx : dx, ay = (dy < 0) ? -dy : dy;
+    uint16_t speed = (ax > ay) ? (ax + (ay >> 1)) : (ay + (ax >> 1)); // Close enough to the length of the movement, without a square root
+    uint8_t idx = speed >> ACCEL_SPEED_SHIFT;
+
+    if(idx >= ACCEL_CURVE_SIZE) idx = ACCEL_CURVE_SIZE - 1;
+
+    return pgm_read_byte(&accel_curves[accel - 1][idx]);
+}
+
+// Returns the scaled movement, carrying what's left of it in the fraction kept for the axis
+static int16_t motion_scale_axis(int16_t delta, uint16_t mult, uint8_t axis) {
+    int32_t scaled = ((int32_t)delta * mult) + frac[axis];
+    int32_t counts = (scaled < 0) ? -((-scaled) >> 8) : (scaled >> 8); // Round toward zero, so the fraction keeps the sign of the movement
+
+    frac[axis] = scaled - (counts << 8);
+
+    if(counts < PS2_DELTA_MIN) return PS2_DELTA_MIN;
+    else if(counts > PS2_DELTA_MAX) return PS2_DELTA_MAX;
+    else return counts;
+}
+
+void motion_scale(uint8_t *buf) {
+    int16_t delta[2];
+
+    if((scale[0] == MOTION_SCALE_ONE) && (scale[1] == MOTION_SCALE_ONE) && (accel == MOTION_ACCEL_NONE)) return; // Nothing to do
+
+    for(uint8_t axis = 0; axis < 2; axis++) {
+        uint8_t sign_bit = 0x10 << axis, ovf_bit = 0x40 << axis;
+
+        // An overflowing axis is taken at its limit
+        if(buf[0] & ovf_bit) delta[axis] = (buf[0] & sign_bit) ? PS2_DELTA_MIN : PS2_DELTA_MAX;
+        else delta[axis] = (buf[0] & sign_bit) ? ((int16_t)buf[axis + 1] - 256) : buf[axis + 1];
+    }
+
+    uint8_t gain = motion_gain(delta[0], delta[1]); // Same gain on both axes, or the direction would change
+
+    for(uint8_t axis = 0; axis < 2; axis++) {
+        uint8_t sign_bit = 0x10 << axis, ovf_bit = 0x40 << axis;
+        uint16_t mult = ((uint32_t)scale[axis] * gain) >> 4; // Fits, as scale is at most 16x and gain at most 16x
+        int16_t moved = motion_scale_axis(delta[axis], mult, axis);
+
+        buf[0] &= ~(sign_bit | ovf_bit);
+        if(moved < 0) buf[0] |= sign_bit;
+        if((moved == PS2_DELTA_MIN) || (moved == PS2_DELTA_MAX)) buf[0] |= ovf_bit; // Saturated
+        buf[axis + 1] = moved & 0xFF;
+    }
+}
+#endif
+
+void motion_setdetents(uint8_t count) {
+    detents = count;
+    wheel = 0;
+}
+
+void motion_wheel_clear(void) {
+    wheel = 0;
+}
+
+void motion_wheel_add(const uint8_t *buf, uint8_t five_btns) {
+    // Wheel movement is 4-bit on 5-button mouses (the upper bits are buttons), 8-bit on the others
+    int8_t notches = five_btns ? ((buf[3] & 0x08) ? (buf[3] | 0xF0) : (buf[3] & 0x0F)) : (int8_t)buf[3];
+
+    wheel += notches * detents;
+
+    // Do not keep scrolling for ages after a runaway spin
+    if(wheel < -WHEEL_PENDING_MAX) wheel = -WHEEL_PENDING_MAX;
+    else if(wheel > WHEEL_PENDING_MAX) wheel = WHEEL_PENDING_MAX;
+}
+
+void motion_wheel_take(uint8_t *buf, uint8_t five_btns) {
+    int8_t out;
+
+    if(wheel < SER_WHEEL_MIN) out = SER_WHEEL_MIN;
+    else if(wheel > SER_WHEEL_MAX) out = SER_WHEEL_MAX;
+    else out = wheel;
+
+    wheel -= out;
+
+    if(five_btns) buf[3] = (buf[3] & 0x30) | (out & 0x0F); // Leave the 4th and 5th buttons alone
+    else buf[3] = out;
+}
+
+uint8_t motion_wheel_pending(void) {
+    return wheel != 0;
+}
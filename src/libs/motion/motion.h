@@ -0,0 +1,83 @@
+#ifndef _MOTION_HEADER_
+#define _MOTION_HEADER_
+
+#include <stdint.h>
+
+// Sensitivity and acceleration, built into the firmware. The Makefiles set it to 0 to leave them out:
+// the movement is then sent as the mouse reports it.
+#ifndef ENABLE_MOTION_SCALE
+#define ENABLE_MOTION_SCALE 1
+#endif
+
+// Sensitivity multipliers are Q8.8 fixed point values: 0x0100 leaves the movement untouched
+#define MOTION_SCALE_ONE 0x0100
+#define MOTION_SCALE_MIN 0x0010 // 1/16x
+#define MOTION_SCALE_MAX 0x1000 // 16x
+
+// Acceleration curves, the gain grows with the speed of the movement in a single report
+#define MOTION_ACCEL_NONE 0
+#define MOTION_ACCEL_MILD 1 // Up to 2x
+#define MOTION_ACCEL_MEDIUM 2 // Up to 3x
+#define MOTION_ACCEL_STRONG 3 // Up to 4x
+#define MOTION_ACCEL_COUNT 4
+
+// Wheel detents sent for every notch of the PS/2 wheel
+#define MOTION_DETENTS_MIN 1
+#define MOTION_DETENTS_MAX 8
+
+#if ENABLE_MOTION_SCALE
+/**
+ * Sets the per-axis sensitivity multipliers, and drops the sub-count movement kept so far
+ * @param scale_x Q8.8 multiplier for the X axis, between MOTION_SCALE_MIN and MOTION_SCALE_MAX
+ * @param scale_y Q8.8 multiplier for the Y axis, between MOTION_SCALE_MIN and MOTION_SCALE_MAX
+ */
+void motion_setscale(uint16_t scale_x, uint16_t scale_y);
+
+/**
+ * Selects the acceleration curve
+ * @param curve One of the MOTION_ACCEL_* values
+ */
+void motion_setaccel(uint8_t curve);
+
+/**
+ * Scales the movement in a PS/2 mouse packet, in place, applying both the sensitivity and the acceleration.
+ * The fractions of a count that could not be reported are carried over to the next packet, so small movements are never lost.
+ * Call it on every report before the scheduler accumulates it: the reports come at the PS/2 sample rate, so their movement
+ * is a speed, while the movement in a serial packet also depends on how many reports the serial speed made it merge.
+ * @param buf Pointer to a 3-byte uint8_t buffer that contains the PS/2 mouse packet
+ */
+void motion_scale(uint8_t *buf);
+#else
+static inline void motion_setscale(uint16_t scale_x, uint16_t scale_y) { }
+static inline void motion_setaccel(uint8_t curve) { }
+static inline void motion_scale(uint8_t *buf) { }
+#endif
+
+/**
+ * Sets how many detents are reported for every notch of the wheel, and drops the wheel movement still pending
+ * @param detents Between MOTION_DETENTS_MIN and MOTION_DETENTS_MAX
+ */
+void motion_setdetents(uint8_t detents);
+
+// Drop the wheel movement still pending, e.g. when the protocol changes
+void motion_wheel_clear(void);
+
+/**
+ * Adds the wheel movement of a PS/2 mouse packet to the pending one
+ * @param buf Pointer to a 4-byte uint8_t buffer that contains the PS/2 mouse packet
+ * @param five_btns If not 0, the packet comes from an Intellimouse Explorer compatible mouse
+ */
+void motion_wheel_add(const uint8_t *buf, uint8_t five_btns);
+
+/**
+ * Moves as much of the pending wheel movement as a serial wheel packet can carry (-8 to 7) into a PS/2 mouse packet,
+ * replacing its own. What does not fit is kept for the next packets.
+ * @param buf Pointer to a 4-byte uint8_t buffer that contains the PS/2 mouse packet
+ * @param five_btns If not 0, the packet comes from an Intellimouse Explorer compatible mouse
+ */
+void motion_wheel_take(uint8_t *buf, uint8_t five_btns);
+
+// Check if there is wheel movement that still has to be sent
+uint8_t motion_wheel_pending(void);
+
+#endif /* _MOTION_HEADER_ */
@@ -2,20 +2,28 @@
 #include <util/crc16.h>
 
 #include "pconfig.h"
+#include "motion.h"
+#include "sched.h"
 
 #define EEPROM_ADDRESS_CFG 0x00
 
 #define CFG_RES_DEFAULT 2
-#define CFG_PROTO_DEFAULT 0
+#define CFG_PROTO_DEFAULT CFG_PROTO_MSWHEEL
+#define CFG_SCALE_DEFAULT MOTION_SCALE_ONE
+#define CFG_MAX_LAG_DEFAULT 100
 
 static uint16_t calculate_CRC(uint8_t* buf, uint16_t len);
+static uint8_t cfg_scale_valid(uint16_t scale);
 
 uint8_t read_perm_config(ConfigStruct *cfg) {
     uint16_t calc_crc = 0;
     eeprom_read_block(cfg, (uint8_t*)EEPROM_ADDRESS_CFG, sizeof(ConfigStruct));
 
     calc_crc = calculate_CRC(cfg->cfg_data.buf, sizeof(cfg->cfg_data.buf));
-    if(calc_crc != cfg->crc) { // Corrupted or invalid config
+    if((calc_crc != cfg->crc) || (cfg->cfg_data.c.proto >= CFG_PROTO_COUNT) ||
+       !cfg_scale_valid(cfg->cfg_data.c.scale_x) || !cfg_scale_valid(cfg->cfg_data.c.scale_y) ||
+       (cfg->cfg_data.c.detents < MOTION_DETENTS_MIN) || (cfg->cfg_data.c.detents > MOTION_DETENTS_MAX) ||
+       (cfg->cfg_data.c.policy >= SCHED_POLICY_COUNT) || (cfg->cfg_data.c.max_lag < SCHED_LAG_MIN)) { // Corrupted or invalid config
         reset_perm_config(cfg); // Reset it
         return 0;
     } else return 1;
@@ -29,16 +37,28 @@ void write_perm_config(ConfigStruct *cfg) {
 static uint16_t calculate_CRC(uint8_t* buf, uint16_t len) {
     uint16_t crc = 0;
 
-    for (uint16_t i = 0; i < buf[i]; i++) {
+    for (uint16_t i = 0; i < len; i++) {
         crc = _crc16_update(crc, buf[i]);
     }
 
     return crc;
 }
 
+static uint8_t cfg_scale_valid(uint16_t scale) {
+    return (scale >= MOTION_SCALE_MIN) && (scale <= MOTION_SCALE_MAX);
+}
+
 void reset_perm_config(ConfigStruct *cfg) {
+    for(uint8_t i = 0; i < sizeof(cfg->cfg_data.buf); i++) cfg->cfg_data.buf[i] = 0; // Unused bits are always 0
+
     cfg->cfg_data.c.proto = CFG_PROTO_DEFAULT;
     cfg->cfg_data.c.res = CFG_RES_DEFAULT;
+    cfg->cfg_data.c.scale_x = CFG_SCALE_DEFAULT;
+    cfg->cfg_data.c.scale_y = CFG_SCALE_DEFAULT;
+    cfg->cfg_data.c.accel = MOTION_ACCEL_NONE;
+    cfg->cfg_data.c.detents = MOTION_DETENTS_MIN;
+    cfg->cfg_data.c.policy = SCHED_LOSSLESS;
+    cfg->cfg_data.c.max_lag = CFG_MAX_LAG_DEFAULT;
 
     cfg->crc = calculate_CRC(cfg->cfg_data.buf, sizeof(cfg->cfg_data.buf));
 }
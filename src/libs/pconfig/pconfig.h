@@ -1,13 +1,30 @@
 #ifndef _PCONFIG_HEADER_
 #define _PCONFIG_HEADER_
 
+// Serial protocols that can be selected in the configuration
+#define CFG_PROTO_MSWHEEL 0 // Microsoft + Wheel
+#define CFG_PROTO_MS 1 // Simple Microsoft
+#define CFG_PROTO_MSYS 2 // Mouse Systems, 5 bytes
+#define CFG_PROTO_LOGI 3 // Logitech, 3 buttons
+#define CFG_PROTO_LOGIWHL 4 // Logitech + Wheel, 5 buttons
+#define CFG_PROTO_MM 5 // Logitech MM series
+#define CFG_PROTO_COUNT 6
+
+typedef struct {
+    uint8_t res : 3; // 0 = 1, 1 = 2, 2 = 4, 3 = 8 counts/mm, default 2
+    uint8_t proto : 3; // One of the CFG_PROTO_* values, default 0 (MS + Wheel)
+    uint8_t accel : 2; // Acceleration curve, one of the MOTION_ACCEL_* values, default 0 (none)
+    uint16_t scale_x; // X sensitivity, Q8.8 fixed point (see motion.h), default 0x0100 (1x)
+    uint16_t scale_y; // Y sensitivity, Q8.8 fixed point (see motion.h), default 0x0100 (1x)
+    uint8_t detents; // Wheel detents reported for every notch, 1-8, default 1
+    uint8_t policy; // Output policy, one of the SCHED_* values (see sched.h), default 0 (lossless)
+    uint8_t max_lag; // Lag limit of the bounded-lag policy, 10-255 ms, default 100
+} ConfigData;
+
 typedef struct {
     union {
-        struct {
-            uint8_t res : 3; // 0 = 1, 1 = 2, 2 = 4, 3 = 8 counts/mm, default 2
-            uint8_t proto : 1; // 0 -> MS + Wheel, 1 -> MS protocol, default 0
-        } c;
-        uint8_t buf[4];
+        ConfigData c;
+        uint8_t buf[sizeof(ConfigData)]; // Covers every field, the CRC and the reset go through it
     } cfg_data;
     uint16_t crc; // CRC will be used to check for valid data from EPROM, and will be updated automatically before writing
 } ConfigStruct;
@@ -0,0 +1,70 @@
+#include "perf.h"
+
+#include "hal.h"
+#include "common/defines.h"
+
+#define STACK_CANARY 0xC5
+
+// The stack measure is built even without the counters, the debug log reports it too
+#if defined (__AVR__)
+extern uint8_t _end; // End of the variables, from the linker
+extern uint8_t __stack; // Top of the stack, from the linker
+
+void perf_paint_stack(void) __attribute__((naked, used, section(".init1")));
+
+// Runs before the stack pointer and __zero_reg__ are set up, so it can't be C. Plain asm only, with
+// the symbols and the canary written out: a naked function can't take operands.
+void perf_paint_stack(void) {
+    __asm volatile(
+        "    ldi r30, lo8(_end)\n"
+        "    ldi r31, hi8(_end)\n"
+        "    ldi r24, " stringify(STACK_CANARY) "\n"
+        "    ldi r25, hi8(__stack)\n"
+        "    rjmp 2f\n"
+        "1:  st Z+, r24\n"
+        "2:  cpi r30, lo8(__stack)\n"
+        "    cpc r31, r25\n"
+        "    brlo 1b\n"
+        "    breq 1b\n");
+}
+
+uint16_t perf_stack_free(void) {
+    const uint8_t *p = &_end;
+    uint16_t count = 0;
+
+    while((p <= &__stack) && (*p == STACK_CANARY)) {
+        p++;
+        count++;
+    }
+
+    return count;
+}
+#else
+uint16_t perf_stack_free(void) {
+    return 0; // The host stack is not ours to measure
+}
+#endif
+
+#if ENABLE_PERF
+
+volatile PerfStats perf_stats;
+
+void perf_get(PerfStats *dst) {
+    const volatile uint8_t *src = (const volatile uint8_t *)&perf_stats;
+    uint8_t *out = (uint8_t *)dst;
+
+    // The ISRs must not change a counter while half of it has been copied
+    HAL_ATOMIC {
+        for(uint8_t idx = 0; idx < sizeof(PerfStats); idx++) out[idx] = src[idx];
+    }
+}
+
+uint8_t perf_bucket(uint16_t value) {
+    uint8_t bucket = 0;
+
+    while(value >>= 1) bucket++;
+
+    return bucket;
+}
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef _PERF_HEADER_
+#define _PERF_HEADER_
+
+#include <stdint.h>
+
+// Built into the firmware, the Makefiles set it to 0 to leave the counters out
+#ifndef ENABLE_PERF
+#define ENABLE_PERF 1
+#endif
+
+// Log2 histogram buckets: bucket n counts the values from 2^n to 2^(n+1)-1, bucket 0 also counts 0
+#define PERF_HIST_BUCKETS 16
+
+// Link health counters. The 16-bit ones stop at their maximum, the high-water marks are in bytes.
+// Every field has a single writer (one ISR or the main loop), so no locking is needed to update them.
+typedef struct {
+    uint16_t ps2_frames; // PS/2 bytes received correctly
+    uint16_t ps2_parity_err; // PS/2 bytes with a wrong parity bit
+    uint16_t ps2_frame_err; // PS/2 bytes with a bad start or stop bit
+    uint16_t ps2_recover; // PS/2 error recoveries completed
+    uint16_t ps2_overflow; // PS/2 bytes lost because the receive buffer was full
+    uint16_t resyncs; // PS/2 bytes skipped looking for the first byte of a report
+    uint16_t host_overflow; // Bytes from the host lost because the receive buffer was full
+    uint16_t ser_sent; // Serial packets sent
+    uint16_t ser_merged; // Reports merged by the output policy, filled in by the main loop
+    uint16_t ser_dropped; // Times movement was dropped by the output policy, filled in by the main loop
+    uint16_t rts; // RTS toggles
+    uint16_t sleeps; // Sleep and wake up cycles
+    uint8_t ps2_hwm; // Most bytes ever waiting in the PS/2 receive buffer
+    uint8_t ser_hwm; // Most bytes ever waiting in the serial transmit buffer
+    uint16_t latency[PERF_HIST_BUCKETS]; // From the last PS/2 stop bit of a report to the last serial stop bit of its packet, in millis_stamp() units
+    uint16_t wait[PERF_HIST_BUCKETS]; // From the last PS/2 stop bit of a report to its transmit slot, in millis_stamp() units
+    uint16_t stack_free; // SRAM never touched by the stack, filled in by the main loop
+    uint16_t ser_clamped; // Movement lost at the scheduler accumulator limit, in counts, filled in by the main loop
+} PerfStats;
+
+// SRAM between the variables and the deepest the stack ever went, painted at boot and checked now.
+// Built even without the counters.
+uint16_t perf_stack_free(void);
+
+#if ENABLE_PERF
+extern volatile PerfStats perf_stats;
+
+// Count one more event
+#define PERF_INC(field) do { if(perf_stats.field != 0xFFFF) perf_stats.field++; } while(0)
+// Keep track of the highest level seen
+#define PERF_HWM(field, level) do { if((level) > perf_stats.field) perf_stats.field = (level); } while(0)
+// Count a value in one of the histograms, through the struct: a pointer to a packed member may be unaligned
+#define PERF_HIST(field, value) do { uint8_t bucket = perf_bucket(value); if(perf_stats.field[bucket] != 0xFFFF) perf_stats.field[bucket]++; } while(0)
+
+/**
+ * Log2 histogram bucket of a value, see PERF_HIST()
+ * @param value Value to count
+ * @return Bucket, 0 to PERF_HIST_BUCKETS - 1
+ */
+uint8_t perf_bucket(uint16_t value);
+
+/**
+ * Takes a consistent copy of the counters
+ * @param dst Pointer to a PerfStats struct that will contain the copy
+ */
+void perf_get(PerfStats *dst);
+#else
+#define PERF_INC(field) do { } while(0)
+#define PERF_HWM(field, level) do { } while(0)
+#define PERF_HIST(field, value) do { } while(0)
+#endif
+
+#endif /* _PERF_HEADER_ */
@@ -10,21 +10,35 @@
 //
 
 #include <inttypes.h>
-#include <avr/io.h>
-#include <avr/interrupt.h>
-#include <avr/pgmspace.h>
 
 #include <stdio.h>
 
 #include "ioconfig.h"
+#include "hal.h"
 
 #include "ps2.h"
+#include "perf.h"
+#include "millis.h"
+#include "trace.h"
 
 // Read PS2 data into bit 7
-#define ps2_datin() ((PS2PIN & _BV(PS2DAT)) ? 0x80 : 0x00)
+#define ps2_datin() (hal_ps2_get(HAL_PS2_DAT) ? 0x80 : 0x00)
 
 // Read PS2 clk into bit 7
-#define ps2_clkin() ((PS2PIN & _BV(PS2CLK)) ? 0x80 : 0x00)
+#define ps2_clkin() (hal_ps2_get(HAL_PS2_CLK) ? 0x80 : 0x00)
+
+// Timer0 periods, in ticks of the prescaled clock
+#if (F_CPU==16000000)
+#define T0_RECOVER 70   // approx 1ms, clk/256
+#define T0_REQ 8        // 128us, clk/256
+#define T0_ACK_POLL 4   // 2us, clk/8
+#define T0_BARKS 40     // 40*256*256/16e6 == 163ms
+#else /* 8Mhz */
+#define T0_RECOVER 35
+#define T0_REQ 4
+#define T0_ACK_POLL 2
+#define T0_BARKS 20     // 20*256*256/8e6 == 163ms
+#endif
 
 
 static volatile uint8_t state;                  // PS2 protocol state
@@ -33,6 +47,11 @@ static volatile uint8_t recv_byte;              // Byte being received
 static volatile uint8_t rx_head;                // Buffer head offset
 static volatile uint8_t rx_tail;                // Buffer tail offset
 static volatile uint8_t rx_buf[PS2_RXBUF_LEN];  // Receive buffer
+#if ENABLE_PERF // Only the latency counters need them
+static volatile uint16_t rx_stamp[PS2_RXBUF_LEN]; // When each byte got its stop bit
+static uint16_t last_stamp;                     // Stamp of the byte last returned by ps2_getbyte()
+#endif
+static volatile uint8_t rx_held;                // The buffer filled up, the mouse is inhibited until a byte is read
 
 static volatile uint8_t tx_byte;                // Byte being transmitted
 
@@ -71,42 +90,21 @@ void ps2_init(void) {
     state = IDLE;
     rx_head = 0;
     rx_tail = 0;
+    rx_held = 0;
     ps2_enable_recv(0);
 
     // Toggle INT0 at the falling edge
-#if defined (__AVR_ATmega8A__)
-    MCUCR |= _BV(ISC01);
-#elif defined (__AVR_ATmega328P__)
-    EICRA |= _BV(ISC01);
-#endif
+    hal_ps2_int_init();
 
     // Disable the timer 0 interrupts
-#if defined (__AVR_ATmega8A__)
-    TIMSK &= ~_BV(TOIE0);
-#elif defined (__AVR_ATmega328P__)
-    TIMSK0 &= ~_BV(TOIE0);
-#endif
+    hal_ps2_timer_stop();
 }
 
 /// Begin error recovery: disable reception and wait for timer interrupt
 void ps2_recover(void) {
     if (state == ERROR) {
         ps2_enable_recv(0);
-#if defined (__AVR_ATmega8A__) // 8 Mhz
-        TCNT0 = 255-35; // approx 1ms
-        TIMSK |= _BV(TOIE0);
-        TCCR0 = 4;  // enable: clk/256
-#elif defined (__AVR_ATmega328P__)
-#if (F_CPU==16000000)
-        TCNT0 = 255-70; // approx 1ms
-        TIMSK0 |= _BV(TOIE0);
-        TCCR0B = 0x04;
-#else /* 8Mhz */
-        TCNT0 = 255-35; // approx 1ms
-        TIMSK0 |= _BV(TOIE0);
-        TCCR0B = 0x04;
-#endif /* CPU speed */
-#endif /* AVR Type */
+        hal_ps2_timer_start(T0_RECOVER, HAL_TIMER_DIV256); // approx 1ms
     }
 }
 
@@ -115,20 +113,10 @@ void ps2_enable_recv(uint8_t enable) {
         state = IDLE;
         ps2_dir(1, 1);
         // enable INT0 interrupt
-#if defined (__AVR_ATmega8A__)
-        GIFR |= _BV(INTF0);
-        GICR |= _BV(INT0);
-#elif defined (__AVR_ATmega328P__)
-        EIFR |= _BV(INTF0);
-        EIMSK |= _BV(INT0);
-#endif
+        hal_ps2_int(1);
     } else {
         // disable INT0, then everything else
-#if defined (__AVR_ATmega8A__)
-        GICR &= ~_BV(INT0);
-#elif defined (__AVR_ATmega328P__)
-        EIMSK &= ~_BV(INT0);
-#endif
+        hal_ps2_int(0);
         ps2_clk(0);
         ps2_dir(1, 0);
     }
@@ -136,16 +124,16 @@ void ps2_enable_recv(uint8_t enable) {
 
 // when 0 -> input, when 1 -> output
 void ps2_dir(uint8_t dat_in, uint8_t clk_in) {
-    dat_in ? (PS2DDR &= ~_BV(PS2DAT)) : (PS2DDR |= _BV(PS2DAT));
-    clk_in ? (PS2DDR &= ~_BV(PS2CLK)) : (PS2DDR |= _BV(PS2CLK));
+    hal_ps2_input(HAL_PS2_DAT, dat_in);
+    hal_ps2_input(HAL_PS2_CLK, clk_in);
 }
 
 void ps2_clk(uint8_t c) {
-    c ? (PS2PORT |= _BV(PS2CLK)) : (PS2PORT &= ~_BV(PS2CLK));
+    hal_ps2_set(HAL_PS2_CLK, c);
 }
 
 void ps2_dat(uint8_t d) {
-    d ? (PS2PORT |= _BV(PS2DAT)) : (PS2PORT &= ~_BV(PS2DAT));
+    hal_ps2_set(HAL_PS2_DAT, d);
 }
 
 uint8_t ps2_avail() {
@@ -154,44 +142,46 @@ uint8_t ps2_avail() {
 
 uint8_t ps2_getbyte() {
     uint8_t result = rx_buf[rx_tail];
+#if ENABLE_PERF
+    last_stamp = rx_stamp[rx_tail];
+#endif
     rx_tail = (rx_tail + 1) % PS2_RXBUF_LEN;
 
+    if (rx_held) { // There is room again, let the mouse send what it kept
+        rx_held = 0;
+        ps2_enable_recv(1);
+    }
+
     return result;
 }
 
+#if ENABLE_PERF
+uint16_t ps2_stamp(void) {
+    return last_stamp;
+}
+#endif
+
 void ps2_sendbyte(uint8_t byte) {
-    while (state != IDLE);
+    while (state != IDLE) hal_spin();
 
     // 1. pull clk low for 100us
     ps2_enable_recv(0);
+    rx_held = 0; // Reception starts again after the transfer
 
     tx_byte = byte;
     state = TX_REQ0;
+    TRACE(TRACE_PS2_TX, byte);
 
     // 128us
-#if defined (__AVR_ATmega8A__)
-    TCNT0 = 255-4;
-    TIMSK |= _BV(TOIE0);
-    TCCR0 = 4;
-#elif defined (__AVR_ATmega328P__)
-#if (F_CPU==16000000)
-    TCNT0 = 255-8;
-    TIMSK0 |= _BV(TOIE0);
-    TCCR0B = 0x04;
-#else /* 8Mhz */
-    TCNT0 = 255-4;
-    TIMSK0 |= _BV(TOIE0);
-    TCCR0B = 0x04;
-#endif 
-#endif
+    hal_ps2_timer_start(T0_REQ, HAL_TIMER_DIV256);
 
-    while (state != IDLE);
+    while (state != IDLE) hal_spin();
 }
 
 // Happens every negative PS2 clock transition.
 //
 // ISR_NOBLOCK because nothing here is really critical
-ISR(INT0_vect, ISR_NOBLOCK) {
+HAL_ISR(HAL_VECT_PS2_CLK, ISR_NOBLOCK) {
     uint8_t ps2_indat = ps2_datin();
     switch (state) {
     case ERROR:
@@ -207,6 +197,8 @@ ISR(INT0_vect, ISR_NOBLOCK) {
             recv_byte = 0;
         } else {
             state = ERROR;
+            PERF_INC(ps2_frame_err);
+            TRACE(TRACE_PS2_FRAME, 0);
         }
         break;
     case RX_DATA:
@@ -223,14 +215,37 @@ ISR(INT0_vect, ISR_NOBLOCK) {
             state = RX_STOP;
         } else {
             state = ERROR;
+            PERF_INC(ps2_parity_err);
+            TRACE(TRACE_PS2_PARITY, recv_byte);
         }
         break;
     case RX_STOP:
         if (!ps2_indat) {
             state = ERROR;
+            PERF_INC(ps2_frame_err);
+            TRACE(TRACE_PS2_FRAME, recv_byte);
         } else {
-            rx_buf[rx_head] = recv_byte;
-            rx_head = (rx_head + 1) % PS2_RXBUF_LEN;
+            uint8_t next_head = (rx_head + 1) % PS2_RXBUF_LEN;
+
+            PERF_INC(ps2_frames);
+            TRACE(TRACE_PS2_RX, recv_byte);
+            if (next_head != rx_tail) { // If the buffer is full, the byte is dropped
+                rx_buf[rx_head] = recv_byte;
+#if ENABLE_PERF
+                rx_stamp[rx_head] = millis_stamp();
+#endif
+                rx_head = next_head;
+                PERF_HWM(ps2_hwm, (uint8_t)(rx_head + PS2_RXBUF_LEN - rx_tail) % PS2_RXBUF_LEN);
+
+                // No room for another byte: inhibit the mouse right after this stop bit, it keeps
+                // its next byte until the main loop reads this one (see ps2_getbyte())
+                if (((rx_head + 1) % PS2_RXBUF_LEN) == rx_tail) {
+                    ps2_enable_recv(0);
+                    rx_held = 1;
+                }
+            } else {
+                PERF_INC(ps2_overflow);
+            }
 
             state = IDLE;
         }
@@ -265,24 +280,8 @@ ISR(INT0_vect, ISR_NOBLOCK) {
             // this will end in TMR0 interrupt
             state = TX_END;
 
-#if defined (__AVR_ATmega8A__)
             waitcnt = 50;           // after 100us it's an error
-            TIMSK |= _BV(TOIE0);    // enable TMR0 interrupt
-            TCNT0 = 255-2;              // 4 counts: 2us
-            TCCR0 = 2;              // prescaler = f/8: go!
-#elif defined (__AVR_ATmega328P__)
-#if (F_CPU==16000000)
-            waitcnt = 50;
-            TIMSK0 |= _BV(TOIE0);
-            TCNT0 = 255-4;
-            TCCR0B = 0x02;
-#else /* 8Mhz */
-            waitcnt = 50;
-            TIMSK0 |= _BV(TOIE0);
-            TCNT0 = 255-2;
-            TCCR0B = 0x02;
-#endif
-#endif
+            hal_ps2_timer_start(T0_ACK_POLL, HAL_TIMER_DIV8); // 2us, then every 256 ticks
         }
         break;
     case TX_END:
@@ -292,46 +291,25 @@ ISR(INT0_vect, ISR_NOBLOCK) {
 }
 
 /// transmit timer and error recovery vector
-ISR(TIMER0_OVF_vect) {
+HAL_ISR(HAL_VECT_PS2_TIMER) {
     static uint8_t barkcnt = 0;
 
     switch (state) {
     case ERROR:
         state = IDLE;
+        PERF_INC(ps2_recover);
         ps2_clk(0);
         ps2_dat(0);
         ps2_enable_recv(1);
 
         // stop timer
-#if defined (__AVR_ATmega8A__)
-        TIMSK &= ~_BV(TOIE0);
-        TCCR0 = 0;
-#elif defined (__AVR_ATmega328P__)
-        TIMSK0 &= ~_BV(TOIE0);
-        TCCR0B = 0; // Clear CS00,02 // FIXME: Do we need to configure only this?
-#endif
+        hal_ps2_timer_stop();
         break;
     case TX_REQ0:
         // load the timer to serve as a watchdog
-        // after 20 barks this is an error
-#if defined (__AVR_ATmega8A__)
-        barkcnt = 20;
-        TIMSK |= _BV(TOIE0);    // enable TMR0 interrupt
-        TCNT0 = 0;//255;            // 20*255*256/8e6 == 163ms
-        TCCR0 = 4;               // prescaler = /256, go!
-#elif defined (__AVR_ATmega328P__)
-#if (F_CPU==16000000)
-        barkcnt = 40;
-        TIMSK0 |= _BV(TOIE0);
-        TCNT0 = 0;
-        TCCR0B = 0x04;
-#else /* 8Mhz */
-        barkcnt = 20;
-        TIMSK0 |= _BV(TOIE0);
-        TCNT0 = 0;
-        TCCR0B = 0x04;
-#endif
-#endif
+        // after T0_BARKS barks this is an error
+        barkcnt = T0_BARKS;
+        hal_ps2_timer_start(255, HAL_TIMER_DIV256);
         // waited for 100us after pulling clock low, pull data low
         ps2_dat(0);
         ps2_dir(0, 0);
@@ -339,13 +317,7 @@ ISR(TIMER0_OVF_vect) {
         // release the clock line
         ps2_dir(0, 1);
 
-#if defined (__AVR_ATmega8A__)
-        GIFR |= _BV(INTF0); // clear INT0 flag
-        GICR |= _BV(INT0);  // enable INT0 @(negedge clk)
-#elif defined (__AVR_ATmega328P__)
-        EIFR |= _BV(INTF0);
-        EIMSK |= _BV(INT0);
-#endif
+        hal_ps2_int(1); // enable INT0 @(negedge clk)
 
         // see you in INT0 handler
         bits = 8;
@@ -356,13 +328,7 @@ ISR(TIMER0_OVF_vect) {
     case TX_END:
         // wait until both clk and dat are up, that will be all
         if (ps2_clkin() && ps2_datin()) {
-#if defined (__AVR_ATmega8A__)
-            TIMSK &= ~_BV(TOIE0);
-            TCCR0 = 0;
-#elif defined (__AVR_ATmega328P__)
-            TIMSK0 &= ~_BV(TOIE0);
-            TCCR0B = 0x00; // FIXME
-#endif
+            hal_ps2_timer_stop();
             state = IDLE;
         } else {
             if (waitcnt == 0) {
@@ -10,8 +10,12 @@ void ps2_init(void);
 uint8_t ps2_avail(void);
 
 // Get one byte from input buffer. ps_avail() must be checked before doing so.
+// If the buffer had filled up, this lets the mouse send again.
 uint8_t ps2_getbyte(void);
 
+// Time the byte last returned by ps2_getbyte() was received, see millis_stamp(). Built with the performance counters.
+uint16_t ps2_stamp(void);
+
 // Transmit one byte and wait for completion.
 void ps2_sendbyte(uint8_t byte);
 
@@ -1,5 +1,17 @@
 #include "ps22ser.h"
 
+// PS/2 has 9-bit two's complement notation, plus an overflow bit.
+// Clamp it into an 8-bit two's complement value, as a serial mouse would report.
+static int8_t ps2DeltaToS8(uint8_t val, uint8_t sign, uint8_t overflow) {
+    if(overflow) return sign ? -128 : 127;
+
+    int16_t delta = sign ? ((int16_t)val - 256) : val;
+    
+    if(delta < -128) return -128;
+    else if(delta > 127) return 127;
+    else return (int8_t)delta;
+}
+
 uint8_t ps2bufToSer(const uint8_t *src, uint8_t *dst) {
     if(!(src[0] & 0x08)) return 0; // The only validation we can do, checking the single fixed bit in the first byte.
     uint8_t retval = 0x01;
@@ -19,14 +31,12 @@ uint8_t ps2bufToSer(const uint8_t *src, uint8_t *dst) {
     dst[3] |= (src[3] & 0x0F); // Just copy the 4 bits necessary for wheels
 
     // PS/2 has 9-bit two's complement notation
-    // Serial (microsoft) has 8-bit two's complement notation
+    // Serial (microsoft) has 8-bit two's complement notation, clamp the movement instead of letting it wrap around
+    int8_t x_mov = ps2DeltaToS8(src[1], src[0] & 0x10, src[0] & 0x40);
+    int8_t y_mov = ps2DeltaToS8(src[2], src[0] & 0x20, src[0] & 0x80);
 
     // We need to invert Y
-    int8_t y_mov = (-((src[0] & 0x20) ? (0x80 | src[2]) : (src[2] & 0x7F)));
-    int8_t x_mov = ((src[0] & 0x10) ? (0x80 | src[1]) : (src[1] & 0x7F));
-
-    y_mov |= (src[0] & 0x80) ? 0x7F : 0; 
-    x_mov |= (src[0] & 0x40) ? 0x7F : 0; 
+    y_mov = (y_mov == -128) ? 127 : -y_mov;
 
     // Movement - First byte
     dst[0] |= (x_mov >> 6) & 0x03; // X7,X6
@@ -38,3 +48,107 @@ uint8_t ps2bufToSer(const uint8_t *src, uint8_t *dst) {
 
     return retval;
 }
+
+#if ENABLE_PROTO_LOGI
+uint8_t ps2bufToLogi(const uint8_t *src, uint8_t *dst, uint8_t prev_btns) {
+    if(!ps2bufToSer(src, dst)) return 0; // First three bytes are the same as a Microsoft packet
+
+    if(!((src[0] ^ prev_btns) & 0x04)) return SER_LOGI_PKT_SIZE; // Middle button did not change, skip the 4th byte
+
+    dst[3] = 0x80 | ((src[0] & 0x04) << 3); // Middle button goes in D5, keep D6 at 0 so it's not taken as a new packet
+    
+    return SER_LOGI_PKT_SIZE + 1;
+}
+#endif
+
+uint8_t ps2bufBtns(const uint8_t *src, uint8_t five_btns) {
+    uint8_t btns = src[0] & (PS2_BTN_LEFT | PS2_BTN_RIGHT | PS2_BTN_MIDDLE);
+
+    if(five_btns) btns |= (src[3] & 0x30) >> 1; // 4th and 5th buttons are in bits 4 and 5 of the 4th byte
+
+    return btns;
+}
+
+#if ENABLE_PROTO_LOGIWHL
+// Wheel movement is 8-bit on wheel mouses, and 4-bit on 5-button mouses (the upper bits are buttons).
+// Serial wheel protocols only have 4 bits, so saturate it instead of letting it wrap around.
+static int8_t ps2WheelDelta(const uint8_t *src, uint8_t five_btns) {
+    int8_t wheel = five_btns ? ((src[3] & 0x08) ? (src[3] | 0xF0) : (src[3] & 0x0F)) : (int8_t)src[3];
+
+    if(wheel < -8) return -8;
+    else if(wheel > 7) return 7;
+    else return wheel;
+}
+
+uint8_t ps2bufToLogiWheel(const uint8_t *src, uint8_t *dst, uint8_t prev_btns, uint8_t five_btns) {
+    if(!ps2bufToSer(src, dst)) return 0; // First three bytes are the same as a Microsoft packet
+
+    uint8_t btns = ps2bufBtns(src, five_btns);
+
+    dst[3] = 0x80; // Leave the first bit to 1 to simulate 7n2
+    dst[3] |= (btns & PS2_BTN_MIDDLE) << 2; // Middle button in D4
+    dst[3] |= (btns & PS2_BTN_4TH) << 2; // 4th button in D5
+    dst[3] |= ps2WheelDelta(src, five_btns) & 0x0F; // Wheel
+
+    if(!((btns ^ prev_btns) & (PS2_BTN_4TH | PS2_BTN_5TH))) return SER_LOGIWHL_PKT_SIZE;
+
+    // Extension packet, type 1 (extra mouse info): type goes in D2-D5 of the first byte, buttons in D4-D5 of the second one,
+    // see docs/logitech_wheel_serial.md
+    dst[4] = 0x80 | (0x01 << 2);
+    dst[5] = 0x80 | ((btns & (PS2_BTN_4TH | PS2_BTN_5TH)) << 1);
+
+    return SER_LOGIWHL_PKT_SIZE + 2;
+}
+#endif
+
+#if ENABLE_PROTO_MSYS
+uint8_t ps2bufToMSys(const uint8_t *src, uint8_t *dst, uint8_t half) {
+    if(!(src[0] & 0x08)) return 0; // Same validation as the Microsoft conversion
+
+    // Both protocols have Y positive upward, so no need to invert it here
+    int8_t x_mov = ps2DeltaToS8(src[1], src[0] & 0x10, src[0] & 0x40);
+    int8_t y_mov = ps2DeltaToS8(src[2], src[0] & 0x20, src[0] & 0x80);
+
+    if(!half) {
+        dst[0] = 0x87; // Sync bits, with all the buttons released (buttons are active low)
+        
+        dst[0] &= ~((src[0] & 0x01) << 2); // Left
+        dst[0] &= ~((src[0] & 0x04) >> 1); // Middle
+        dst[0] &= ~((src[0] & 0x02) >> 1); // Right
+
+        dst[1] = x_mov; // Xa
+        dst[2] = y_mov; // Ya
+        dst[3] = dst[4] = 0x00; // No movement in the second half, for now
+    } else {
+        dst[3] = x_mov; // Xb
+        dst[4] = y_mov; // Yb
+    }
+
+    return 1;
+}
+#endif
+
+#if ENABLE_PROTO_MM
+uint8_t ps2bufToMM(const uint8_t *src, uint8_t *dst) {
+    if(!(src[0] & 0x08)) return 0;
+
+    // MM series sends sign and magnitude, with the sign bit set for movements right and up (same as PS/2)
+    int8_t x_mov = ps2DeltaToS8(src[1], src[0] & 0x10, src[0] & 0x40);
+    int8_t y_mov = ps2DeltaToS8(src[2], src[0] & 0x20, src[0] & 0x80);
+
+    dst[0] = 0x80; // Sync bit
+    dst[0] |= (src[0] & 0x01) << 2; // Left
+    dst[0] |= (src[0] & 0x04) >> 1; // Middle
+    dst[0] |= (src[0] & 0x02) >> 1; // Right
+
+    if(x_mov >= 0) dst[0] |= 0x10;
+    if(y_mov >= 0) dst[0] |= 0x08;
+
+    // Magnitudes are only 7 bits
+    dst[1] = (x_mov < 0) ? ((x_mov == -128) ? 127 : -x_mov) : x_mov;
+    dst[2] = (y_mov < 0) ? ((y_mov == -128) ? 127 : -y_mov) : y_mov;
+
+    return 1;
+}
+#endif
+
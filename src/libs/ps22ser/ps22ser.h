@@ -3,6 +3,40 @@
 
 #include <stdint.h>
 
+// Serial protocols built into the firmware, the Makefiles set them to 0 to leave a protocol out.
+// Microsoft + Wheel is the fallback protocol and is always built in.
+#ifndef ENABLE_PROTO_MS
+#define ENABLE_PROTO_MS 1
+#endif
+#ifndef ENABLE_PROTO_MSYS
+#define ENABLE_PROTO_MSYS 1
+#endif
+#ifndef ENABLE_PROTO_LOGI
+#define ENABLE_PROTO_LOGI 1
+#endif
+#ifndef ENABLE_PROTO_LOGIWHL
+#define ENABLE_PROTO_LOGIWHL 1
+#endif
+#ifndef ENABLE_PROTO_MM
+#define ENABLE_PROTO_MM 1
+#endif
+
+#define SER_MS_PKT_SIZE 3
+#define SER_MSWHL_PKT_SIZE 4
+#define SER_MSYS_PKT_SIZE 5
+#define SER_LOGI_PKT_SIZE 3 // Plus one optional byte for the middle button
+#define SER_LOGIWHL_PKT_SIZE 4 // Plus two optional bytes for the 4th and 5th buttons
+#define SER_MM_PKT_SIZE 3
+
+#define SER_MAX_PKT_SIZE (2 * SER_MSYS_PKT_SIZE) // A pending Mouse Systems packet can be flushed together with the next one
+
+// Button bits, as returned by ps2bufBtns(). The first three match the PS/2 packet.
+#define PS2_BTN_LEFT 0x01
+#define PS2_BTN_RIGHT 0x02
+#define PS2_BTN_MIDDLE 0x04
+#define PS2_BTN_4TH 0x08
+#define PS2_BTN_5TH 0x10
+
 /**
  * This function converts a 3-byte PS/2 mouse packet into a 3 or 4 bytes
  * Microsoft/Logitech serial protocol
@@ -12,4 +46,55 @@
  */
 uint8_t ps2bufToSer(const uint8_t *src, uint8_t *dst);
 
+/**
+ * This function converts a 3-byte PS/2 mouse packet into one half of a 5-byte
+ * Mouse Systems serial packet. The first half carries the buttons and the Xa/Ya movement,
+ * the second half carries the Xb/Yb movement that happened after the first half.
+ * @param src Pointer to a 3-byte uint8_t buffer that contains the PS/2 mouse packet
+ * @param dst Pointer to a 5-byte uint8_t buffer that will contain the converted response in serial protocol
+ * @param half 0 to fill the first half (this also clears the second one), 1 to fill the second half
+ * @return If 0, the conversion did not work else, the conversion was performed.
+ */
+uint8_t ps2bufToMSys(const uint8_t *src, uint8_t *dst, uint8_t half);
+
+/**
+ * This function converts a 3-byte PS/2 mouse packet into a Logitech 3-button serial packet.
+ * That's a Microsoft packet, plus a 4th byte with the middle button status that is sent
+ * only when the middle button changes state.
+ * @param src Pointer to a 3-byte uint8_t buffer that contains the PS/2 mouse packet
+ * @param dst Pointer to a 4-byte uint8_t buffer that will contain the converted response in serial protocol
+ * @param prev_btns Button status (in PS/2 format) of the previously transmitted packet
+ * @return 0 if the conversion did not work, otherwise the number of bytes to transmit (3 or 4)
+ */
+uint8_t ps2bufToLogi(const uint8_t *src, uint8_t *dst, uint8_t prev_btns);
+
+/**
+ * This function converts a 3-byte PS/2 mouse packet into a 3-byte Logitech MM series serial packet.
+ * The packet must be sent with odd parity.
+ * @param src Pointer to a 3-byte uint8_t buffer that contains the PS/2 mouse packet
+ * @param dst Pointer to a 3-byte uint8_t buffer that will contain the converted response in serial protocol
+ * @return If 0, the conversion did not work else, the conversion was performed.
+ */
+uint8_t ps2bufToMM(const uint8_t *src, uint8_t *dst);
+
+/**
+ * Extracts the status of all the buttons from a PS/2 mouse packet
+ * @param src Pointer to a 4-byte uint8_t buffer that contains the PS/2 mouse packet
+ * @param five_btns If not 0, the packet comes from an Intellimouse Explorer compatible mouse
+ * @return Bitmask with the PS2_BTN_* bits of the pressed buttons
+ */
+uint8_t ps2bufBtns(const uint8_t *src, uint8_t five_btns);
+
+/**
+ * This function converts a 4-byte PS/2 wheel mouse packet into a Logitech serial wheel packet.
+ * That's a Microsoft wheel packet with the 4th button in D5 of the 4th byte, plus two extension bytes
+ * carrying the 4th and 5th buttons that are sent only when one of them changes state.
+ * @param src Pointer to a 4-byte uint8_t buffer that contains the PS/2 mouse packet
+ * @param dst Pointer to a 6-byte uint8_t buffer that will contain the converted response in serial protocol
+ * @param prev_btns Button status (as returned by ps2bufBtns()) of the previously transmitted packet
+ * @param five_btns If not 0, the packet comes from an Intellimouse Explorer compatible mouse
+ * @return 0 if the conversion did not work, otherwise the number of bytes to transmit (4 or 6)
+ */
+uint8_t ps2bufToLogiWheel(const uint8_t *src, uint8_t *dst, uint8_t prev_btns, uint8_t five_btns);
+
 #endif /* _PS22SER_HEADER_ */
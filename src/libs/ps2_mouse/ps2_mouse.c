@@ -1,11 +1,9 @@
 #include "ps2_mouse.h"
 
-#include <avr/wdt.h>
 #include <avr/pgmspace.h>
 
-#include <util/delay.h>
-
 #include "ps2.h"
+#include "hal.h"
 
 // This sequence will enable wheel mode and 4 bytes mode, where supported
 static const uint8_t ps2_wheel_sequence[] PROGMEM = { 0xF3, 0xC8,
@@ -13,6 +11,12 @@ static const uint8_t ps2_wheel_sequence[] PROGMEM = { 0xF3, 0xC8,
                                                       0xF3, 0x50
                                                     };
 
+// This sequence will enable 4th and 5th buttons on Intellimouse Explorer compatible mouses. Needs wheel mode enabled first.
+static const uint8_t ps2_5btn_sequence[] PROGMEM = { 0xF3, 0xC8,
+                                                     0xF3, 0xC8,
+                                                     0xF3, 0x50
+                                                   };
+
 static void mouse_flush_fast(void);
 static void mouse_flush_med(void);
 static void mouse_flush_slow(void);
@@ -20,27 +24,54 @@ static uint16_t mouse_get_status(void);
 static uint16_t mouse_get_id(void);
 static void mouse_sendSequence(const uint8_t *seq, uint8_t length);
 
+// Valid PS/2 sample rates
+static const uint8_t ps2_rates[] PROGMEM = { 10, 20, 40, 60, 80, 100, 200 };
+
+#define MOUSE_CMD_WAIT 22 // Time the mouse gets to answer a command, in ms
+
+// Settings waiting to be sent by mouse_task()
+#define MOUSE_PEND_RES 0x01
+#define MOUSE_PEND_RATE 0x02
+#define MOUSE_PEND_REMOTE 0x04
+#define MOUSE_PEND_POLL 0x08
+
+// Steps of a sequence
+#define MOUSE_SEQ_IDLE 0
+#define MOUSE_SEQ_FLUSH 1 // The mouse was disabled, waiting for it to go quiet
+#define MOUSE_SEQ_SEND 2 // Next byte to be sent
+#define MOUSE_SEQ_ACK 3 // Waiting for the answer to the last byte
+
+#define MOUSE_SEQ_MAX 7 // Resolution, rate, remote mode and enable
+
+static uint8_t pending = 0; // MOUSE_PEND_* flags
+static uint8_t pend_res, pend_rate;
+
+static uint8_t seq_state = MOUSE_SEQ_IDLE;
+static uint8_t seq[MOUSE_SEQ_MAX]; // Bytes of the sequence being sent
+static uint8_t seq_len, seq_idx;
+static uint32_t seq_time; // When the current step started
+
 static void mouse_flush_fast(void) {
-    _delay_ms(0);
+    hal_delay_ms(0);
     do {
         if (ps2_avail()) ps2_getbyte();
-        _delay_ms(0);
+        hal_delay_ms(0);
     } while (ps2_avail());
 }
 
 static void mouse_flush_med(void) {
-    _delay_ms(22);
+    hal_delay_ms(22);
     do {
         if (ps2_avail()) ps2_getbyte();
-        _delay_ms(22);
+        hal_delay_ms(22);
     } while (ps2_avail());
 }
 
 static void mouse_flush_slow(void) {
-    _delay_ms(100);
+    hal_delay_ms(100);
     do {
         if (ps2_avail()) ps2_getbyte();
-        _delay_ms(100);
+        hal_delay_ms(100);
     } while (ps2_avail());
 }
 
@@ -59,11 +90,11 @@ uint8_t mouse_reset(void) {
     ps2_sendbyte(PS2_MOUSE_CMD_RESET);
 
     // Kick the watchdog
-    wdt_reset();
+    hal_wdt_kick();
 
     // wait for some time for mouse self-test to complete
     while (1) {
-        _delay_ms(250);
+        hal_delay_ms(250);
         if (ps2_avail()) {
             b = ps2_getbyte();
             if ((b == PS2_MOUSE_RESP_RESETOK) || (b == PS2_MOUSE_RESP_ACK)) { // Apparently, some mouses respond with ACK to a reset...
@@ -75,7 +106,7 @@ uint8_t mouse_reset(void) {
     }
 
     // flush the rest of reponse, most likely mouse id == 0
-    _delay_ms(100);
+    hal_delay_ms(100);
     mouse_flush_fast();
 
     return 0;
@@ -86,7 +117,7 @@ int16_t mouse_command(uint8_t cmd, uint8_t wait) {
 
     ps2_sendbyte(cmd);
     if (wait) {
-        _delay_ms(22);
+        hal_delay_ms(22);
         if (ps2_avail()) response = ps2_getbyte();
     }
 
@@ -94,12 +125,87 @@ int16_t mouse_command(uint8_t cmd, uint8_t wait) {
 }
 
 void mouse_setres(uint8_t res) {
-    mouse_command(PS2_MOUSE_CMD_DISABLE, 1);
+    pend_res = res;
+    pending |= MOUSE_PEND_RES;
+}
 
-    mouse_command(PS2_MOUSE_CMD_SET_RESOLUTION, 1);
-    mouse_command(res, 1); // 0 = 1, 1 = 2, 2 = 4, 3 = 8 counts/mm
+uint8_t mouse_validrate(uint8_t rate) {
+    for(uint8_t idx = 0; idx < sizeof(ps2_rates); idx++) {
+        if(pgm_read_byte(&ps2_rates[idx]) == rate) return 1;
+    }
 
-    mouse_command(PS2_MOUSE_CMD_ENABLE, 1);
+    return 0;
+}
+
+void mouse_setrate(uint8_t rate) {
+    pend_rate = rate;
+    pending = (pending | MOUSE_PEND_RATE) & ~MOUSE_PEND_REMOTE; // Stream mode wins over an older prompt mode
+}
+
+void mouse_setprompt(void) {
+    pending |= MOUSE_PEND_REMOTE;
+}
+
+void mouse_poll(void) {
+    pending |= MOUSE_PEND_POLL;
+}
+
+uint8_t mouse_busy(void) {
+    return pending || (seq_state != MOUSE_SEQ_IDLE);
+}
+
+uint8_t mouse_task(uint32_t now) {
+    switch(seq_state) {
+        case MOUSE_SEQ_IDLE:
+            seq_idx = seq_len = 0;
+            if(pending & (MOUSE_PEND_RES | MOUSE_PEND_RATE | MOUSE_PEND_REMOTE)) {
+                if(pending & MOUSE_PEND_RES) {
+                    seq[seq_len++] = PS2_MOUSE_CMD_SET_RESOLUTION;
+                    seq[seq_len++] = pend_res;
+                }
+                if(pending & MOUSE_PEND_RATE) {
+                    seq[seq_len++] = PS2_MOUSE_CMD_STREAMMODE;
+                    seq[seq_len++] = PS2_MOUSE_CMD_SAMPLERATE;
+                    seq[seq_len++] = pend_rate;
+                }
+                if(pending & MOUSE_PEND_REMOTE) seq[seq_len++] = PS2_MOUSE_CMD_REMOTEMODE;
+                seq[seq_len++] = PS2_MOUSE_CMD_ENABLE;
+                pending &= MOUSE_PEND_POLL; // A poll goes after the new settings
+
+                // Stop the mouse from reporting, and throw away whatever it sent before
+                mouse_command(PS2_MOUSE_CMD_DISABLE, 0);
+                seq_state = MOUSE_SEQ_FLUSH;
+                seq_time = now;
+                return 1;
+            }
+            if(!pending) return 0;
+
+            pending = 0;
+            seq[seq_len++] = PS2_MOUSE_CMD_READDATA;
+            seq_state = MOUSE_SEQ_SEND;
+            // fall through, the poll goes out right away
+        case MOUSE_SEQ_SEND:
+            mouse_command(seq[seq_idx++], 0);
+            seq_state = MOUSE_SEQ_ACK;
+            seq_time = now;
+            break;
+        case MOUSE_SEQ_FLUSH:
+            if(ps2_avail()) { // Still talking, wait until it has been quiet for a while
+                while(ps2_avail()) ps2_getbyte();
+                seq_time = now;
+            } else if((now - seq_time) >= MOUSE_CMD_WAIT) seq_state = MOUSE_SEQ_SEND;
+            break;
+        case MOUSE_SEQ_ACK:
+            if((now - seq_time) < MOUSE_CMD_WAIT) break;
+
+            if(ps2_avail()) ps2_getbyte(); // Eat the ACK. After a poll only the report is left in the buffer.
+            seq_state = (seq_idx < seq_len) ? MOUSE_SEQ_SEND : MOUSE_SEQ_IDLE;
+            break;
+        default:
+            break;
+    }
+
+    return 0;
 }
 
 uint8_t mouse_init(uint8_t res, uint8_t wheel_detect) {
@@ -119,7 +225,7 @@ uint8_t mouse_init(uint8_t res, uint8_t wheel_detect) {
     mouse_command(res, 1); // 0 = 1, 1 = 2, 2 = 4, 3 = 8 counts/mm
     mouse_flush_med();
 
-    wdt_reset();
+    hal_wdt_kick();
 
     // Get button status
     sreq = mouse_get_status();
@@ -127,7 +233,7 @@ uint8_t mouse_init(uint8_t res, uint8_t wheel_detect) {
     if(sreq & 0x0100) retval |= MOUSE_ERR_MASK; // Notify we did not get a response
     mouse_flush_med();
 
-    wdt_reset();
+    hal_wdt_kick();
 
     // Check for mouse wheel
     if(wheel_detect) mouse_sendSequence(ps2_wheel_sequence, sizeof(ps2_wheel_sequence));
@@ -137,7 +243,19 @@ uint8_t mouse_init(uint8_t res, uint8_t wheel_detect) {
     if((id & 0x00FF) == MOUSE_ID_WHEEL) retval |= MOUSE_EXT_MASK;
     if(id & 0x0100) retval |= MOUSE_ERR_MASK; // Notify we did not get a response
 
-    wdt_reset();
+    hal_wdt_kick();
+
+    // We have a wheel, check if we also have 4th and 5th buttons
+    if(retval & MOUSE_EXT_MASK) {
+        mouse_sendSequence(ps2_5btn_sequence, sizeof(ps2_5btn_sequence));
+        mouse_flush_med();
+
+        id = mouse_get_id();
+        if((id & 0x00FF) == MOUSE_ID_5BUTTONS) retval |= MOUSE_5BTN_MASK;
+        if(id & 0x0100) retval |= MOUSE_ERR_MASK;
+    }
+
+    hal_wdt_kick();
 
     mouse_command(PS2_MOUSE_CMD_ENABLE, 1);
 
@@ -158,7 +276,7 @@ static uint16_t mouse_get_status(void) {
 
     mouse_command(PS2_MOUSE_CMD_STATREQ, 0);
     while(retries) { // Loop until we get what we want or we die!
-        _delay_ms(20);
+        hal_delay_ms(20);
         if(ps2_avail()) {
             sreq = ps2_getbyte();
             if(sreq == PS2_MOUSE_RESP_NAK) mouse_command(PS2_MOUSE_CMD_STATREQ, 0); // Send the command again
@@ -175,7 +293,7 @@ static uint16_t mouse_get_id(void) {
 
     mouse_command(PS2_MOUSE_CMD_READID, 0);
     while(retries) { // Loop until we get what we want or we die!
-        _delay_ms(20);
+        hal_delay_ms(20);
         if(ps2_avail()) {
             id = ps2_getbyte();
             if (id == PS2_MOUSE_RESP_ERROR) return MOUSE_ID_STANDARD; // Some older mouses respond with an error to this command
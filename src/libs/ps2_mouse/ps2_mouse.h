@@ -14,6 +14,7 @@
 #define PS2_MOUSE_CMD_SCALNG21 0xe7
 #define PS2_MOUSE_CMD_SET_RESOLUTION 0xe8
 #define PS2_MOUSE_CMD_STATREQ 0xe9
+#define PS2_MOUSE_CMD_STREAMMODE 0xea
 #define PS2_MOUSE_CMD_READDATA 0xeb
 #define PS2_MOUSE_CMD_CLEARECHO 0xec
 #define PS2_MOUSE_CMD_SETECHO 0xee
@@ -30,20 +31,45 @@
 #define MOUSE_EXT_MASK 0x08
 #define MOUSE_BTN_MASK 0x07
 #define MOUSE_ERR_MASK 0x10
+#define MOUSE_5BTN_MASK 0x20
 
 #define MOUSE_ID_STANDARD 0x00
 #define MOUSE_ID_WHEEL 0x03
+#define MOUSE_ID_5BUTTONS 0x04
 
 /**
  * Resets, initializes and configures the mouse
  * @param res resolution to initialize the mouse with
  * @param wheel_detect if 1, we attempt wheel activation
- * @return The status of the buttons in the 3 Least Significant Bits, 0 in the 4th bit if a normal mouse is detected, 1 if a PS/2++ compatible mouse is detected, the 5th bit indicates failure in responding to id or status requests
+ * @return The status of the buttons in the 3 Least Significant Bits, 0 in the 4th bit if a normal mouse is detected, 1 if a PS/2++ compatible mouse is detected, the 5th bit indicates failure in responding to id or status requests, the 6th bit is 1 if an Intellimouse Explorer (5 buttons) compatible mouse is detected
  */
 uint8_t mouse_init(uint8_t res, uint8_t wheel_detect);
 
 uint8_t mouse_reset(void);
 int16_t mouse_command(uint8_t cmd, uint8_t wait);
+
+// The settings below are not sent right away: mouse_task() sends them from the main loop a byte at a time,
+// so the serial reports keep going out while the mouse is reconfigured (about 150 ms). Settings asked for
+// while a sequence is running are sent after it, only the last value of each one.
+
+// Set the resolution, 0 = 1, 1 = 2, 2 = 4, 3 = 8 counts/mm
 void mouse_setres(uint8_t res);
+// Set the sample rate (reports per second) and go back to stream mode. Rate must be valid, see mouse_validrate()
+void mouse_setrate(uint8_t rate);
+// Check if the rate is a valid PS/2 sample rate
+uint8_t mouse_validrate(uint8_t rate);
+// Switch to remote mode: the mouse keeps accumulating movement and sends a report only when polled
+void mouse_setprompt(void);
+// Ask the mouse for a report while in remote mode. The report will be received like any other, once mouse_busy() is 0.
+void mouse_poll(void);
+
+/**
+ * Sends the settings asked for, one step at a time. Never waits longer than a PS/2 byte takes to go out.
+ * @param now Current millis()
+ * @return 1 if the mouse was just stopped to be reconfigured: what was received of a report is thrown away
+ */
+uint8_t mouse_task(uint32_t now);
+// Check if settings are still to be sent. The PS/2 receive buffer holds the answers of the mouse until then, leave it alone.
+uint8_t mouse_busy(void);
 
 #endif /* _PS2_MOUSE_HEADER_ */
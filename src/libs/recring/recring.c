@@ -0,0 +1,86 @@
+#include "recring.h"
+
+#include <stddef.h>
+
+#include "hal.h"
+#include "uart.h"
+#include "diag.h"
+#include "millis.h"
+
+#if ENABLE_DIAG_UART
+#define out_free(to) (((to) == RECRING_ON_DIAG) ? diag_tx_free() : uart_tx_free())
+#define out_putbyte(to, b) (((to) == RECRING_ON_DIAG) ? diag_putbyte(b) : uart_putbyte(b))
+#define out_empty(to) (((to) == RECRING_ON_DIAG) ? diag_tx_empty() : uart_tx_empty())
+#else
+#define out_free(to) uart_tx_free()
+#define out_putbyte(to, b) uart_putbyte(b)
+#define out_empty(to) uart_tx_empty()
+#endif
+
+void recring_start(RecRing *ring, uint8_t to) {
+    HAL_ATOMIC {
+        ring->head = ring->tail = 0;
+        ring->lost = 0;
+        ring->on = to;
+    }
+    ring->last_sent = millis();
+}
+
+void recring_stop(RecRing *ring) {
+    HAL_ATOMIC {
+        ring->on = 0;
+        ring->head = ring->tail;
+    }
+}
+
+volatile uint8_t *recring_alloc(RecRing *ring) {
+    if(((ring->head + 1) & ring->mask) == ring->tail) {
+        ring->lost = 1;
+        return NULL;
+    }
+
+    return ring->buf + (ring->head * ring->size);
+}
+
+void recring_commit(RecRing *ring) {
+    if(ring->lost) ring->buf[ring->head * ring->size] |= ring->lost_flag;
+    ring->head = (ring->head + 1) & ring->mask;
+    ring->lost = 0;
+}
+
+uint8_t recring_idle(const RecRing *ring, uint32_t now, uint32_t tick_ms) {
+    return ring->on && (ring->head == ring->tail) && ((now - ring->last_sent) >= tick_ms);
+}
+
+void recring_flush(RecRing *ring, uint32_t now) {
+    uint8_t to = ring->on, size = ring->size;
+    uint8_t tail = ring->tail; // Only the main loop moves it
+
+    if(!to) return;
+
+    while((ring->head != tail) && (out_free(to) >= size)) {
+        volatile uint8_t *rec = ring->buf + (tail * size);
+
+        for(uint8_t idx = 0; idx < size; idx++) out_putbyte(to, rec[idx]);
+        tail = (tail + 1) & ring->mask;
+        ring->tail = tail;
+        ring->last_sent = now;
+    }
+}
+
+void recring_drain(RecRing *ring) {
+    uint8_t to = ring->on;
+
+    if(!to) return;
+
+    while(ring->head != ring->tail) {
+        recring_flush(ring, millis());
+        hal_spin();
+    }
+
+    if(to == RECRING_ON_UART) uart_tx_drain(); // Down to the last stop bit
+    else {
+        while(!out_empty(to)) hal_spin();
+        hal_delay_ms(1); // Only a stop bit left
+    }
+}
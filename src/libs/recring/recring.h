@@ -0,0 +1,70 @@
+#ifndef _RECRING_HEADER_
+#define _RECRING_HEADER_
+
+// Ring of fixed-size records, behind the binary outputs (the PS/2 trace capture, the debug log).
+// Records are queued in RAM, by the ISRs too, and moved to the serial port or the diagnostic output
+// by the main loop, only as room frees up there, so nothing in the data path waits for them.
+// When the ring is full new records are dropped, and the next one that fits gets the owner's lost flag
+// in its first byte.
+
+#include <stdint.h>
+
+// Where the records go, on is 0 when the ring is not running
+#define RECRING_ON_UART 1
+#define RECRING_ON_DIAG 2 // The diagnostic output, see diag.h
+
+typedef struct {
+    volatile uint8_t *buf; // Storage for mask + 1 records
+    uint8_t size; // Bytes in a record
+    uint8_t mask; // Records the ring holds - 1, they must be a power of 2
+    uint8_t lost_flag; // Set in the first byte of the record that follows a loss
+    volatile uint8_t on; // RECRING_ON_UART, RECRING_ON_DIAG or 0
+    volatile uint8_t head; // Written by whoever queues, maybe an ISR
+    volatile uint8_t tail;
+    volatile uint8_t lost; // Records were dropped since the last one queued
+    uint32_t last_sent; // When the last record went out, in ms
+} RecRing;
+
+/**
+ * Static initializer of a ring
+ * @param storage Array of len * size bytes
+ * @param size Bytes in a record
+ * @param len Records the ring holds, a power of 2
+ * @param lost_flag Bit set in the first byte of a record when records were lost before it
+ */
+#define RECRING_INIT(storage, size, len, lost_flag) { (storage), (size), (len) - 1, (lost_flag), 0, 0, 0, 0, 0 }
+
+/**
+ * Start sending, clearing what might be left
+ * @param to RECRING_ON_UART or RECRING_ON_DIAG
+ */
+void recring_start(RecRing *ring, uint8_t to);
+// Stop sending, dropping the records still queued
+void recring_stop(RecRing *ring);
+
+/**
+ * Room for the next record. Fill it and queue it with recring_commit(), with the interrupts disabled
+ * if an ISR queues records into the same ring.
+ * @return Where to write the record, NULL if the ring is full: the record is lost
+ */
+volatile uint8_t *recring_alloc(RecRing *ring);
+// Queue the record returned by recring_alloc(), flagging it if records were lost before it
+void recring_commit(RecRing *ring);
+
+/**
+ * Check if the output went quiet: the ring runs, is empty and sent nothing for a while
+ * @param now Current millis()
+ * @param tick_ms How long is a while, in ms
+ */
+uint8_t recring_idle(const RecRing *ring, uint32_t now, uint32_t tick_ms);
+
+/**
+ * Moves whole records to the output, as long as it has room for them. Never waits.
+ * @param now Current millis()
+ */
+void recring_flush(RecRing *ring, uint32_t now);
+
+// Sends everything queued and waits for the last stop bit to leave the output, e.g. before sleeping
+void recring_drain(RecRing *ring);
+
+#endif /* _RECRING_HEADER_ */
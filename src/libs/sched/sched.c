@@ -0,0 +1,184 @@
+#include "sched.h"
+
+#include <stddef.h>
+
+#include "ps22ser.h"
+#include "motion.h"
+
+#if (SCHED_BTN_QUEUE_SIZE & (SCHED_BTN_QUEUE_SIZE - 1))
+#error "SCHED_BTN_QUEUE_SIZE must be a power of 2"
+#endif
+
+// What a serial packet carries on every axis: 8-bit two's complement, and the MM series only has 7-bit magnitudes
+#define SER_DELTA_MAX 127
+// What we are willing to keep accumulated, even with the lossless policy: more is counted in SchedStats.clamped
+#define SCHED_DELTA_MAX 2047
+
+static int16_t acc_x, acc_y; // Accumulated movement, PS/2 orientation (Y positive upward)
+static uint32_t acc_time; // When the oldest accumulated movement came in
+
+// A button change still to be sent
+typedef struct {
+    uint8_t btns; // As returned by ps2bufBtns()
+    int16_t x, y; // Movement made before the change: it goes out first, with the previous buttons
+} SchedBtn;
+
+static SchedBtn btn_queue[SCHED_BTN_QUEUE_SIZE];
+static uint8_t btn_head, btn_tail;
+static uint8_t sent_btns; // Buttons in the last packet we built
+static uint8_t last_btns; // Most recent button status, sent or queued
+
+static uint8_t has_five_btns, has_wheel;
+
+static uint8_t out_policy = SCHED_LOSSLESS;
+static uint8_t out_max_lag = 100;
+static SchedStats stats;
+static uint8_t stats_changed; // Since sched_stats_changed() was last called
+
+static int16_t sched_add(int16_t acc, int16_t delta);
+static int16_t sched_clamp(int16_t acc);
+static uint16_t sched_count(uint16_t counter, uint16_t amount);
+
+void sched_setpolicy(uint8_t policy, uint8_t max_lag) {
+    out_policy = policy;
+    out_max_lag = max_lag;
+}
+
+const SchedStats *sched_stats(void) {
+    return &stats;
+}
+
+uint8_t sched_stats_changed(void) {
+    uint8_t changed = stats_changed;
+
+    stats_changed = 0;
+    return changed;
+}
+
+// Saturating counter increment, of one of the statistics
+static uint16_t sched_count(uint16_t counter, uint16_t amount) {
+    stats_changed = 1;
+    return ((uint16_t)(counter + amount) < counter) ? 0xFFFF : (counter + amount);
+}
+
+void sched_reset(uint8_t five_btns, uint8_t wheel) {
+    acc_x = acc_y = 0;
+    btn_head = btn_tail = 0;
+
+    if(last_btns != sent_btns) { // The buttons are still where they are, the host must know
+        btn_queue[btn_head].btns = last_btns;
+        btn_queue[btn_head].x = btn_queue[btn_head].y = 0;
+        btn_head++;
+    }
+
+    has_five_btns = five_btns;
+    has_wheel = wheel;
+
+    motion_wheel_clear();
+}
+
+// Adds to an accumulator, what goes past the limit is lost and counted
+static int16_t sched_add(int16_t acc, int16_t delta) {
+    acc += delta;
+
+    if(acc < -SCHED_DELTA_MAX) {
+        stats.clamped = sched_count(stats.clamped, -SCHED_DELTA_MAX - acc);
+        return -SCHED_DELTA_MAX;
+    } else if(acc > SCHED_DELTA_MAX) {
+        stats.clamped = sched_count(stats.clamped, acc - SCHED_DELTA_MAX);
+        return SCHED_DELTA_MAX;
+    } else return acc;
+}
+
+void sched_report(const uint8_t *buf, uint32_t now) {
+    uint8_t btns = ps2bufBtns(buf, has_five_btns);
+
+    // An overflowing axis is taken at its limit
+    int16_t x = (buf[0] & 0x40) ? ((buf[0] & 0x10) ? -256 : 255) : ((buf[0] & 0x10) ? ((int16_t)buf[1] - 256) : buf[1]);
+    int16_t y = (buf[0] & 0x80) ? ((buf[0] & 0x20) ? -256 : 255) : ((buf[0] & 0x20) ? ((int16_t)buf[2] - 256) : buf[2]);
+
+    if((btns != last_btns) && !sched_full()) { // The caller checks for room, a change is never lost
+        SchedBtn *chg = &btn_queue[btn_head];
+
+        // What moved before the change moved with the old buttons, the policy leaves it alone:
+        // it is what puts a click where it happened
+        chg->btns = btns;
+        chg->x = acc_x;
+        chg->y = acc_y;
+        acc_x = acc_y = 0;
+
+        btn_head = (btn_head + 1) & (SCHED_BTN_QUEUE_SIZE - 1);
+        last_btns = btns;
+
+        if(sched_full()) stats.btn_full = sched_count(stats.btn_full, 1);
+    }
+
+    if(acc_x || acc_y) { // Movement from the previous reports is still waiting
+        if((out_policy == SCHED_FRESHEST) || ((out_policy == SCHED_BOUNDED) && ((now - acc_time) > out_max_lag))) {
+            stats.dropped = sched_count(stats.dropped, 1);
+            stats.dropped_counts = sched_count(stats.dropped_counts, ((acc_x < 0) ? -acc_x : acc_x) + ((acc_y < 0) ? -acc_y : acc_y));
+            acc_x = acc_y = 0;
+        } else if(x || y) stats.merged = sched_count(stats.merged, 1);
+    }
+
+    if(!acc_x && !acc_y) acc_time = now;
+
+    acc_x = sched_add(acc_x, x);
+    acc_y = sched_add(acc_y, y);
+
+    if(has_wheel) motion_wheel_add(buf, has_five_btns);
+}
+
+uint8_t sched_pending(void) {
+    return (btn_head != btn_tail) || acc_x || acc_y || (has_wheel && motion_wheel_pending());
+}
+
+uint8_t sched_full(void) {
+    return ((btn_head + 1) & (SCHED_BTN_QUEUE_SIZE - 1)) == btn_tail;
+}
+
+// What a serial packet carries of an accumulated movement
+static int16_t sched_clamp(int16_t acc) {
+    if(acc < -SER_DELTA_MAX) return -SER_DELTA_MAX;
+    else if(acc > SER_DELTA_MAX) return SER_DELTA_MAX;
+    else return acc;
+}
+
+void sched_next(uint8_t *buf) {
+    SchedBtn *src = NULL; // Where the movement for this packet comes from, NULL for the accumulator
+    int16_t x, y;
+
+    if(btn_head != btn_tail) {
+        SchedBtn *chg = &btn_queue[btn_tail];
+
+        if(chg->x || chg->y) src = chg; // The movement before the change goes first, with the buttons the host has
+        else { // Button changes go one per packet, with what moved after them, up to the next change
+            sent_btns = chg->btns;
+            btn_tail = (btn_tail + 1) & (SCHED_BTN_QUEUE_SIZE - 1);
+
+            if(btn_head != btn_tail) src = &btn_queue[btn_tail];
+        }
+    }
+
+    // As much as a serial packet carries, the rest stays
+    if(src) {
+        x = sched_clamp(src->x);
+        y = sched_clamp(src->y);
+        src->x -= x;
+        src->y -= y;
+    } else {
+        x = sched_clamp(acc_x);
+        y = sched_clamp(acc_y);
+        acc_x -= x;
+        acc_y -= y;
+    }
+
+    buf[0] = 0x08 | (sent_btns & (PS2_BTN_LEFT | PS2_BTN_RIGHT | PS2_BTN_MIDDLE));
+    if(x < 0) buf[0] |= 0x10;
+    if(y < 0) buf[0] |= 0x20;
+    buf[1] = x & 0xFF;
+    buf[2] = y & 0xFF;
+    buf[3] = has_five_btns ? ((sent_btns & (PS2_BTN_4TH | PS2_BTN_5TH)) << 1) : 0x00;
+
+    if(has_wheel) motion_wheel_take(buf, has_five_btns);
+}
@@ -0,0 +1,73 @@
+#ifndef _SCHED_HEADER_
+#define _SCHED_HEADER_
+
+#include <stdint.h>
+
+// Button changes waiting for a packet of their own, must be a power of 2
+#ifndef SCHED_BTN_QUEUE_SIZE
+#define SCHED_BTN_QUEUE_SIZE 8
+#endif
+
+// What to do with movement that could not be sent yet when a new report comes in
+#define SCHED_LOSSLESS 0 // Accumulate everything
+#define SCHED_FRESHEST 1 // Drop it, only the newest movement is sent
+#define SCHED_BOUNDED 2 // Accumulate, but drop it once it's older than the lag limit
+#define SCHED_POLICY_COUNT 3
+
+// Lag limits for SCHED_BOUNDED, in ms
+#define SCHED_LAG_MIN 10
+#define SCHED_LAG_MAX 255
+
+// What the output policy did, the counters stop at their maximum
+typedef struct {
+    uint16_t merged; // Reports added to movement that was still waiting
+    uint16_t dropped; // Times waiting movement was thrown away
+    uint16_t dropped_counts; // Movement thrown away, in counts (X and Y summed)
+    uint16_t btn_full; // Times the button queue filled up, holding back the PS/2 reports
+    uint16_t clamped; // Movement lost at the accumulator limit, in counts (X and Y summed)
+} SchedStats;
+
+/**
+ * Selects the output policy
+ * @param policy One of SCHED_LOSSLESS, SCHED_FRESHEST or SCHED_BOUNDED
+ * @param max_lag Lag limit for SCHED_BOUNDED, in ms
+ */
+void sched_setpolicy(uint8_t policy, uint8_t max_lag);
+
+// Statistics of the output policy
+const SchedStats *sched_stats(void);
+// Check if the statistics changed since the last time it was asked
+uint8_t sched_stats_changed(void);
+
+/**
+ * Drops everything waiting to be sent
+ * @param five_btns If not 0, the reports come from an Intellimouse Explorer compatible mouse
+ * @param wheel If not 0, the serial protocol carries the wheel
+ */
+void sched_reset(uint8_t five_btns, uint8_t wheel);
+
+/**
+ * Takes in a PS/2 mouse report. Movement is handled according to the output policy, every change of
+ * the buttons is queued so it gets a serial packet of its own, along with the movement made before it.
+ * Wheel movement is always accumulated.
+ * Never call it while sched_full() is 1: button changes are never merged, the report has to wait.
+ * @param buf Pointer to a 4-byte uint8_t buffer that contains the PS/2 mouse packet
+ * @param now Current time, in ms
+ */
+void sched_report(const uint8_t *buf, uint32_t now);
+
+// Check if there is something to send
+uint8_t sched_pending(void);
+
+// Check if the button queue is full: leave the next report in the PS/2 receive buffer until a packet is sent
+uint8_t sched_full(void);
+
+/**
+ * Builds the report to send in the next transmit slot: the oldest queued button change comes first,
+ * after the movement made before it, with the previous buttons. A change carries the movement made after it,
+ * up to the next change. Movement is taken as much as a serial packet can carry, the rest stays.
+ * @param buf Pointer to a 4-byte uint8_t buffer that will contain the report, in PS/2 format
+ */
+void sched_next(uint8_t *buf);
+
+#endif /* _SCHED_HEADER_ */
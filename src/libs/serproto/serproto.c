@@ -0,0 +1,153 @@
+#include <avr/pgmspace.h>
+
+#include "serproto.h"
+#include "pconfig.h"
+#include "uart_baud.h"
+
+#include "pnp_ids.h" // Generated at build time from src/pnp_ids.def
+
+#define MSYS_BTNS (PS2_BTN_LEFT | PS2_BTN_RIGHT | PS2_BTN_MIDDLE)
+
+static uint8_t encodeMSWheel(const uint8_t *src, uint8_t *dst, SerEncState *st);
+#if ENABLE_PROTO_MS
+static uint8_t encodeMS(const uint8_t *src, uint8_t *dst, SerEncState *st);
+#endif
+#if ENABLE_PROTO_MSYS
+static uint8_t encodeMSys(const uint8_t *src, uint8_t *dst, SerEncState *st);
+#endif
+#if ENABLE_PROTO_LOGI
+static uint8_t encodeLogi(const uint8_t *src, uint8_t *dst, SerEncState *st);
+#endif
+#if ENABLE_PROTO_LOGIWHL
+static uint8_t encodeLogiWheel(const uint8_t *src, uint8_t *dst, SerEncState *st);
+#endif
+#if ENABLE_PROTO_MM
+static uint8_t encodeMM(const uint8_t *src, uint8_t *dst, SerEncState *st);
+#endif
+
+// Legacy identification strings
+static const uint8_t ident_mswheel[] PROGMEM = { 'M', 'Z', '@', 0x00, 0x00, 0x00 };
+#if ENABLE_PROTO_MS
+static const uint8_t ident_ms[] PROGMEM = { 'M' };
+#endif
+#if ENABLE_PROTO_LOGI
+static const uint8_t ident_logi[] PROGMEM = { 'M', '3' };
+#endif
+
+// The first entry is the fallback protocol. Mouse Systems and MM series mice do not identify themselves.
+static const SerProto proto_table[] PROGMEM = {
+    { CFG_PROTO_MSWHEEL, encodeMSWheel, ident_mswheel, sizeof(ident_mswheel), pnp_id_mswheel, sizeof(pnp_id_mswheel),
+      UART_FMT_8N1, SER_MSWHL_PKT_SIZE, SERPROTO_WHEEL },
+#if ENABLE_PROTO_MS
+    { CFG_PROTO_MS, encodeMS, ident_ms, sizeof(ident_ms), pnp_id_ms, sizeof(pnp_id_ms),
+      UART_FMT_8N1, SER_MS_PKT_SIZE, 0 },
+#endif
+#if ENABLE_PROTO_MSYS
+    { CFG_PROTO_MSYS, encodeMSys, NULL, 0, NULL, 0,
+      UART_FMT_8N1, SER_MSYS_PKT_SIZE, 0 },
+#endif
+#if ENABLE_PROTO_LOGI
+    { CFG_PROTO_LOGI, encodeLogi, ident_logi, sizeof(ident_logi), pnp_id_logi, sizeof(pnp_id_logi),
+      UART_FMT_8N1, SER_LOGI_PKT_SIZE, 0 },
+#endif
+#if ENABLE_PROTO_LOGIWHL
+    { CFG_PROTO_LOGIWHL, encodeLogiWheel, ident_mswheel, sizeof(ident_mswheel), pnp_id_logiwhl, sizeof(pnp_id_logiwhl),
+      UART_FMT_8N1, SER_LOGIWHL_PKT_SIZE, SERPROTO_WHEEL },
+#endif
+#if ENABLE_PROTO_MM
+    { CFG_PROTO_MM, encodeMM, NULL, 0, NULL, 0,
+      UART_FMT_8O1, SER_MM_PKT_SIZE, 0 },
+#endif
+};
+
+#define PROTO_TABLE_SIZE (sizeof(proto_table) / sizeof(proto_table[0]))
+
+// Position of a protocol in the table, PROTO_TABLE_SIZE if it is not there
+static uint8_t serproto_find(uint8_t id) {
+    uint8_t idx;
+
+    for(idx = 0; idx < PROTO_TABLE_SIZE; idx++) {
+        if(pgm_read_byte(&proto_table[idx].id) == id) break;
+    }
+
+    return idx;
+}
+
+uint8_t serproto_get(uint8_t id, SerProto *proto) {
+    uint8_t idx = serproto_find(id);
+
+    if(idx >= PROTO_TABLE_SIZE) return 0;
+
+    memcpy_P(proto, &proto_table[idx], sizeof(SerProto));
+
+    return 1;
+}
+
+uint8_t serproto_next(uint8_t id) {
+    uint8_t idx = serproto_find(id) + 1;
+
+    if(idx >= PROTO_TABLE_SIZE) idx = 0;
+
+    return pgm_read_byte(&proto_table[idx].id);
+}
+
+static uint8_t encodeMSWheel(const uint8_t *src, uint8_t *dst, SerEncState *st) {
+    return ps2bufToSer(src, dst) ? SER_MSWHL_PKT_SIZE : 0;
+}
+
+#if ENABLE_PROTO_MS
+static uint8_t encodeMS(const uint8_t *src, uint8_t *dst, SerEncState *st) {
+    return ps2bufToSer(src, dst) ? SER_MS_PKT_SIZE : 0; // The fourth byte is left out
+}
+#endif
+
+#if ENABLE_PROTO_MSYS
+// Mouse Systems packets carry two movement reports: pair consecutive PS/2 reports into a single packet,
+// but never hold back a button change, it goes out right away in a packet of its own
+static uint8_t encodeMSys(const uint8_t *src, uint8_t *dst, SerEncState *st) {
+    uint8_t btns = ps2bufBtns(src, st->five_btns);
+    uint8_t len = 0;
+
+    if(st->half && ((btns ^ st->prev_btns) & MSYS_BTNS)) { // Flush the pending half first
+        st->half = 0;
+        len = SER_MSYS_PKT_SIZE;
+    }
+
+    if(!ps2bufToMSys(src, dst + len, st->half)) return len;
+
+    if(st->half || ((btns ^ st->prev_btns) & MSYS_BTNS)) {
+        st->half = 0;
+        len += SER_MSYS_PKT_SIZE;
+    } else st->half = 1; // Wait for the next report to fill the second half
+
+    st->prev_btns = btns;
+
+    return len;
+}
+#endif
+
+#if ENABLE_PROTO_LOGI
+static uint8_t encodeLogi(const uint8_t *src, uint8_t *dst, SerEncState *st) {
+    uint8_t len = ps2bufToLogi(src, dst, st->prev_btns);
+
+    if(len) st->prev_btns = ps2bufBtns(src, st->five_btns);
+
+    return len;
+}
+#endif
+
+#if ENABLE_PROTO_LOGIWHL
+static uint8_t encodeLogiWheel(const uint8_t *src, uint8_t *dst, SerEncState *st) {
+    uint8_t len = ps2bufToLogiWheel(src, dst, st->prev_btns, st->five_btns);
+
+    if(len) st->prev_btns = ps2bufBtns(src, st->five_btns);
+
+    return len;
+}
+#endif
+
+#if ENABLE_PROTO_MM
+static uint8_t encodeMM(const uint8_t *src, uint8_t *dst, SerEncState *st) {
+    return ps2bufToMM(src, dst) ? SER_MM_PKT_SIZE : 0;
+}
+#endif
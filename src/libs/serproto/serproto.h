@@ -0,0 +1,55 @@
+#ifndef _SERPROTO_HEADER_
+#define _SERPROTO_HEADER_
+
+#include <stdint.h>
+
+#include "ps22ser.h"
+
+// Protocol flags
+#define SERPROTO_WHEEL 0x01 // The protocol reports the wheel, with 4 bits
+
+// State kept by the encoders between two PS/2 reports
+typedef struct {
+    uint8_t prev_btns; // Buttons (as returned by ps2bufBtns()) of the last encoded packet
+    uint8_t five_btns; // If not 0, the reports come from an Intellimouse Explorer compatible mouse
+    uint8_t half; // If 1, a Mouse Systems packet is half-filled in the destination buffer, waiting for its second half
+} SerEncState;
+
+/**
+ * Converts a PS/2 report into the serial protocol.
+ * @param src Pointer to a 4-byte uint8_t buffer that contains the PS/2 mouse packet
+ * @param dst Pointer to a SER_MAX_PKT_SIZE uint8_t buffer that will contain the serial data
+ * @param st Encoder state, updated by the call
+ * @return Number of bytes to transmit from dst, 0 if there is nothing to transmit now
+ */
+typedef uint8_t (*ser_encoder_t)(const uint8_t *src, uint8_t *dst, SerEncState *st);
+
+// Protocol descriptor
+typedef struct {
+    uint8_t id; // One of the CFG_PROTO_* values
+    ser_encoder_t encode;
+    const uint8_t *ident; // Legacy identification sent when RTS is toggled, in PROGMEM and without the msb set
+    uint8_t ident_len;
+    const uint8_t *pnp_id; // Plug and Play COM ID (see src/pnp_ids.def) following the legacy one, in PROGMEM
+    uint8_t pnp_id_len;
+    uint8_t format; // Frame format, one of uart_format_t
+    uint8_t pkt_size; // Size of a packet without the optional bytes
+    uint8_t flags; // SERPROTO_* flags
+} SerProto;
+
+/**
+ * Looks up a protocol in the descriptor table
+ * @param id One of the CFG_PROTO_* values
+ * @param proto Pointer to a SerProto struct that will receive a copy of the descriptor
+ * @return 1 if the protocol is built into the firmware, 0 otherwise (proto is left untouched)
+ */
+uint8_t serproto_get(uint8_t id, SerProto *proto);
+
+/**
+ * Finds the protocol that follows another one, to cycle through the ones built into the firmware
+ * @param id One of the CFG_PROTO_* values
+ * @return The next protocol in the descriptor table, the first one after the last
+ */
+uint8_t serproto_next(uint8_t id);
+
+#endif /* _SERPROTO_HEADER_ */
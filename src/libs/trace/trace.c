@@ -0,0 +1,57 @@
+#include "trace.h"
+
+#if ENABLE_TRACE
+
+#include <stddef.h>
+
+#include "hal.h"
+#include "millis.h"
+
+// Records the ring holds, must be a power of 2
+#ifndef TRACE_BUFFER_LEN
+#define TRACE_BUFFER_LEN 16
+#endif
+
+#if (TRACE_BUFFER_LEN & (TRACE_BUFFER_LEN - 1))
+#error "TRACE_BUFFER_LEN must be a power of 2"
+#endif
+
+static volatile uint8_t buf[TRACE_BUFFER_LEN * TRACE_REC_SIZE];
+
+RecRing trace_ring = RECRING_INIT(buf, TRACE_REC_SIZE, TRACE_BUFFER_LEN, TRACE_LOST);
+
+void trace_start(uint8_t to) {
+    recring_start(&trace_ring, to);
+}
+
+void trace_stop(void) {
+    recring_stop(&trace_ring);
+}
+
+void trace_put(uint8_t type, uint8_t data) {
+    HAL_ATOMIC {
+        volatile uint8_t *rec = recring_alloc(&trace_ring);
+
+        if(rec != NULL) {
+            uint16_t stamp = millis_stamp();
+
+            rec[0] = TRACE_SYNC | type;
+            rec[1] = data;
+            rec[2] = stamp & 0xFF;
+            rec[3] = stamp >> 8;
+            recring_commit(&trace_ring);
+        }
+    }
+}
+
+void trace_flush(uint32_t now) {
+    if(recring_idle(&trace_ring, now, TRACE_TICK_MS)) trace_put(TRACE_TICK, 0);
+
+    recring_flush(&trace_ring, now);
+}
+
+void trace_drain(void) {
+    recring_drain(&trace_ring);
+}
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef _TRACE_HEADER_
+#define _TRACE_HEADER_
+
+// PS/2 trace capture: while it runs, every byte on the PS/2 lines goes out of the serial port as a
+// compact binary record, at a speed a real mouse stream fits in, instead of the mouse reports.
+//
+// Every record is TRACE_REC_SIZE bytes:
+//   0  TRACE_SYNC in the high nibble, TRACE_LOST if records were lost before this one, the type (TRACE_*) in the low bits
+//   1  Data: the PS/2 byte, the bits received so far for the errors, 0 for the events
+//   2  Time, see millis_stamp(): 8 us units from Timer1, little-endian. It wraps around every 524 ms,
+//      TRACE_TICK records keep the gaps between records shorter than that
+//
+// Records are queued by the ISRs into a RAM ring and moved to the UART by the main loop, only as
+// room frees up in the transmit buffer: the capture never stalls the PS/2 side. When the ring is full
+// new records are dropped, and the next one that fits carries TRACE_LOST. See recring.h.
+
+#include <stdint.h>
+
+#include "recring.h"
+
+// Built into the firmware, the Makefiles set it to 0 to leave it out
+#ifndef ENABLE_TRACE
+#define ENABLE_TRACE 1
+#endif
+
+#define TRACE_REC_SIZE 4
+
+#define TRACE_SYNC 0xA0
+#define TRACE_SYNC_MASK 0xF0
+#define TRACE_LOST 0x08
+#define TRACE_TYPE_MASK 0x07
+
+// Record types
+#define TRACE_PS2_RX 0 // Byte received from the mouse
+#define TRACE_PS2_PARITY 1 // Byte received from the mouse with a wrong parity bit
+#define TRACE_PS2_FRAME 2 // Bad start or stop bit, the data holds the bits received until then
+#define TRACE_PS2_TX 3 // Byte sent to the mouse
+#define TRACE_RTS 4 // RTS toggled by the host
+#define TRACE_SLEEP 5 // The board goes to sleep
+#define TRACE_WAKE 6 // The board woke up
+#define TRACE_TICK 7 // Nothing happened, sent every TRACE_TICK_MS
+
+#define TRACE_TICK_MS 250
+
+// Where the capture goes, trace_on is 0 when it's not running
+#define TRACE_ON_UART RECRING_ON_UART
+#define TRACE_ON_DIAG RECRING_ON_DIAG // The diagnostic output, see diag.h
+
+#if ENABLE_TRACE
+extern RecRing trace_ring;
+#define trace_on (trace_ring.on)
+#else
+#define trace_on 0 // Left out, never running: what checks it goes away
+#endif
+
+// Queue a record if the capture is running. Cheap enough for the ISRs.
+#define TRACE(type, data) do { if(trace_on) trace_put((type), (data)); } while(0)
+
+#if ENABLE_TRACE
+/**
+ * Start the capture, clearing what might be left from the last one
+ * @param to TRACE_ON_UART or TRACE_ON_DIAG
+ */
+void trace_start(uint8_t to);
+// Stop the capture, dropping the records not sent yet
+void trace_stop(void);
+
+/**
+ * Queue a record, stamped now. Safe to call from an ISR.
+ * @param type One of the record types
+ * @param data Data byte
+ */
+void trace_put(uint8_t type, uint8_t data);
+
+/**
+ * Moves whole records to the output, as long as it has room for them. Never waits.
+ * Sends a TRACE_TICK when nothing was sent for TRACE_TICK_MS.
+ * @param now Current millis()
+ */
+void trace_flush(uint32_t now);
+
+// Sends everything queued and waits for it to leave the output, e.g. before sleeping
+void trace_drain(void);
+#else
+static inline void trace_start(uint8_t to) { }
+static inline void trace_stop(void) { }
+static inline void trace_put(uint8_t type, uint8_t data) { }
+static inline void trace_flush(uint32_t now) { }
+static inline void trace_drain(void) { }
+#endif
+
+#endif /* _TRACE_HEADER_ */
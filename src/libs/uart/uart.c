@@ -1,134 +1,193 @@
-#include <avr/io.h>
-#include <stdio.h>
+#include <avr/pgmspace.h>
 
-#ifndef BAUD
-#define BAUD 1200
+// Buffer sizes, must be powers of 2
+#ifndef UART_RX_BUFFER_SIZE
+#define UART_RX_BUFFER_SIZE 16
+#endif
+#ifndef UART_TX_BUFFER_SIZE
+#define UART_TX_BUFFER_SIZE 32
 #endif
 
-#include <util/setbaud.h>
+#if (UART_RX_BUFFER_SIZE & (UART_RX_BUFFER_SIZE - 1)) || (UART_TX_BUFFER_SIZE & (UART_TX_BUFFER_SIZE - 1))
+#error "UART buffer sizes must be powers of 2"
+#endif
 
 /* http://www.cs.mun.ca/~rod/Winter2007/4723/notes/serial/serial.html */
 
-#include "common/defines.h"
-
-#if defined(__SECOND_UART__)
-#define UART_NUMBER 1
+#include "hal.h"
+#include "uart.h"
+#include "perf.h"
+#include "millis.h"
+
+// UBRR values for every speed in uart_baud_t, the MSB is set when the U2X bit is needed.
+// All the values are within 0.2% of the nominal speed.
+#define UBRR_U2X 0x8000
+#if (F_CPU==16000000)
+static const uint16_t ubrr_table[UART_BAUD_COUNT + 1] PROGMEM = { 832, // 1200
+                                                                  416, // 2400
+                                                                  207, // 4800
+                                                                  103, // 9600
+                                                                  3    // 250000
+                                                                };
+#elif (F_CPU==8000000)
+static const uint16_t ubrr_table[UART_BAUD_COUNT + 1] PROGMEM = { 416, // 1200
+                                                                  207, // 2400
+                                                                  103, // 4800
+                                                                  51,  // 9600
+                                                                  1    // 250000
+                                                                };
 #else
-#define UART_NUMBER 0
+#error "No UBRR table for this F_CPU"
 #endif
 
-#if defined(__AVR_AT90Tiny2313__) | defined(__AVR_ATtiny2313__) | defined(__AVR_ATtiny4313__)
-#define UART_UBRRH UBRRH
-#define UART_UBRRL UBRRL
+static uart_baud_t cur_baud = UART_BAUD_1200;
+static uart_format_t cur_fmt = UART_FMT_8N1;
+static volatile uint8_t tx_started = 0; // Set after the first transmission, before that TXC will never be set
 
-#define UART_UCSRA UCSRA
-#define UART_UCSRC UCSRC
-#define UART_UCSRB UCSRB
+static volatile uint8_t rx_head;                        // RX buffer head offset, written by the ISR
+static volatile uint8_t rx_tail;                        // RX buffer tail offset
+static volatile uint8_t rx_buf[UART_RX_BUFFER_SIZE];    // RX buffer
 
-#define UART_RXEN RXEN
-#define UART_TXEN TXEN
+static volatile uint8_t tx_head;                        // TX buffer head offset
+static volatile uint8_t tx_tail;                        // TX buffer tail offset, written by the ISR
+static volatile uint8_t tx_buf[UART_TX_BUFFER_SIZE];    // TX buffer
+#if ENABLE_PERF
+static volatile uint16_t tx_drained;                    // When the last byte in the buffer was moved to the UART
+#endif
 
-#define UART_UCSZ0 UCSZ0
-#define UART_UCSZ1 UCSZ1
+static void uart_tx_next(void);
+void uart_init(void) {
+    rx_head = rx_tail = 0;
+    tx_head = tx_tail = 0;
 
-#define UART_UDR UDR
+    uart_setbaud(UART_BAUD_1200);
+    uart_setformat(UART_FMT_8N1);
+}
 
-#define UART_UDRE UDRE
+void uart_setformat(uart_format_t fmt) {
+    uart_tx_drain(); // Do not mangle what's still to be sent
 
-#define UART_RXC RXC
+    cur_fmt = fmt;
+    hal_uart_setformat(fmt == UART_FMT_8O1);
+}
 
-#define UART_U2X U2X
+void uart_setbaud(uart_baud_t baud) {
+    uint16_t ubrr = pgm_read_word(&ubrr_table[baud]);
 
-#elif defined (__AVR_ATmega8A__)
+    cur_baud = baud;
 
-#define UART_UDR                UDR
-#define UART_UCSRA              token_paste2(UCSR, A)
-#define UART_UCSRB              token_paste2(UCSR, B)
-#define UART_UCSRC              token_paste2(UCSR, C)
-#define UART_UBRR               UBRR
-#define UART_UBRRL              token_paste2(UBRR, L)
-#define UART_UBRRH              token_paste2(UBRR, H)
-#define UART_U2X                U2X
+    // Let the last byte leave the shift register before changing speed
+    uart_tx_drain();
 
-#define UART_UDRE               UDRE
+    hal_uart_setbaud(ubrr & ~UBRR_U2X, (ubrr & UBRR_U2X) ? 1 : 0);
+}
 
-#define UART_RXC		RXC
+uart_baud_t uart_getbaud(void) {
+    return cur_baud;
+}
 
-#define UART_RXEN		RXEN
-#define UART_TXEN		TXEN
+void uart_enable(void) {
+    hal_uart_enable();
+}
 
-#define UART_UCSZ0              token_paste2(UCSZ, 0)
-#define UART_UCSZ1              token_paste2(UCSZ, 1)
+void uart_disable(void) {
+    hal_uart_disable();
+}
 
-#else // Not an ATTiny
+// Move the next byte from the TX buffer to the UART. UDRE must be set.
+static void uart_tx_next(void) {
+    if(tx_head == tx_tail) { // Nothing to send, we got here by mistake
+        hal_uart_tx_int(0);
+        return;
+    }
 
-#define UART_UDR                token_paste2(UDR, UART_NUMBER)
+    hal_uart_put(tx_buf[tx_tail]);
+#if ENABLE_PERF
+    if(((tx_tail + 1) & (UART_TX_BUFFER_SIZE - 1)) == tx_head) tx_drained = millis_stamp(); // Before the buffer looks empty
+#endif
+    tx_tail = (tx_tail + 1) & (UART_TX_BUFFER_SIZE - 1);
+    tx_started = 1;
 
-#undef UCSR
-#define UART_UCSRA              token_paste3(UCSR, UART_NUMBER, A)
-#define UART_UCSRB              token_paste3(UCSR, UART_NUMBER, B)
-#define UART_UCSRC              token_paste3(UCSR, UART_NUMBER, C)
-#define UART_UBRR               token_paste2(UBRR, UART_NUMBER)
-#define UART_UBRRL              token_paste3(UBRR, UART_NUMBER, L)
-#define UART_UBRRH              token_paste3(UBRR, UART_NUMBER, H)
+    if(tx_head == tx_tail) hal_uart_tx_int(0); // Nothing more to send
+}
 
-#define UART_U2X				token_paste2(U2X, UART_NUMBER)
+void uart_tx_drain(void) {
+    while(tx_head != tx_tail) {
+        // With interrupts disabled (e.g. called from an ISR) we have to push the bytes out by ourselves
+        if(!hal_irq_enabled() && hal_uart_tx_ready()) uart_tx_next();
+        hal_spin();
+    }
 
-#undef UDRE
-#define UART_UDRE				token_paste2(UDRE, UART_NUMBER)
+    if(tx_started) {
+        while(!hal_uart_tx_done()) hal_spin();
+    }
+}
 
-#undef RXC
-#define UART_RXC				token_paste2(RXC, UART_NUMBER)
+void uart_putbyte(uint8_t b) {
+    uint8_t next_head = (tx_head + 1) & (UART_TX_BUFFER_SIZE - 1);
 
-#undef RXEN
-#undef TXEN
-#define UART_RXEN				token_paste2(RXEN, UART_NUMBER)
-#define UART_TXEN				token_paste2(TXEN, UART_NUMBER)
+    while(next_head == tx_tail) { // Buffer full, wait for a free slot
+        if(!hal_irq_enabled() && hal_uart_tx_ready()) uart_tx_next();
+        hal_spin();
+    }
 
-#undef UCSZ
-#define UART_UCSZ0              token_paste3(UCSZ, UART_NUMBER, 0)
-#define UART_UCSZ1              token_paste3(UCSZ, UART_NUMBER, 1)
+    tx_buf[tx_head] = b;
+    tx_head = next_head;
+    PERF_HWM(ser_hwm, (uint8_t)(tx_head - tx_tail) & (UART_TX_BUFFER_SIZE - 1));
 
-#endif
+    HAL_ATOMIC {
+        hal_uart_tx_int(1); // Start transmitting, if we were not already doing it
+    }
+}
 
-void uart_init(void) {
-    UART_UBRRH = UBRRH_VALUE;
-    UART_UBRRL = UBRRL_VALUE;
+void uart_tx_discard(void) {
+    HAL_ATOMIC {
+        hal_uart_tx_int(0);
+        tx_head = tx_tail; // The byte already in the UART will still complete
+    }
+}
 
-#if USE_2X
-    UART_UCSRA |= (1 << UART_U2X);
-#else
-    UART_UCSRA &= ~_BV(UART_U2X);
-#endif
+uint8_t uart_tx_free(void) {
+    return (tx_tail - tx_head - 1) & (UART_TX_BUFFER_SIZE - 1);
+}
 
-#if defined (__AVR_ATmega8A__)
-    // ATMega8A requires the msb to be set to 1, otherwise UBRRH is selected
-    UART_UCSRC = 0x80 | _BV(UART_UCSZ1) | _BV(UART_UCSZ0); /* 8-bit data */
-#else
-    UART_UCSRC = _BV(UART_UCSZ1) | _BV(UART_UCSZ0); /* 8-bit data */
-#endif
+uint8_t uart_tx_empty(void) {
+    return tx_head == tx_tail;
 }
 
-void uart_enable(void) {
-    UART_UCSRB = _BV(UART_RXEN) | _BV(UART_TXEN);   /* Enable RX and TX */
+#if ENABLE_PERF
+uint16_t uart_tx_end_stamp(void) {
+    uint8_t frame_bits = (cur_fmt == UART_FMT_8O1) ? 11 : 10;
+    uint32_t bps = (cur_baud == UART_BAUD_250000) ? 250000UL : (1200UL << cur_baud);
+
+    // The last byte was loaded when the one before it started shifting out, so two frames go by
+    return tx_drained + (uint16_t)((2UL * frame_bits * (1000000UL / MILLIS_STAMP_US)) / bps);
 }
+#endif
 
-void uart_disable(void) {
-    UART_UCSRB = 0;   /* Disable RX and TX */
+uint8_t uart_avail(void) {
+    return rx_head != rx_tail;
 }
 
-int uart_putchar(char c, FILE *stream) {
-    if (c == '\n') {
-        uart_putchar('\r', stream);
-    }
-    loop_until_bit_is_set(UART_UCSRA, UART_UDRE);
-    UART_UDR = c;
+uint8_t uart_getbyte(void) {
+    uint8_t result = rx_buf[rx_tail];
+    rx_tail = (rx_tail + 1) & (UART_RX_BUFFER_SIZE - 1);
 
-    return 0;
+    return result;
 }
 
-int uart_getchar(FILE *stream) {
-    loop_until_bit_is_set(UART_UCSRA, UART_RXC);
+HAL_ISR(HAL_VECT_UART_RX) {
+    uint8_t data = hal_uart_get();
+    uint8_t next_head = (rx_head + 1) & (UART_RX_BUFFER_SIZE - 1);
+
+    if(next_head != rx_tail) { // If the buffer is full, the byte is dropped
+        rx_buf[rx_head] = data;
+        rx_head = next_head;
+    } else {
+        PERF_INC(host_overflow);
+    }
+}
 
-    return UART_UDR;
+HAL_ISR(HAL_VECT_UART_UDRE) {
+    uart_tx_next();
 }
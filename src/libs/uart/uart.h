@@ -1,16 +1,37 @@
 #ifndef _UART_HEADER_
 #define _UART_HEADER_
 
-int uart_putchar(char c, FILE *stream);
-int uart_getchar(FILE *stream);
+#include <stdint.h>
+
+#include "uart_baud.h"
+
+// Queue a raw byte for transmission. Waits only if the transmit buffer is full.
+void uart_putbyte(uint8_t b);
+// Number of bytes that can be queued without waiting
+uint8_t uart_tx_free(void);
+// Check if the transmit buffer is empty
+uint8_t uart_tx_empty(void);
+// When the last stop bit of what was in the transmit buffer goes out, see millis_stamp().
+// Only valid once uart_tx_empty() is true, for transmissions of at least two bytes. Built with the performance counters.
+uint16_t uart_tx_end_stamp(void);
+// Wait until everything in the transmit buffer has been completely transmitted, the last stop bit included
+void uart_tx_drain(void);
+// Throw away everything still waiting in the transmit buffer
+void uart_tx_discard(void);
+
+// Check if a byte was received from the host. Received bytes are buffered in background.
+uint8_t uart_avail(void);
+// Get the received byte. uart_avail() must be checked before doing so.
+uint8_t uart_getbyte(void);
 
 void uart_init(void);
+// Change the serial speed, after waiting for the transmission in progress to complete
+void uart_setbaud(uart_baud_t baud);
+// Current serial speed
+uart_baud_t uart_getbaud(void);
+// Change the frame format, after waiting for the transmission in progress to complete
+void uart_setformat(uart_format_t fmt);
 void uart_enable(void);
 void uart_disable(void);
 
-/* http://www.ermicro.com/blog/?p=325 */
-
-FILE uart_output = FDEV_SETUP_STREAM(uart_putchar, NULL, _FDEV_SETUP_WRITE);
-FILE uart_input = FDEV_SETUP_STREAM(NULL, uart_getchar, _FDEV_SETUP_READ);
-
 #endif
@@ -0,0 +1,20 @@
+#ifndef _UART_BAUD_HEADER_
+#define _UART_BAUD_HEADER_
+
+// Serial speeds supported by uart_setbaud()
+typedef enum {
+    UART_BAUD_1200 = 0,
+    UART_BAUD_2400,
+    UART_BAUD_4800,
+    UART_BAUD_9600,
+    UART_BAUD_COUNT, // Speeds a serial mouse host can select
+    UART_BAUD_250000 = UART_BAUD_COUNT // PS/2 trace capture only, exact with both crystals
+} uart_baud_t;
+
+// Frame formats supported by uart_setformat()
+typedef enum {
+    UART_FMT_8N1 = 0,
+    UART_FMT_8O1
+} uart_format_t;
+
+#endif /* _UART_BAUD_HEADER_ */
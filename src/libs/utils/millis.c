@@ -1,7 +1,9 @@
 #include "millis.h"
 
-#include <avr/interrupt.h>
-#include <util/atomic.h>
+#include "hal.h"
+
+#define TICKS_PER_MS (F_CPU / 1000 / 8) // Timer1 runs at F_CPU / 8
+#define TICKS_PER_STAMP (TICKS_PER_MS * MILLIS_STAMP_US / 1000)
 
 static volatile uint32_t millis_counter;
 
@@ -10,33 +12,35 @@ void millis_init(void) {
     
     millis_counter = 0; // Clear the millisecond counter
 
-    // Clear timer when the count matches ctc_match_overflow, and set clock divider by 8
-    TCCR1B |= (1 << WGM12) | (1 << CS11);
-  
-    // Load the value for the timer
-    OCR1AH = ctc_match_overflow >> 8;
-    OCR1AL = ctc_match_overflow & 0xFF;
- 
-    // Enable compare-match interrupt
-#if defined (__AVR_ATmega328P__)
-    TIMSK1 |= (1 << OCIE1A);
-#elif defined (__AVR_ATmega8A__)
-    TIMSK |= (1 << OCIE1A);
-#endif
+    hal_millis_init(ctc_match_overflow);
 }
 
 uint32_t millis(void) {
     uint32_t rval;
  
     // Execute this atomically
-    ATOMIC_BLOCK(ATOMIC_FORCEON) {
+    HAL_ATOMIC {
         rval = millis_counter;
     }
 
     return rval;
 } 
 
+uint16_t millis_stamp(void) {
+    uint16_t ms, ticks;
+
+    HAL_ATOMIC {
+        ms = millis_counter;
+        ticks = hal_millis_count();
+
+        // The counter was cleared, but the interrupt counting that millisecond did not run yet
+        if(hal_millis_pending() && (ticks < (TICKS_PER_MS / 2))) ms++;
+    }
+
+    return (ms * (1000 / MILLIS_STAMP_US)) + (ticks / TICKS_PER_STAMP);
+}
+
 // Handler for the timer interrupt
-ISR(TIMER1_COMPA_vect) {
+HAL_ISR(HAL_VECT_MILLIS) {
     millis_counter++;  
 }
\ No newline at end of file
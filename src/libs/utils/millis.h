@@ -6,4 +6,11 @@
 void millis_init(void);
 uint32_t millis(void);
 
+// Resolution of millis_stamp(), in us
+#define MILLIS_STAMP_US 8
+
+// Fine timestamp for latency measurements, in MILLIS_STAMP_US units, taken from the Timer1 counter.
+// It wraps around every 524 ms, so only differences between close stamps make sense. Safe to call from an ISR.
+uint16_t millis_stamp(void);
+
 #endif /* _MILLIS_H */
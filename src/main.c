@@ -1,37 +1,44 @@
 #include <stdint.h>
-#include <stdio.h>
 #include <stdlib.h>
 
-#include <util/delay.h>
-
-#include <avr/io.h>
-#include <avr/wdt.h>
-#include <avr/interrupt.h>
-#include <avr/sleep.h>
+#include <avr/pgmspace.h>
 
 #include "ioconfig.h"
+#include "hal.h"
 #include "ps2.h"
 #include "ps2_mouse.h"
 #include "ps22ser.h"
+#include "serproto.h"
+#include "motion.h"
+#include "sched.h"
+#include "perf.h"
 #include "pconfig.h"
+#include "hostcmd.h"
+#include "trace.h"
+#include "dlog.h"
+#include "diag.h"
 
 #include "uart.h"
 #include "millis.h"
 
 #include "main.h"
 
-#define VERSION "1.2.1"
+#define VERSION_MAJOR 1
+#define VERSION_MINOR 2
+#define VERSION_PATCH 1
 
 #define SLEEP_DELAY_TIME 180000 //  3 minutes without movement before we put the micro to sleep
 
 #define PS2_WHL_PKT_SIZE 4
 #define PS2_STD_PKT_SIZE 3
 
+#define MSYS_HALF_TIMEOUT 25 // Max time (ms) we keep a Mouse Systems packet half-filled waiting for the next PS/2 report
+
 typedef union {
     struct {
         uint8_t default_proto : 1; // if 1, default protocol is enabled, if 0, MS protocol is forced
         uint8_t powersave : 1; // if 1, we enable powersave after 2 minutes idle
-        uint8_t standard_mode : 1; // if 1, the board runs normally, if 0, the board enters debug mode
+        uint8_t standard_mode : 1; // if 1, the board runs normally, if 0, the board enters debug mode (see dlog.h)
         uint8_t wheel_detect : 1; // if 1, we try PS/2 wheel detection
         uint8_t unused : 2;
     } u;
@@ -45,89 +52,133 @@ static void blinkLED(uint8_t times, uint8_t fast); // Blink the led X times eith
 static void soft_reset(void);
 
 static void update_configuration(uint8_t buttons, ConfigStruct *cfg);
+static void loadSettings(const ConfigStruct *cfg);
 
-static void sendMSPkt(void);
-static void sendMSWheelPkt(void);
-static void sendDebugPkt(void);
+static void sendIdent(uint8_t debug);
+
+static void execHostCmd(const HostCmd *cmd, ConfigStruct *cfg);
+#if ENABLE_PERF
+static void takeStats(PerfStats *snap);
+#endif
+static uint8_t setProto(uint8_t new_proto);
+static void xmitSerPkt(const uint8_t *ps2_buf, const uint8_t *ser_buf, uint8_t len, uint8_t debug);
+static uint8_t scaleToQ44(uint16_t scale);
 
-static void sleepMode(uint8_t debug);
+static void sleepMode(void);
+
+#if ENABLE_DIAG_UART
+static void setDiag(uint8_t out);
+static void diagFeed(uint32_t now);
+#endif
 
 // Vars
-static volatile uint8_t rts_disable_xmit = 0;
-static void (* volatile sendDetectPkt)(void) = &sendMSWheelPkt;
+static volatile uint8_t rts_toggled = 0; // Set by the RTS interrupt, the host wants us to identify again
+static SerProto proto; // Serial protocol in use, the host can change it at runtime
+static SerEncState enc_state; // State of its encoder
+static uint8_t boot_proto = CFG_PROTO_MSWHEEL; // Serial protocol selected at boot
+static uint8_t poll_pending = 0; // If 1, the host asked for a report in prompt mode
+static uint8_t prompt_mode = 0; // If 1, the host asked for reports to be sent only on request
+static uint8_t ps2_res = 0; // Current PS/2 resolution
+static uint8_t ps2_rate = 0; // Current PS/2 sample rate
+static uint16_t scale_x = MOTION_SCALE_ONE, scale_y = MOTION_SCALE_ONE; // Current sensitivity, Q8.8
+static uint8_t accel = MOTION_ACCEL_NONE; // Current acceleration curve
+static uint8_t detents = MOTION_DETENTS_MIN; // Current wheel detents for every notch
+static uint8_t out_policy = SCHED_LOSSLESS, max_lag = 100; // Current output policy
+static uart_baud_t trace_baud; // Speed to go back to when the trace capture stops
+
+// Plug and Play identification still to be queued, it's fed to the serial port as room frees up
+static const uint8_t *pnp_id_ptr = NULL;
+static uint8_t pnp_id_left = 0;
+
+// Performance counters still to be sent to the host, fed to the serial port the same way
+#if ENABLE_PERF
+static PerfStats perf_snap;
+#endif
+static const uint8_t *perf_ptr = NULL;
+static uint8_t perf_left = 0;
+
+#if ENABLE_DIAG_UART
+// What the diagnostic output carries (DIAG_OUT_*), and the counters still to be sent there. They have a snapshot
+// of their own: the host is never held off while they go out, and its *# never changes them halfway.
+static uint8_t diag_out = ENABLE_PERF ? DIAG_OUT_STATS : DIAG_OUT_NONE;
+static const uint8_t *diag_perf_ptr = NULL;
+static uint8_t diag_perf_left = 0;
+#if ENABLE_PERF
+static PerfStats diag_snap;
+static uint32_t diag_perf_time = 0; // When the counters were last sent there
+#endif
+#endif
+
+// Latency measurements, see millis_stamp()
+static uint16_t wait_stamp; // When the oldest report still in the scheduler came in from the mouse
+static uint16_t pkt_stamp; // When the oldest report in the packet being sent came in from the mouse
+static uint8_t pkt_stamped = 0; // If 1, pkt_stamp belongs to the packet being sent
+static uint8_t lat_pending = 0; // If 1, the latency of the packet being sent is measured once it has left
 
 int main(void) {
     HeaderOptions opts;
     ConfigStruct cfg;
 
-    uint8_t serial_pkt_buf[4]; // Buffer for serial packets
+    uint8_t serial_pkt_buf[SER_MAX_PKT_SIZE]; // Buffer for serial packets
     uint8_t ps2_pkt_buf[PS2_WHL_PKT_SIZE] = {0x00, 0x00, 0x00, 0x00}; // Buffer for ps/2 packets
+    uint8_t out_pkt_buf[PS2_WHL_PKT_SIZE]; // Report picked by the scheduler, in PS/2 format
     uint8_t converter_result; // Instanteneous result of the conversion
     uint8_t ps2_buf_counter = 0;
     uint8_t init_res = 0; // Init codes
     uint8_t ps2_pkt_size = 0;
 
-    uint8_t cfg_force_ms = 0;
+    HostCmd hcmd; // Last command received from the host
 
-#if defined (__AVR_ATmega328P__)
-    wdt_enable(WDTO_4S); // Enable the watchdog to reset in 4 seconds...
-#elif defined (__AVR_ATmega8A__)
-    wdt_enable(WDTO_2S); // Enable the watchdog to reset in 2 seconds...
-#endif
+    uint32_t msys_half_time = 0; // When the first half of a Mouse Systems packet was filled
+
+    hal_wdt_start(); // Enable the watchdog
 
     // Initialize the I/O and communications
     io_init();
 
     // Read the option header
-    opts.header = OPTPIN;
+    opts.header = hal_opt_read();
+    if(!ENABLE_DLOG) opts.u.standard_mode = 1; // No debug mode without the log
     // Read the config from EEPROM
     read_perm_config(&cfg);
     
     // Option header always wins over stored config
-    if(!opts.u.default_proto || cfg.cfg_data.c.proto) cfg_force_ms = 1; // We're enforcing simple Microsoft protocol
-    else cfg_force_ms = 0; // Enable mouse wheel protocol
+    if(!opts.u.default_proto) boot_proto = CFG_PROTO_MS; // We're enforcing simple Microsoft protocol
+    else boot_proto = cfg.cfg_data.c.proto;
 
-    // Set which type of identification code we'll send
-    if(!opts.u.standard_mode) sendDetectPkt = sendDebugPkt;
-    else if(cfg_force_ms) sendDetectPkt = sendMSPkt;
+    if(!serproto_get(boot_proto, &proto)) boot_proto = CFG_PROTO_MSWHEEL; // Not built into this firmware
 
     // Initialize RTS interrupt and PS2
     rts_init();
     ps2_init();
 
     // First watchdog kick
-    wdt_reset();
+    hal_wdt_kick();
 
     // Initialize serial port
     uart_init();
-    stdout = &uart_output;
-    stdin  = &uart_input;
+#if ENABLE_DIAG_UART
+    diag_init();
+#endif
 
     // Initialize millisecond counter
     millis_init();
 
     // Enable interrupts
-    sei();
-
-    // Clear some vars
-    rts_disable_xmit = 0;
+    hal_irq_enable();
 
     setLED(1); // Turn the LED on
 
+    setProto(boot_proto); // Set the frame format
     uart_enable();
 
-    if(!opts.u.standard_mode) {
-        wdt_reset();
-        printf(" Board initialized! - %s\n", VERSION);
-        printf(" -- hdr -> proto:%u standard:%u pwrsave:%u wheel:%u\n", opts.u.default_proto, opts.u.standard_mode, opts.u.powersave, opts.u.wheel_detect);
-        printf(" -- cfg -> proto:%u res:%u\n", cfg.cfg_data.c.proto, cfg.cfg_data.c.res);
-        printf(" -- Initializing PS/2 Mouse\n");
-        wdt_reset();
+    if(!opts.u.standard_mode) { // Debug mode: the serial port carries the debug log
+        dlog_start(DLOG_ON_UART);
+        DLOG(DLOG_BOOT, VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH, opts.header, 0);
+        DLOG(DLOG_CONFIG, cfg.cfg_data.c.proto, cfg.cfg_data.c.res, 0, 0, 0);
     }
 
     init_res = mouse_init(cfg.cfg_data.c.res, opts.u.wheel_detect); // Initialize the mouse
-
-    if(!opts.u.standard_mode) printf(" -- Initializing result %02X\n", init_res);
     
     // Check if we need to update the configuration
     update_configuration(init_res & MOUSE_BTN_MASK, &cfg);
@@ -136,7 +187,19 @@ int main(void) {
     if(init_res & MOUSE_EXT_MASK) ps2_pkt_size = PS2_WHL_PKT_SIZE;
     else ps2_pkt_size = PS2_STD_PKT_SIZE;
 
-    wdt_reset(); // kick the watchdog again...
+    DLOG(DLOG_MOUSE_INIT, init_res, ps2_pkt_size, 0, 0, 0);
+
+    enc_state.five_btns = (init_res & MOUSE_5BTN_MASK) ? 1 : 0;
+    sched_reset(enc_state.five_btns, proto.flags & SERPROTO_WHEEL);
+
+    ps2_res = cfg.cfg_data.c.res;
+    ps2_rate = opts.u.wheel_detect ? 80 : 100; // Detection sequences leave the mouse at 80 reports per second
+
+    const uint8_t boot_res = ps2_res, boot_rate = ps2_rate;
+
+    loadSettings(&cfg);
+
+    hal_wdt_kick(); // kick the watchdog again...
 
     // Notify which mouse we found
     if (init_res & MOUSE_ERR_MASK) blinkLED(2, 1);
@@ -150,45 +213,133 @@ int main(void) {
         now = millis();
         if(now < last_pkt_time) last_pkt_time = now; // Rollover...
 
-        wdt_reset(); // Kick the watchdog
+        hal_wdt_kick(); // Kick the watchdog
+
+        // Check if the host is asking for something. Not while the counters are going out, the replies would end up
+        // in the middle or the snapshot would change under them
+        while(ENABLE_HOSTCMD && !perf_left && uart_avail()) {
+            if(hostcmd_feed(uart_getbyte(), &hcmd)) execHostCmd(&hcmd, &cfg);
+            last_pkt_time = now;
+        }
+
+        // While capturing a trace the toggle is only recorded, the board stays at the capture speed
+        if(rts_toggled && (trace_on == TRACE_ON_UART)) rts_toggled = 0;
+
+        // The host toggled RTS: a real mouse would lose power here, so go back to the default speed and protocol,
+        // identify ourselves again and undo what the host changed on the mouse
+        if(rts_toggled) {
+            rts_toggled = 0;
+
+            if(dlog_on != DLOG_ON_UART) uart_tx_discard(); // Whatever was still queued means nothing to the host now, but the log must stay whole
+            perf_left = 0;
+            lat_pending = 0;
+            uart_setbaud(UART_BAUD_1200);
+            if(proto.id != boot_proto) setProto(boot_proto);
+            hostcmd_reset();
+
+            sendIdent(!opts.u.standard_mode);
+
+            if(ENABLE_HOSTCMD && (prompt_mode || (ps2_rate != boot_rate))) { // Without the commands the host changed nothing
+                prompt_mode = 0;
+                ps2_rate = boot_rate;
+                mouse_setrate(ps2_rate);
+            }
+            if(ENABLE_HOSTCMD && (ps2_res != boot_res)) {
+                ps2_res = boot_res;
+                mouse_setres(ps2_res);
+            }
+
+            loadSettings(&cfg); // Undo what the host changed
+
+            ps2_buf_counter = 0;
+            enc_state.half = 0;
+            sched_reset(enc_state.five_btns, proto.flags & SERPROTO_WHEEL); // Nothing from before the reset is of any use
+        }
+
+        // Keep the Plug and Play identification flowing without ever waiting for the serial port
+        while(pnp_id_left && uart_tx_free()) {
+            uart_putbyte(pgm_read_byte(pnp_id_ptr++) | 0x80); // Every character is sent with the msb set
+            pnp_id_left--;
+        }
+        while(!pnp_id_left && perf_left && uart_tx_free()) {
+            uart_putbyte(*perf_ptr++);
+            perf_left--;
+        }
+        if(!pnp_id_left && !perf_left) {
+            if(trace_on == TRACE_ON_UART) trace_flush(now); // The trace has the serial port to itself
+            else if(dlog_on == DLOG_ON_UART) dlog_flush(now);
+        }
+#if ENABLE_DIAG_UART
+        diagFeed(now);
+#endif
+
+        // Settings for the mouse go out a byte at a time, the reports already received keep being sent meanwhile
+        if(ENABLE_HOSTCMD && mouse_task(now)) { // The PS/2 stream was interrupted, start over
+            ps2_buf_counter = 0;
+            enc_state.half = 0;
+        }
 
-        while(ps2_avail()) {
+        // With the button queue full the next report stays in the PS/2 buffer, and the mouse is held off once that fills up too
+        while(!mouse_busy() && ps2_avail() && (ps2_buf_counter || !sched_full())) {
             last_pkt_time = now;
 
             ps2_pkt_buf[ps2_buf_counter] = ps2_getbyte();
             
             // Wait for a packet that has fixed bit 3 at 1, this is an attempt at a resync
-            if(!ps2_buf_counter && !(ps2_pkt_buf[ps2_buf_counter] & 0x08)) continue;
+            if(!ps2_buf_counter && !(ps2_pkt_buf[ps2_buf_counter] & 0x08)) {
+                PERF_INC(resyncs);
+                continue;
+            }
 
             ps2_buf_counter = (ps2_buf_counter + 1) % ps2_pkt_size;
 
             if(!ps2_buf_counter) {
-                converter_result = ps2bufToSer(ps2_pkt_buf, serial_pkt_buf);
-
-                if(converter_result && !rts_disable_xmit) {
-                    ps2_enable_recv(0); // Ok, stop receiving for now
-
-                    // debug prints
-                    if(!opts.u.standard_mode) {
-                        printf("PS/2  <-- %02X %02X %02X %02X\n", ps2_pkt_buf[0], ps2_pkt_buf[1], ps2_pkt_buf[2], ps2_pkt_buf[3]);
-                        printf("RS232 --> %02X %02X %02X %02X\n\n", serial_pkt_buf[0], serial_pkt_buf[1], serial_pkt_buf[2], serial_pkt_buf[3]);
-                    } else { // Running normally
-                        // Transmit the converted data to the serial port
-                        uart_putchar(serial_pkt_buf[0], NULL);
-                        uart_putchar(serial_pkt_buf[1], NULL);
-                        uart_putchar(serial_pkt_buf[2], NULL);
-                        if(!cfg_force_ms) uart_putchar(serial_pkt_buf[3], NULL); // Send the fourth byte, according to the Microsoft Wheel mouse specs
-                    }
+#if ENABLE_PERF
+                if(!sched_pending()) wait_stamp = ps2_stamp(); // Nothing older is waiting
+#endif
+                motion_scale(ps2_pkt_buf); // Per report, so the acceleration follows the mouse and not the serial speed
+                sched_report(ps2_pkt_buf, now);
+            }
+        }
 
-                    ps2_enable_recv(1); // Back to getting data!
-                }
+        // The last packet has left the serial port, see how long it took since its report came in from the mouse
+        if(ENABLE_PERF && lat_pending && uart_tx_empty()) {
+            lat_pending = 0;
+            PERF_HIST(latency, uart_tx_end_stamp() - pkt_stamp);
+        }
+
+        // Next transmit slot: the last packet is leaving the serial port, so whatever we send now
+        // goes out right after it. Button changes get the slot first, the movement fills the others.
+        // In prompt mode a report is sent only when the host asks, even if nothing changed, once the mouse answered.
+        if((prompt_mode ? (poll_pending && !mouse_busy()) : sched_pending()) && uart_tx_empty() && !pnp_id_left && !perf_left) {
+            poll_pending = 0;
+
+            if(!enc_state.half) { // A Mouse Systems packet keeps the stamp of its first half
+                pkt_stamp = wait_stamp;
+                pkt_stamped = sched_pending(); // In prompt mode the report might carry nothing
             }
+            if(sched_pending()) PERF_HIST(wait, millis_stamp() - wait_stamp);
+
+            sched_next(out_pkt_buf);
+
+            converter_result = proto.encode(out_pkt_buf, serial_pkt_buf, &enc_state);
+
+            if(converter_result) xmitSerPkt(out_pkt_buf, serial_pkt_buf, converter_result, !opts.u.standard_mode);
+            else if(enc_state.half) msys_half_time = now;
+        }
+
+        // Nothing came to fill the second half in time, send the Mouse Systems packet as it is
+        if(enc_state.half && !perf_left && ((now - msys_half_time) > MSYS_HALF_TIMEOUT)) {
+            enc_state.half = 0;
+            xmitSerPkt(out_pkt_buf, serial_pkt_buf, proto.pkt_size, !opts.u.standard_mode);
         }
 
-        if(!opts.u.powersave && ((now - last_pkt_time) > SLEEP_DELAY_TIME)) { 
-            sleepMode(!opts.u.standard_mode);
+        // In prompt mode the mouse stays quiet until the host asks, so it would never wake us up
+        if(!opts.u.powersave && !prompt_mode && ((now - last_pkt_time) > SLEEP_DELAY_TIME)) { 
+            sleepMode();
             last_pkt_time = millis();
             ps2_buf_counter = 0;
+            enc_state.half = 0;
         }
     }
 
@@ -197,60 +348,273 @@ int main(void) {
 
 static void rts_init(void) {
     // Enable INT1, and have it toggle at any logical level change
-#if defined (__AVR_ATmega328P__)
-    // Toggle at the rising edge
-    EICRA |= _BV(ISC10);
-    EICRA &= ~_BV(ISC11);
-    EIMSK |= _BV(INT1);
-#elif defined (__AVR_ATmega8A__)
-    MCUCR |= _BV(ISC10);
-    MCUCR &= ~_BV(ISC11);
-    GICR  |= _BV(INT1);
-#endif
+    hal_rts_init();
 }
 
 static void setLED(uint8_t status) {
-    if(!status) LEDPORT &= ~(_BV(LED_P)); // Turn the LED off
-    else LEDPORT |= _BV(LED_P); // Turn the LED on
+    hal_led(status); // Turn the LED on or off
 }
 
 static void blinkLED(uint8_t times, uint8_t fast) {
     setLED(0);
 
     while(times--) {
-        wdt_reset();
+        hal_wdt_kick();
 
         setLED(1);
-        fast ? _delay_ms(50) : _delay_ms(100);
+        fast ? hal_delay_ms(50) : hal_delay_ms(100);
         setLED(0);
-        fast ? _delay_ms(50) : _delay_ms(100);
+        fast ? hal_delay_ms(50) : hal_delay_ms(100);
+    }
+}
+
+HAL_ISR(HAL_VECT_RTS) { // Manage INT1
+    rts_toggled = 1; // The main loop will take care of it, without blocking here
+    PERF_INC(rts);
+    TRACE(TRACE_RTS, 0);
+}
+
+// Send the identification of the protocol in use: the legacy one goes straight to the serial port,
+// the Plug and Play COM ID is fed by the main loop as room frees up
+static void sendIdent(uint8_t debug) {
+    if(dlog_on) { // With the free stack: toggling RTS is how debug mode asks for it, also without the host commands
+        uint16_t stack = perf_stack_free();
+
+#if ENABLE_PERF
+        DLOG(DLOG_IDENT, proto.id, perf_stats.rts & 0xFF, perf_stats.rts >> 8, stack & 0xFF, stack >> 8);
+#else
+        DLOG(DLOG_IDENT, proto.id, 0, 0, stack & 0xFF, stack >> 8); // No RTS count without the counters
+#endif
     }
+    if(debug) return;
+
+    for(uint8_t idx = 0; idx < proto.ident_len; idx++) uart_putbyte(pgm_read_byte(&proto.ident[idx]) | 0x80);
+
+    pnp_id_ptr = proto.pnp_id;
+    pnp_id_left = proto.pnp_id_len;
 }
 
-ISR(INT1_vect) { // Manage INT1
-    rts_disable_xmit = 1; // Avoid further transmission from the code in the main loop
+// Returns 0 if the protocol is not built into the firmware
+static uint8_t setProto(uint8_t new_proto) {
+    if(!serproto_get(new_proto, &proto)) return 0;
+
+    enc_state.half = 0; // Whatever was pending belongs to the old protocol
+    sched_reset(enc_state.five_btns, proto.flags & SERPROTO_WHEEL);
+
+    uart_setformat(proto.format);
+
+    return 1;
+}
 
-    sendDetectPkt();
-    _delay_ms(10);
+// The mouse settings are only queued here, see mouse_task()
+static void execHostCmd(const HostCmd *cmd, ConfigStruct *cfg) {
+    uint8_t value = 0, valid = 1;
+
+    DLOG(DLOG_HOSTCMD, cmd->cmd, cmd->arg, cmd->val, 0, 0);
+
+    switch(cmd->cmd) {
+        case HOSTCMD_SETBAUD:
+            uart_setbaud(cmd->arg);
+            return;
+        case HOSTCMD_SETRATE:
+            ps2_rate = cmd->arg;
+            prompt_mode = 0;
+            mouse_setrate(ps2_rate);
+            return;
+        case HOSTCMD_SETRES:
+            ps2_res = cmd->arg;
+            mouse_setres(ps2_res);
+            return;
+        case HOSTCMD_PROMPT:
+            prompt_mode = 1;
+            poll_pending = 0;
+            mouse_setprompt();
+            return;
+        case HOSTCMD_POLL:
+            if(prompt_mode) {
+                poll_pending = 1;
+                mouse_poll(); // The report will come through the usual path
+            }
+            return;
+        case HOSTCMD_SETPROTO:
+            setProto(cmd->arg);
+            return;
+        case HOSTCMD_SETPARAM:
+            switch(cmd->arg) {
+                case HOSTPARAM_PROTO:
+                    valid = setProto(cmd->val);
+                    break;
+                case HOSTPARAM_RES:
+                    valid = (cmd->val < 4);
+                    if(valid) {
+                        ps2_res = cmd->val;
+                        mouse_setres(ps2_res);
+                    }
+                    break;
+                case HOSTPARAM_RATE:
+                    valid = mouse_validrate(cmd->val);
+                    if(valid) {
+                        ps2_rate = cmd->val;
+                        prompt_mode = 0;
+                        mouse_setrate(ps2_rate);
+                    }
+                    break;
+                case HOSTPARAM_BAUD:
+                    valid = (cmd->val < UART_BAUD_COUNT);
+                    break;
+                case HOSTPARAM_TRACE:
+                    valid = (cmd->val < (ENABLE_TRACE ? 2 : 1)) && (trace_on != TRACE_ON_DIAG); // Only 0 without the capture
+                    break;
+#if ENABLE_DIAG_UART
+                case HOSTPARAM_DIAG:
+                    valid = (cmd->val <= (DIAG_OUT_STATS | DIAG_OUT_LOG)) || (cmd->val == DIAG_OUT_TRACE);
+                    if((cmd->val & DIAG_OUT_STATS) && !ENABLE_PERF) valid = 0;
+                    if((cmd->val & DIAG_OUT_LOG) && (!ENABLE_DLOG || (dlog_on == DLOG_ON_UART))) valid = 0; // Debug mode, the log has the serial port
+                    if((cmd->val & DIAG_OUT_TRACE) && (!ENABLE_TRACE || (trace_on == TRACE_ON_UART))) valid = 0;
+                    if(valid) setDiag(cmd->val);
+                    break;
+#endif
+                case HOSTPARAM_SCALE_X:
+                case HOSTPARAM_SCALE_Y:
+                    valid = (cmd->val != 0) && ENABLE_MOTION_SCALE;
+                    if(valid) {
+                        if(cmd->arg == HOSTPARAM_SCALE_X) scale_x = (uint16_t)cmd->val << 4; // Q4.4 to Q8.8
+                        else scale_y = (uint16_t)cmd->val << 4;
+                        motion_setscale(scale_x, scale_y);
+                    }
+                    break;
+                case HOSTPARAM_ACCEL:
+                    valid = (cmd->val < MOTION_ACCEL_COUNT) && ENABLE_MOTION_SCALE;
+                    if(valid) {
+                        accel = cmd->val;
+                        motion_setaccel(accel);
+                    }
+                    break;
+                case HOSTPARAM_DETENTS:
+                    valid = (cmd->val >= MOTION_DETENTS_MIN) && (cmd->val <= MOTION_DETENTS_MAX);
+                    if(valid) {
+                        detents = cmd->val;
+                        motion_setdetents(detents);
+                    }
+                    break;
+                case HOSTPARAM_POLICY:
+                case HOSTPARAM_MAX_LAG:
+                    valid = (cmd->arg == HOSTPARAM_POLICY) ? (cmd->val < SCHED_POLICY_COUNT) : (cmd->val >= SCHED_LAG_MIN);
+                    if(valid) {
+                        if(cmd->arg == HOSTPARAM_POLICY) out_policy = cmd->val;
+                        else max_lag = cmd->val;
+                        sched_setpolicy(out_policy, max_lag);
+                    }
+                    break;
+                case HOSTPARAM_SAVE:
+                    valid = (cmd->val == 1);
+                    if(valid) {
+                        cfg->cfg_data.c.scale_x = scale_x;
+                        cfg->cfg_data.c.scale_y = scale_y;
+                        cfg->cfg_data.c.accel = accel;
+                        cfg->cfg_data.c.detents = detents;
+                        cfg->cfg_data.c.policy = out_policy;
+                        cfg->cfg_data.c.max_lag = max_lag;
+                        write_perm_config(cfg);
+                    }
+                    break;
+                default:
+                    valid = 0;
+                    break;
+            }
+            // fall through, reply with the current value
+        case HOSTCMD_GETPARAM:
+            switch(cmd->arg) {
+                case HOSTPARAM_PROTO: value = proto.id; break;
+                case HOSTPARAM_RES: value = ps2_res; break;
+                case HOSTPARAM_RATE: value = ps2_rate; break;
+                case HOSTPARAM_BAUD: value = (cmd->cmd == HOSTCMD_SETPARAM) ? cmd->val : uart_getbaud(); break;
+                case HOSTPARAM_SCALE_X: value = scaleToQ44(scale_x); break;
+                case HOSTPARAM_SCALE_Y: value = scaleToQ44(scale_y); break;
+                case HOSTPARAM_SAVE: value = 0; break;
+                case HOSTPARAM_ACCEL: value = accel; break;
+                case HOSTPARAM_DETENTS: value = detents; break;
+                case HOSTPARAM_POLICY: value = out_policy; break;
+                case HOSTPARAM_MAX_LAG: value = max_lag; break;
+                case HOSTPARAM_TRACE: value = (cmd->cmd == HOSTCMD_SETPARAM) ? cmd->val : (trace_on == TRACE_ON_UART); break;
+#if ENABLE_DIAG_UART
+                case HOSTPARAM_DIAG: value = diag_out; break;
+#endif
+                default: valid = 0; break;
+            }
 
-    rts_disable_xmit = 0; // Allow transmission again
+            uart_putbyte(valid ? HOSTCMD_REPLY_OK : HOSTCMD_REPLY_ERR);
+            uart_putbyte(cmd->arg);
+            if(valid) uart_putbyte(value);
+
+            // Speed changes only after the reply went out at the old speed
+            if(valid && (cmd->cmd == HOSTCMD_SETPARAM) && (cmd->arg == HOSTPARAM_BAUD)) uart_setbaud(cmd->val);
+            if(valid && (cmd->cmd == HOSTCMD_SETPARAM) && (cmd->arg == HOSTPARAM_TRACE) && (cmd->val != (trace_on == TRACE_ON_UART))) {
+                if(cmd->val) {
+                    trace_baud = uart_getbaud();
+                    uart_setbaud(UART_BAUD_250000);
+                    trace_start(TRACE_ON_UART);
+                } else {
+                    trace_stop();
+                    uart_setbaud(trace_baud);
+                }
+            }
+            return;
+#if ENABLE_PERF
+        case HOSTCMD_STATS:
+            takeStats(&perf_snap);
+
+            uart_putbyte(HOSTCMD_REPLY_STATS);
+            uart_putbyte(sizeof(PerfStats));
+            perf_ptr = (const uint8_t *)&perf_snap; // The rest is fed by the main loop, also between the debug events
+            perf_left = sizeof(PerfStats);
+            return;
+#endif
+        case HOSTCMD_NONE:
+        default:
+            return;
+    }
 }
 
-static void sendMSPkt(void) {
-    uart_putchar('M' | 0x80, NULL);
+#if ENABLE_PERF
+// Snapshot of the performance counters, with the ones the main loop fills in
+static void takeStats(PerfStats *snap) {
+    perf_get(snap);
+    snap->ser_merged = sched_stats()->merged;
+    snap->ser_dropped = sched_stats()->dropped;
+    snap->ser_clamped = sched_stats()->clamped;
+    snap->stack_free = perf_stack_free();
 }
+#endif
 
-static void sendMSWheelPkt(void) {
-    uart_putchar('M' | 0x80, NULL);
-    uart_putchar('Z' | 0x80, NULL);
-    uart_putchar('@' | 0x80, NULL);
-    uart_putchar(0x80, NULL);
-    uart_putchar(0x80, NULL);
-    uart_putchar(0x80, NULL);
+// Q8.8 sensitivity to the Q4.4 format used by the host commands, rounded
+static uint8_t scaleToQ44(uint16_t scale) {
+    return (scale >= 0x0FF0) ? 0xFF : ((scale + 0x08) >> 4);
 }
 
-static void sendDebugPkt(void) {
-    printf("DETECT_PKT\n");
+static void xmitSerPkt(const uint8_t *ps2_buf, const uint8_t *ser_buf, uint8_t len, uint8_t debug) {
+    if(pnp_id_left) return; // The host is busy identifying us
+    if(trace_on == TRACE_ON_UART) return; // The serial line carries the trace
+
+    if(dlog_on) { // Logged, the scheduler counters only when they changed
+        const SchedStats *sst = sched_stats();
+
+        DLOG(DLOG_PS2_PKT, ps2_buf[0], ps2_buf[1], ps2_buf[2], ps2_buf[3], 0);
+        DLOG(DLOG_SER_PKT, len, ser_buf[0], ser_buf[1], ser_buf[2], (len > 3) ? ser_buf[3] : 0);
+        if(len > 4) DLOG(DLOG_SER_TAIL, ser_buf[4], 0, 0, 0, 0);
+        if(sched_stats_changed()) {
+            DLOG(DLOG_SCHED, sst->merged & 0xFF, sst->merged >> 8, sst->dropped & 0xFF, sst->dropped >> 8, sst->btn_full & 0xFF);
+            DLOG(DLOG_SCHED_TAIL, sst->clamped & 0xFF, sst->clamped >> 8, sst->dropped_counts & 0xFF, sst->dropped_counts >> 8, 0);
+        }
+    }
+
+    if(!debug) { // Running normally, debug mode only logs the packet
+        // Transmit the converted data to the serial port
+        for(uint8_t idx = 0; idx < len; idx++) uart_putbyte(ser_buf[idx]);
+        lat_pending = pkt_stamped;
+    }
+
+    PERF_INC(ser_sent);
 }
 
 static void update_configuration(uint8_t buttons, ConfigStruct *cfg) {
@@ -262,18 +626,21 @@ static void update_configuration(uint8_t buttons, ConfigStruct *cfg) {
             soft_reset();
             break;
         case 4: // Left button, change protocol
-            cfg->cfg_data.c.proto = !(cfg->cfg_data.c.proto);
+            cfg->cfg_data.c.proto = serproto_next(cfg->cfg_data.c.proto); // Only the protocols built into the firmware
             write_perm_config(cfg);
             blinkLED(10, 0);
+            hal_delay_ms(500);
+            blinkLED(cfg->cfg_data.c.proto + 1, 0);
+            hal_delay_ms(500);
             soft_reset();
             break;
         case 1: // Right button, change resolution
             cfg->cfg_data.c.res = (cfg->cfg_data.c.res + 1) % 4;
             write_perm_config(cfg);
             blinkLED(3, 0);
-            _delay_ms(500);
+            hal_delay_ms(500);
             blinkLED(cfg->cfg_data.c.res + 1, 0);
-            _delay_ms(500);
+            hal_delay_ms(500);
             soft_reset();
             break;
         case 0: // Nothing to do
@@ -282,44 +649,88 @@ static void update_configuration(uint8_t buttons, ConfigStruct *cfg) {
     }
 }
 
+// Sensitivity, acceleration, wheel and output policy, as stored
+static void loadSettings(const ConfigStruct *cfg) {
+    scale_x = cfg->cfg_data.c.scale_x;
+    scale_y = cfg->cfg_data.c.scale_y;
+    motion_setscale(scale_x, scale_y);
+    accel = cfg->cfg_data.c.accel;
+    motion_setaccel(accel);
+    detents = cfg->cfg_data.c.detents;
+    motion_setdetents(detents);
+    out_policy = cfg->cfg_data.c.policy;
+    max_lag = cfg->cfg_data.c.max_lag;
+    sched_setpolicy(out_policy, max_lag);
+}
+
 static void soft_reset(void) {
-    wdt_enable(WDTO_15MS);  
-    while(1); // This will reset the unit
+    hal_wdt_expire(); // This will reset the unit
 }
 
-void sleepMode(uint8_t debug) {
-    if(debug) printf("sleepMode() - Sleeping!!!\n\n");
+void sleepMode(void) {
+    PERF_INC(sleeps);
+    DLOG(DLOG_SLEEP, 0, 0, 0, 0, 0);
+    TRACE(TRACE_SLEEP, 0);
+#if ENABLE_DIAG_UART
+    while(diag_perf_left) { // Not half a block, the reader would lose track
+        diagFeed(millis());
+        hal_spin();
+    }
+#endif
+    trace_drain(); // The UARTs stop with the clock
+    dlog_drain();
+#if ENABLE_DIAG_UART
+    while(!diag_tx_empty()) hal_spin();
+    hal_delay_ms(1); // The last stop bit
+#endif
+
+    hal_wdt_stop();
 
-    wdt_disable();
+    // Go to sleep now, the PS/2 clock wakes us up
+    hal_sleep_powerdown();
 
-    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
-    cli();
+    hal_wdt_start(); // Enable the watchdog again
+    TRACE(TRACE_WAKE, 0);
+    DLOG(DLOG_WAKE, 0, 0, 0, 0, 0);
+}
 
-    // Set INT0 to interrupt on low level (falling edge won't work)
-#if defined (__AVR_ATmega8A__)
-    MCUCR &= ~(_BV(ISC01) | _BV(ISC00));
-#elif defined (__AVR_ATmega328P__)
-    EICRA &= ~(_BV(ISC01) | _BV(ISC00));
-#endif
+#if ENABLE_DIAG_UART
+static void setDiag(uint8_t out) {
+    if((out ^ diag_out) & DIAG_OUT_TRACE) {
+        if(out & DIAG_OUT_TRACE) trace_start(TRACE_ON_DIAG);
+        else trace_stop();
+    }
+    if((out ^ diag_out) & DIAG_OUT_LOG) {
+        if(out & DIAG_OUT_LOG) dlog_start(DLOG_ON_DIAG);
+        else dlog_stop();
+    }
 
-    // Go to sleep now...
-    sleep_enable();
-    sei();
-    sleep_cpu();
-    sleep_disable();
-
-    // Restore interrupt on falling edge for INT0
-#if defined (__AVR_ATmega8A__)
-    MCUCR |= _BV(ISC01);
-#elif defined (__AVR_ATmega328P__)
-    EICRA |= _BV(ISC01);
+    diag_out = out;
+}
+
+// Feed the diagnostic output: the counters when they are due, a whole block before anything else, then the
+// trace or the log. Like the serial port, it never waits.
+static void diagFeed(uint32_t now) {
+#if ENABLE_PERF
+    // The header goes out whole, or the reader would lose track
+    if((diag_out & DIAG_OUT_STATS) && !diag_perf_left && ((now - diag_perf_time) >= DIAG_STATS_MS) && (diag_tx_free() >= 2)) {
+        diag_perf_time = now;
+        takeStats(&diag_snap);
+
+        diag_putbyte(HOSTCMD_REPLY_STATS); // Same as the reply to the host
+        diag_putbyte(sizeof(PerfStats));
+        diag_perf_ptr = (const uint8_t *)&diag_snap;
+        diag_perf_left = sizeof(PerfStats);
+    }
 #endif
 
-#if defined (__AVR_ATmega328P__)
-    wdt_enable(WDTO_4S); // Enable the watchdog to reset in 4 seconds...
-#elif defined (__AVR_ATmega8A__)
-    wdt_enable(WDTO_2S); // Enable the watchdog to reset in 2 seconds...
-#endif    
-    
-    if(debug) printf("sleepMode() - Woken Up!!!\n\n");
+    while(diag_perf_left && diag_tx_free()) {
+        diag_putbyte(*diag_perf_ptr++);
+        diag_perf_left--;
+    }
+    if(diag_perf_left) return;
+
+    if(trace_on == TRACE_ON_DIAG) trace_flush(now);
+    else if(dlog_on == DLOG_ON_DIAG) dlog_flush(now);
 }
+#endif
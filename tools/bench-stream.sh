@@ -0,0 +1,17 @@
+#!/bin/sh
+# Runs the throughput and drop rate benchmark on the host build, at the clock of
+# both ATmega328P variants: 16 MHz (Makefile.328p) and 8 MHz (Makefile.328p_8).
+# The host build has every feature in. The ATmega8A firmware is not covered: it
+# has no host commands, so the benchmark could not pick its protocol and speed.
+#
+# Usage: tools/bench-stream.sh [pontag-bench-stream options]
+# Results are left in out/host-<f_cpu>/bench-stream-<f_cpu>.json.
+
+status=0
+for f_cpu in 16000000 8000000; do
+    outdir=out/host-$f_cpu
+    make -f Makefile.host F_CPU=$f_cpu OUTDIR=$outdir $outdir/pontag-bench-stream > /dev/null || exit 1
+    $outdir/pontag-bench-stream -o $outdir/bench-stream-$f_cpu.json "$@" || status=1
+done
+
+exit $status
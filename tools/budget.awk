@@ -0,0 +1,27 @@
+# Checks the memory used by the firmware against the size of the MCU
+#
+# Flash holds .text and the initial values in .data, SRAM holds .data, .bss and .noinit.
+# What is left of the SRAM is all the stack gets, so the build fails when that
+# or the free flash drop below the given headroom.
+#
+# Usage: avr-size -A firmware.elf | awk -f tools/budget.awk -v mcu=atmega8a \
+#            -v flash=7680 -v ram=1024 -v flash_min=512 -v ram_min=256
+
+$1 == ".text" || $1 == ".data" { flash_used += $2 }
+$1 == ".data" || $1 == ".bss" || $1 == ".noinit" { ram_used += $2 }
+
+function report(name, used, size, min) {
+    printf "%-6s %6u used (%3u%%) of %6u, %6u free, needs %u\n", name, used, (100 * used) / size, size, size - used, min
+    if((size - used) < min) {
+        printf "ERROR: %s headroom on %s is below %u bytes\n", name, mcu, min
+        return 1
+    }
+    return 0
+}
+
+END {
+    print "Memory budget for " mcu ":"
+    fail = report("Flash", flash_used, flash, flash_min)
+    fail += report("SRAM", ram_used, ram, ram_min)
+    exit (fail ? 1 : 0)
+}
@@ -0,0 +1,81 @@
+# Generates a C header with the Plug and Play COM IDs listed in src/pnp_ids.def
+#
+# Every character is stored in the 6-bit format used on the wire (ASCII - 0x20),
+# the checksum is the sum of all the 6-bit characters between '(' and ')' included.
+#
+# Usage: awk -f tools/pnpgen.awk src/pnp_ids.def > out/pnp_ids.h
+
+BEGIN {
+    PNP_REV = 100 # Plug and Play COM spec revision 1.00
+
+    for(i = 32; i < 96; i++) ord[sprintf("%c", i)] = i
+
+    print "// Generated by tools/pnpgen.awk, do not edit"
+    print "#ifndef _PNP_IDS_H_"
+    print "#define _PNP_IDS_H_"
+    print ""
+    print "#include <stdint.h>"
+    print "#include <avr/pgmspace.h>"
+}
+
+/^[ \t]*#/ || NF == 0 { next }
+
+NF < 5 {
+    print "pnpgen: " FILENAME ":" FNR ": not enough fields" > "/dev/stderr"
+    exit 1
+}
+
+{
+    name = $1
+    fields[1] = $3; fields[2] = $4; fields[3] = $5
+    user = $0
+    sub(/^[ \t]*[^ \t]+[ \t]+[^ \t]+[ \t]+[^ \t]+[ \t]+[^ \t]+[ \t]+[^ \t]+[ \t]*/, "", user)
+    fields[4] = user
+
+    # Only the fields up to the last non-empty one are transmitted
+    last = 0
+    for(f = 1; f <= 4; f++) {
+        if(fields[f] == "-") fields[f] = ""
+        if(fields[f] != "") last = f
+    }
+
+    n = 0
+    out[n++] = ord["("] - 32
+    out[n++] = int(PNP_REV / 64)
+    out[n++] = PNP_REV % 64
+    text = $2
+    for(f = 1; f <= last; f++) text = text "\\" fields[f]
+
+    for(i = 1; i <= length(text); i++) {
+        c = toupper(substr(text, i, 1))
+        if(!(c in ord)) {
+            print "pnpgen: " FILENAME ":" FNR ": invalid character '" c "'" > "/dev/stderr"
+            exit 1
+        }
+        out[n++] = ord[c] - 32
+    }
+
+    if(last) { # The checksum is there only if the extensions are there
+        sum = out[0] + (ord[")"] - 32)
+        for(i = 1; i < n; i++) sum += out[i]
+        csum = sprintf("%02X", sum % 256)
+        out[n++] = ord[substr(csum, 1, 1)] - 32
+        out[n++] = ord[substr(csum, 2, 1)] - 32
+        text = text csum
+    }
+    out[n++] = ord[")"] - 32
+
+    print ""
+    print "// (" text ")"
+    # Marked unused, as the protocol using it may be left out of the build
+    line = "static const uint8_t " name "[] PROGMEM __attribute__((unused)) = {"
+    for(i = 0; i < n; i++) {
+        line = line ((i % 12 == 0) ? "\n    " : " ") sprintf("0x%02X", out[i]) ((i < n - 1) ? "," : "")
+    }
+    print line "\n};"
+}
+
+END {
+    print ""
+    print "#endif /* _PNP_IDS_H_ */"
+}